@@ -74,6 +74,14 @@ int ignore_reduce_failures = 0;
 bool decompress_input = false;
 std::string combine = "";
 bool compress_output = false;
+::baidu::shuttle::sdk::CompressionType shuffle_compression = \
+    ::baidu::shuttle::sdk::kSnappy;
+std::string nfs_work_dir;
+std::string merge_combiner;
+bool pipelined_shuffle = false;
+bool local_shuffle = false;
+bool push_shuffle = false;
+bool host_shuffle = false;
 }
 
 const std::string error_message = "shuttle client - A fast computing framework base on Galaxy\n"
@@ -117,6 +125,13 @@ const std::string error_message = "shuttle client - A fast computing framework b
         "\t  mapred.ignore.reduce.failures\t\tSpecify the maximum number of failed-reduce ignored\n"
         "\t  mapred.decompress.input \t\t Allow decompress input file\n"
         "\t  mapred.output.compress \t\t Allow compress output file\n"
+        "\t  mapred.map.output.compression.codec\tSpecify the codec of shuffle data: snappy/lz4/zstd/none\n"
+        "\t  mapred.shuffle.nfs.dir\t\tKeep shuffle data in this dir on a nfs mount instead of hdfs\n"
+        "\t  mapred.shuffle.merge.combiner\tCombine records of a key when merging map outputs: sum\n"
+        "\t  mapred.shuffle.local\t\tMerge the records of a reduce task on its local disk instead of in tuo files\n"
+        "\t  mapred.shuffle.pipelined\tStart reduce tasks early, fetching each map as it is done, implies local\n"
+        "\t  mapred.shuffle.push\t\tMaps push records to the running reduce tasks, the shuffle fs keeps the rest, implies local\n"
+        "\t  mapred.shuffle.host\t\tMap spills stay on the minions running the maps, which serve them to reduce tasks, implies local\n"
         "\t  mapred.map.max.attempts\t\tSpecify the maximum number of retries per each map task\n"
         "\t  mapred.job.check.counters\t\tEnable checking job counters\n"
         "\t  mapred.reduce.max.attempts\t\tSpecify the maximum number of retries per each reduce tasks\n"
@@ -186,6 +201,9 @@ ParsePartitioner(const std::string& partitioner) {
     } else if (boost::iequals(partitioner, "inthash") ||
             boost::iequals(partitioner, "inthashpartitioner")) {
         return ::baidu::shuttle::sdk::kIntHash;
+    } else if (boost::iequals(partitioner, "totalorder") ||
+            boost::iequals(partitioner, "totalorderpartitioner")) {
+        return ::baidu::shuttle::sdk::kTotalOrder;
     }
     return ::baidu::shuttle::sdk::kKeyFieldBased;
 }
@@ -216,6 +234,18 @@ ParseOutputFormat(const std::string& output_format) {
     return ::baidu::shuttle::sdk::kTextOutput;
 }
 
+static inline ::baidu::shuttle::sdk::CompressionType
+ParseCompressionCodec(const std::string& codec) {
+    if (boost::iequals(codec, "lz4")) {
+        return ::baidu::shuttle::sdk::kLz4;
+    } else if (boost::iequals(codec, "zstd")) {
+        return ::baidu::shuttle::sdk::kZstd;
+    } else if (boost::iequals(codec, "none")) {
+        return ::baidu::shuttle::sdk::kNoCompression;
+    }
+    return ::baidu::shuttle::sdk::kSnappy;
+}
+
 static bool ParseBooleanValue(const std::string& boolean) {
     if (boost::iequals(boolean, "true") ||
             boost::iequals(boolean, "1")) {
@@ -471,6 +501,25 @@ static void ParseJobConfig() {
         } else if(boost::starts_with(*it, "mapred.output.compress=")) {
             config::compress_output = 
                ParseBooleanValue(it->substr(strlen("mapred.output.compress=")));
+        } else if(boost::starts_with(*it, "mapred.map.output.compression.codec=")) {
+            config::shuffle_compression = ParseCompressionCodec(
+               it->substr(strlen("mapred.map.output.compression.codec=")));
+        } else if(boost::starts_with(*it, "mapred.shuffle.nfs.dir=")) {
+            config::nfs_work_dir = it->substr(strlen("mapred.shuffle.nfs.dir="));
+        } else if(boost::starts_with(*it, "mapred.shuffle.merge.combiner=")) {
+            config::merge_combiner = it->substr(strlen("mapred.shuffle.merge.combiner="));
+        } else if(boost::starts_with(*it, "mapred.shuffle.pipelined=")) {
+            config::pipelined_shuffle =
+               ParseBooleanValue(it->substr(strlen("mapred.shuffle.pipelined=")));
+        } else if(boost::starts_with(*it, "mapred.shuffle.local=")) {
+            config::local_shuffle =
+               ParseBooleanValue(it->substr(strlen("mapred.shuffle.local=")));
+        } else if(boost::starts_with(*it, "mapred.shuffle.push=")) {
+            config::push_shuffle =
+               ParseBooleanValue(it->substr(strlen("mapred.shuffle.push=")));
+        } else if(boost::starts_with(*it, "mapred.shuffle.host=")) {
+            config::host_shuffle =
+               ParseBooleanValue(it->substr(strlen("mapred.shuffle.host=")));
         }
     }
 }
@@ -851,6 +900,13 @@ static int SubmitJob() {
     job_desc.decompress_input = config::decompress_input;
     job_desc.compress_output = config::compress_output;
     job_desc.cmdenvs = config::cmdenvs;
+    job_desc.shuffle_compression = config::shuffle_compression;
+    job_desc.nfs_work_dir = config::nfs_work_dir;
+    job_desc.merge_combiner = config::merge_combiner;
+    job_desc.pipelined_shuffle = config::pipelined_shuffle;
+    job_desc.local_shuffle = config::local_shuffle;
+    job_desc.push_shuffle = config::push_shuffle;
+    job_desc.host_shuffle = config::host_shuffle;
 
     std::string jobid;
     bool ok = shuttle->SubmitJob(job_desc, jobid);
@@ -0,0 +1,101 @@
+#include "bloom_filter.h"
+#include <string.h>
+
+namespace baidu {
+namespace shuttle {
+
+static uint32_t BloomHash(const Slice& key) {
+    //murmur-like hash, the same as leveldb uses for its filters
+    const uint32_t seed = 0xbc9f1d34;
+    const uint32_t m = 0xc6a4a793;
+    const uint32_t r = 24;
+    const char* data = key.data();
+    const char* limit = data + key.size();
+    uint32_t h = seed ^ (key.size() * m);
+    while (data + 4 <= limit) {
+        uint32_t w;
+        memcpy(&w, data, sizeof(w));
+        data += 4;
+        h += w;
+        h *= m;
+        h ^= (h >> 16);
+    }
+    switch (limit - data) {
+    case 3:
+        h += static_cast<unsigned char>(data[2]) << 16;
+        //fall through
+    case 2:
+        h += static_cast<unsigned char>(data[1]) << 8;
+        //fall through
+    case 1:
+        h += static_cast<unsigned char>(data[0]);
+        h *= m;
+        h ^= (h >> r);
+        break;
+    }
+    return h;
+}
+
+BloomFilterBuilder::BloomFilterBuilder(int bits_per_key) : bits_per_key_(bits_per_key) {
+    //ln(2) * bits_per_key minimizes the false positive rate
+    num_probes_ = static_cast<int>(bits_per_key * 0.69);
+    if (num_probes_ < 1) {
+        num_probes_ = 1;
+    }
+    if (num_probes_ > 30) {
+        num_probes_ = 30;
+    }
+}
+
+void BloomFilterBuilder::AddKey(const Slice& key) {
+    hashes_.push_back(BloomHash(key));
+}
+
+void BloomFilterBuilder::Finish(std::string* filter) {
+    size_t bits = hashes_.size() * bits_per_key_;
+    if (bits < 64) {
+        bits = 64; //avoid a high false positive rate for few keys
+    }
+    size_t bytes = (bits + 7) / 8;
+    bits = bytes * 8;
+    filter->assign(bytes, '\0');
+    filter->push_back(static_cast<char>(num_probes_));
+    char* array = &(*filter)[0];
+    std::vector<uint32_t>::iterator it;
+    for (it = hashes_.begin(); it != hashes_.end(); it++) {
+        //double hashing to generate the probes
+        uint32_t h = *it;
+        const uint32_t delta = (h >> 17) | (h << 15);
+        for (int j = 0; j < num_probes_; j++) {
+            const uint32_t bitpos = h % bits;
+            array[bitpos / 8] |= (1 << (bitpos % 8));
+            h += delta;
+        }
+    }
+}
+
+bool BloomFilterMayMatch(const Slice& key, const Slice& filter) {
+    const size_t len = filter.size();
+    if (len < 2) {
+        return true;
+    }
+    const char* array = filter.data();
+    const size_t bits = (len - 1) * 8;
+    const int num_probes = array[len - 1];
+    if (num_probes <= 0 || num_probes > 30) {
+        return true; //unknown encoding, consider it a match
+    }
+    uint32_t h = BloomHash(key);
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (int j = 0; j < num_probes; j++) {
+        const uint32_t bitpos = h % bits;
+        if ((array[bitpos / 8] & (1 << (bitpos % 8))) == 0) {
+            return false;
+        }
+        h += delta;
+    }
+    return true;
+}
+
+} //namespace shuttle
+} //namespace baidu
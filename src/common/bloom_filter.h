@@ -0,0 +1,32 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_BLOOM_FILTER_H_
+#define _BAIDU_SHUTTLE_COMMON_BLOOM_FILTER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common/slice.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Collects keys and builds a bloom filter over them,
+// filter layout: [bit array][number of probes, 1 byte]
+class BloomFilterBuilder {
+public:
+    explicit BloomFilterBuilder(int bits_per_key);
+    void AddKey(const Slice& key);
+    size_t NumKeys() const { return hashes_.size(); }
+    void Finish(std::string* filter);
+private:
+    int bits_per_key_;
+    int num_probes_;
+    std::vector<uint32_t> hashes_;
+};
+
+// false means the key is definitely not in the filter
+bool BloomFilterMayMatch(const Slice& key, const Slice& filter);
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
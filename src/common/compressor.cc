@@ -0,0 +1,160 @@
+#include "compressor.h"
+#include <string.h>
+#include <stdint.h>
+#include <snappy.h>
+#include <lz4.h>
+#include <zstd.h>
+
+namespace baidu {
+namespace shuttle {
+
+// favor speed, shuffle data is written once and read once
+const static int sZstdLevel = 1;
+
+class NoCompressor : public Compressor {
+public:
+    virtual CompressionType Type() {
+        return kNoCompression;
+    }
+    virtual bool Compress(const char* input, size_t length, std::string* output) {
+        output->assign(input, length);
+        return true;
+    }
+    virtual bool Uncompress(const char* input, size_t length, std::string* output) {
+        output->assign(input, length);
+        return true;
+    }
+};
+
+class SnappyCompressor : public Compressor {
+public:
+    virtual CompressionType Type() {
+        return kSnappy;
+    }
+    virtual bool Compress(const char* input, size_t length, std::string* output) {
+        output->clear();
+        snappy::Compress(input, length, output);
+        return true;
+    }
+    virtual bool Uncompress(const char* input, size_t length, std::string* output) {
+        output->clear();
+        return snappy::Uncompress(input, length, output);
+    }
+};
+
+class Lz4Compressor : public Compressor {
+public:
+    virtual CompressionType Type() {
+        return kLz4;
+    }
+    //lz4 block format does not keep the raw size: [raw size][lz4 block]
+    virtual bool Compress(const char* input, size_t length, std::string* output) {
+        if (length > (size_t)LZ4_MAX_INPUT_SIZE) {
+            return false;
+        }
+        uint32_t raw_size = length;
+        int bound = LZ4_compressBound(length);
+        output->resize(sizeof(raw_size) + bound);
+        memcpy(&(*output)[0], &raw_size, sizeof(raw_size));
+        int n = LZ4_compress_default(input, &(*output)[sizeof(raw_size)], length, bound);
+        if (n <= 0) {
+            return false;
+        }
+        output->resize(sizeof(raw_size) + n);
+        return true;
+    }
+    virtual bool Uncompress(const char* input, size_t length, std::string* output) {
+        uint32_t raw_size;
+        if (length < sizeof(raw_size)) {
+            return false;
+        }
+        memcpy(&raw_size, input, sizeof(raw_size));
+        if (raw_size > (uint32_t)LZ4_MAX_INPUT_SIZE) {
+            return false;
+        }
+        output->resize(raw_size);
+        if (raw_size == 0) {
+            return true;
+        }
+        int n = LZ4_decompress_safe(input + sizeof(raw_size), &(*output)[0],
+                                    length - sizeof(raw_size), raw_size);
+        return n == (int)raw_size;
+    }
+};
+
+class ZstdCompressor : public Compressor {
+public:
+    virtual CompressionType Type() {
+        return kZstd;
+    }
+    virtual bool Compress(const char* input, size_t length, std::string* output) {
+        size_t bound = ZSTD_compressBound(length);
+        output->resize(bound);
+        size_t n = ZSTD_compress(&(*output)[0], bound, input, length, sZstdLevel);
+        if (ZSTD_isError(n)) {
+            return false;
+        }
+        output->resize(n);
+        return true;
+    }
+    virtual bool Uncompress(const char* input, size_t length, std::string* output) {
+        unsigned long long raw_size = ZSTD_getFrameContentSize(input, length);
+        if (raw_size == ZSTD_CONTENTSIZE_UNKNOWN || raw_size == ZSTD_CONTENTSIZE_ERROR) {
+            return false;
+        }
+        output->resize(raw_size);
+        if (raw_size == 0) {
+            return true;
+        }
+        size_t n = ZSTD_decompress(&(*output)[0], raw_size, input, length);
+        return !ZSTD_isError(n) && n == raw_size;
+    }
+};
+
+Compressor* Compressor::Create(CompressionType type) {
+    switch (type) {
+    case kNoCompression:
+        return new NoCompressor();
+    case kSnappy:
+        return new SnappyCompressor();
+    case kLz4:
+        return new Lz4Compressor();
+    case kZstd:
+        return new ZstdCompressor();
+    default:
+        return NULL;
+    }
+}
+
+bool Compressor::ParseName(const std::string& name, CompressionType* type) {
+    if (name == "snappy") {
+        *type = kSnappy;
+    } else if (name == "lz4") {
+        *type = kLz4;
+    } else if (name == "zstd") {
+        *type = kZstd;
+    } else if (name == "none") {
+        *type = kNoCompression;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string Compressor::Name(CompressionType type) {
+    switch (type) {
+    case kNoCompression:
+        return "none";
+    case kSnappy:
+        return "snappy";
+    case kLz4:
+        return "lz4";
+    case kZstd:
+        return "zstd";
+    default:
+        return "unknown";
+    }
+}
+
+} //namespace shuttle
+} //namespace baidu
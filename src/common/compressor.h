@@ -0,0 +1,29 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_COMPRESSOR_H_
+#define _BAIDU_SHUTTLE_COMMON_COMPRESSOR_H_
+
+#include <string>
+#include "proto/shuttle.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// Block codec shared by sort file writers and readers,
+// the codec of a file is recorded in its footer
+class Compressor {
+public:
+    static Compressor* Create(CompressionType type);
+    // name is one of: snappy, lz4, zstd, none
+    static bool ParseName(const std::string& name, CompressionType* type);
+    static std::string Name(CompressionType type);
+
+    virtual ~Compressor() { }
+    virtual CompressionType Type() = 0;
+    // output is overwritten, not appended
+    virtual bool Compress(const char* input, size_t length, std::string* output) = 0;
+    virtual bool Uncompress(const char* input, size_t length, std::string* output) = 0;
+};
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
@@ -1,13 +1,21 @@
+#include <algorithm>
 #include <deque>
+#include <dirent.h>
 #include <fcntl.h> 
+#include <ftw.h>
+#include <glob.h>
 #include <stdio.h> 
+#include <sys/mman.h>
 #include <sys/stat.h> 
 #include <sys/types.h> 
 #include <unistd.h> 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 
 #include "filesystem.h"
 #include "logging.h"
+#include "mutex.h"
+#include "thread.h"
 #include "common/tools_util.h"
 
 using baidu::common::INFO;
@@ -63,29 +71,102 @@ public:
     int64_t Tell();
     int64_t GetSize();
     bool Rename(const std::string& old_name, const std::string& new_name);
+    bool Remove(const std::string& path);
+    bool List(const std::string& dir, std::vector<FileInfo>* children);
+    bool Glob(const std::string& dir, std::vector<FileInfo>* children);
+    bool Mkdirs(const std::string& dir);
+    bool Exist(const std::string& path);
+private:
+    int fd_;
+    std::string path_;
+};
+
+class MmapFs : public FileSystem {
+public:
+    MmapFs();
+    virtual ~MmapFs();
+    bool Open(const std::string& path,
+              OpenMode mode);
+    bool Open(const std::string& path,
+              Param& param,
+              OpenMode mode);
+    bool Close();
+    bool Seek(int64_t pos);
+    int32_t Read(void* buf, size_t len);
+    int32_t ReadZeroCopy(const char** data, size_t len);
+    int32_t Write(void* /*buf*/, size_t /*len*/) {
+        return -1;
+    }
+    int64_t Tell();
+    int64_t GetSize();
+    bool Rename(const std::string& old_name, const std::string& new_name);
+    //a read-only mapping of one file, dirs are left to the local fs
     bool Remove(const std::string& /*path*/) {
-        //TODO, not implementation
         return false;
     }
     bool List(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
-        //TODO, not implementation
         return false;
     }
     bool Glob(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
-        //TODO, not implementation
         return false;
     }
     bool Mkdirs(const std::string& /*dir*/) {
-        //TODO, not implementation
         return false;
     }
     bool Exist(const std::string& /*path*/) {
-        //TODO, not implementation
         return false;
     }
+private:
+    void WillNeed();
+private:
+    char* data_;
+    int64_t size_;
+    int64_t pos_;
+    int64_t advised_end_;
+    std::string path_;
+};
+
+class NfsFs : public FileSystem {
+public:
+    NfsFs();
+    virtual ~NfsFs();
+    bool Open(const std::string& path,
+              OpenMode mode);
+    bool Open(const std::string& path,
+              Param& param,
+              OpenMode mode);
+    bool Close();
+    bool Seek(int64_t pos);
+    int32_t Read(void* buf, size_t len);
+    int32_t Write(void* buf, size_t len);
+    int64_t Tell();
+    int64_t GetSize();
+    bool Rename(const std::string& old_name, const std::string& new_name);
+    bool Remove(const std::string& path);
+    bool List(const std::string& dir, std::vector<FileInfo>* children);
+    bool Glob(const std::string& dir, std::vector<FileInfo>* children);
+    bool Mkdirs(const std::string& dir);
+    bool Exist(const std::string& path);
+private:
+    bool QueueWrite(std::string* chunk);
+    void WriteBehindLoop();
+    bool PwriteAll(const std::string& chunk, int64_t offset);
 private:
     int fd_;
     std::string path_;
+    OpenMode mode_;
+    int64_t pos_;
+    std::string read_buf_;
+    int64_t read_buf_offset_;
+    std::string write_buf_;
+    std::deque<std::string*> write_queue_;
+    int64_t write_offset_;
+    bool write_error_;
+    bool write_stop_;
+    common::Thread write_thread_;
+    Mutex mu_;
+    CondVar not_empty_;
+    CondVar not_full_;
 };
 
 FileSystem* FileSystem::CreateInfHdfs() {
@@ -102,6 +183,14 @@ FileSystem* FileSystem::CreateLocalFs() {
     return new LocalFs();
 }
 
+FileSystem* FileSystem::CreateMmapFs() {
+    return new MmapFs();
+}
+
+FileSystem* FileSystem::CreateNfs() {
+    return new NfsFs();
+}
+
 bool FileSystem::WriteAll(void* buf, size_t len) {
     size_t start = 0;
     char* str = (char*)buf;
@@ -413,6 +502,491 @@ bool LocalFs::Rename(const std::string& old_name, const std::string& new_name) {
     return ::rename(old_name.c_str(), new_name.c_str()) == 0;
 }
 
+//dir operations of the fs on posix dirs, local or mounted by nfs
+static int RemoveEntry(const char* path, const struct stat* /*sb*/,
+                       int /*typeflag*/, struct FTW* /*ftwbuf*/) {
+    return ::remove(path);
+}
+
+static bool PosixRemove(const std::string& path) {
+    //recursive, the same as hdfs does
+    return ::nftw(path.c_str(), RemoveEntry, 64, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+static bool PosixList(const std::string& dir, std::vector<FileInfo>* children) {
+    if (children == NULL) {
+        return false;
+    }
+    DIR* dp = ::opendir(dir.c_str());
+    if (dp == NULL) {
+        LOG(WARNING, "error in listing directory: %s, %s", dir.c_str(), strerror(errno));
+        return false;
+    }
+    struct dirent* entry = NULL;
+    while ((entry = ::readdir(dp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        FileInfo info;
+        info.name = dir + "/" + entry->d_name;
+        struct stat buf;
+        if (::stat(info.name.c_str(), &buf) != 0) {
+            continue; //removed while listing
+        }
+        info.kind = S_ISDIR(buf.st_mode) ? 'D' : 'F';
+        info.size = buf.st_size;
+        children->push_back(info);
+    }
+    ::closedir(dp);
+    return true;
+}
+
+static bool PosixGlob(const std::string& dir, std::vector<FileInfo>* children) {
+    if (children == NULL) {
+        return false;
+    }
+    glob_t matches;
+    int ret = ::glob(dir.c_str(), 0, NULL, &matches);
+    if (ret == GLOB_NOMATCH) {
+        return true;
+    }
+    if (ret != 0) {
+        LOG(WARNING, "glob %s fail: %d", dir.c_str(), ret);
+        return false;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        struct stat buf;
+        if (::stat(matches.gl_pathv[i], &buf) != 0) {
+            continue;
+        }
+        if (S_ISDIR(buf.st_mode)) {
+            PosixList(matches.gl_pathv[i], children);
+        } else {
+            FileInfo info;
+            info.kind = 'F';
+            info.name = matches.gl_pathv[i];
+            info.size = buf.st_size;
+            children->push_back(info);
+        }
+    }
+    globfree(&matches);
+    return true;
+}
+
+static bool PosixMkdirs(const std::string& dir) {
+    mode_t acl = S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH;
+    size_t pos = 0;
+    while (pos != std::string::npos) {
+        pos = dir.find('/', pos + 1);
+        std::string sub_dir = dir.substr(0, pos);
+        if (::mkdir(sub_dir.c_str(), acl) != 0 && errno != EEXIST) {
+            LOG(WARNING, "mkdir %s fail, %s", sub_dir.c_str(), strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool PosixExist(const std::string& path) {
+    return ::access(path.c_str(), F_OK) == 0;
+}
+
+bool LocalFs::Remove(const std::string& path) {
+    return PosixRemove(path);
+}
+
+bool LocalFs::List(const std::string& dir, std::vector<FileInfo>* children) {
+    return PosixList(dir, children);
+}
+
+bool LocalFs::Glob(const std::string& dir, std::vector<FileInfo>* children) {
+    return PosixGlob(dir, children);
+}
+
+bool LocalFs::Mkdirs(const std::string& dir) {
+    return PosixMkdirs(dir);
+}
+
+bool LocalFs::Exist(const std::string& path) {
+    return PosixExist(path);
+}
+
+// pages ahead of the read position that the kernel is asked to load
+const static int64_t sMmapWillNeedBytes = (8 << 20);
+
+MmapFs::MmapFs() : data_(NULL), size_(0), pos_(0), advised_end_(0) {
+
+}
+
+MmapFs::~MmapFs() {
+    Close();
+}
+
+bool MmapFs::Open(const std::string& path,
+                  OpenMode mode) {
+    if (mode != kReadFile) {
+        LOG(WARNING, "mmap file is read only, %s", path.c_str());
+        return false;
+    }
+    Close();
+    path_ = path;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(WARNING, "open %s fail, %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat buf;
+    if (fstat(fd, &buf) != 0) {
+        LOG(WARNING, "stat %s fail, %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    size_ = buf.st_size;
+    if (size_ > 0) {
+        void* addr = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            LOG(WARNING, "mmap %s fail, %s", path.c_str(), strerror(errno));
+            ::close(fd);
+            size_ = 0;
+            return false;
+        }
+        data_ = (char*)addr;
+        ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+    ::close(fd); //the mapping stays valid after the fd is closed
+    pos_ = 0;
+    advised_end_ = 0;
+    return true;
+}
+
+bool MmapFs::Open(const std::string& path,
+                  Param& /*param*/,
+                  OpenMode mode) {
+    return Open(path, mode);
+}
+
+bool MmapFs::Close() {
+    if (data_ == NULL) {
+        return true;
+    }
+    int ret = ::munmap(data_, size_);
+    data_ = NULL;
+    size_ = 0;
+    pos_ = 0;
+    advised_end_ = 0;
+    return ret == 0;
+}
+
+bool MmapFs::Seek(int64_t pos) {
+    if (pos < 0 || pos > size_) {
+        return false;
+    }
+    pos_ = pos;
+    return true;
+}
+
+void MmapFs::WillNeed() {
+    //keep a window ahead of the reader in flight, moving it
+    //only when half of it is consumed saves most of the syscalls
+    if (advised_end_ - pos_ > sMmapWillNeedBytes / 2 || advised_end_ >= size_) {
+        return;
+    }
+    static const int64_t page_size = sysconf(_SC_PAGESIZE);
+    int64_t start = std::max(pos_, advised_end_) / page_size * page_size;
+    int64_t end = std::min(pos_ + sMmapWillNeedBytes, size_);
+    ::madvise(data_ + start, end - start, MADV_WILLNEED);
+    advised_end_ = end;
+}
+
+int32_t MmapFs::Read(void* buf, size_t len) {
+    const char* data = NULL;
+    int32_t n = ReadZeroCopy(&data, len);
+    if (n > 0) {
+        memcpy(buf, data, n);
+    }
+    return n;
+}
+
+int32_t MmapFs::ReadZeroCopy(const char** data, size_t len) {
+    if (data_ == NULL) {
+        return size_ == 0 ? 0 : -1;
+    }
+    WillNeed();
+    int64_t n = std::min((int64_t)len, size_ - pos_);
+    n = std::min(n, (int64_t)INT32_MAX);
+    *data = data_ + pos_;
+    pos_ += n;
+    return n;
+}
+
+int64_t MmapFs::Tell() {
+    return pos_;
+}
+
+int64_t MmapFs::GetSize() {
+    return size_;
+}
+
+bool MmapFs::Rename(const std::string& old_name, const std::string& new_name) {
+    return ::rename(old_name.c_str(), new_name.c_str()) == 0;
+}
+
+//nfs servers handle large requests at aligned offsets much better than
+//the small ones sort files are made of, so reads fetch whole aligned chunks
+//and writes are cut into aligned chunks written by a background thread
+const static int64_t sNfsReadChunk = (1 << 20);
+const static size_t sNfsWriteChunk = (4 << 20);
+const static size_t sNfsMaxQueuedWrites = 4;
+
+NfsFs::NfsFs() : fd_(-1), mode_(kReadFile), pos_(0), read_buf_offset_(0),
+                 write_offset_(0), write_error_(false), write_stop_(false),
+                 not_empty_(&mu_), not_full_(&mu_) {
+
+}
+
+NfsFs::~NfsFs() {
+    if (fd_ >= 0) {
+        Close();
+    }
+}
+
+bool NfsFs::Open(const std::string& path,
+                 OpenMode mode) {
+    if (fd_ >= 0) {
+        Close();
+    }
+    path_ = path;
+    mode_ = mode;
+    pos_ = 0;
+    read_buf_.clear();
+    read_buf_offset_ = 0;
+    write_buf_.clear();
+    write_offset_ = 0;
+    write_error_ = false;
+    mode_t acl = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+    if (mode == kReadFile) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+    } else if (mode == kWriteFile) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, acl);
+    } else {
+        LOG(WARNING, "unkown open mode");
+        return false;
+    }
+    if (fd_ < 0) {
+        LOG(WARNING, "open %s fail, %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    if (mode == kWriteFile) {
+        write_buf_.reserve(sNfsWriteChunk);
+        write_stop_ = false;
+        write_thread_.Start(boost::bind(&NfsFs::WriteBehindLoop, this));
+    }
+    return true;
+}
+
+bool NfsFs::Open(const std::string& path,
+                 Param& /*param*/,
+                 OpenMode mode) {
+    return Open(path, mode);
+}
+
+bool NfsFs::Close() {
+    if (fd_ < 0) {
+        return false;
+    }
+    bool ok = true;
+    if (mode_ == kWriteFile) {
+        if (!write_buf_.empty()) {
+            std::string* chunk = new std::string();
+            chunk->swap(write_buf_);
+            ok = QueueWrite(chunk);
+        }
+        {
+            MutexLock lock(&mu_);
+            write_stop_ = true;
+            not_empty_.Signal();
+        }
+        write_thread_.Join();
+        ok = ok && !write_error_;
+    }
+    if (::close(fd_) != 0) {
+        LOG(WARNING, "close %s fail, %s", path_.c_str(), strerror(errno));
+        ok = false;
+    }
+    fd_ = -1;
+    return ok;
+}
+
+bool NfsFs::Seek(int64_t pos) {
+    if (mode_ == kWriteFile) {
+        return pos == pos_; //only appending is supported
+    }
+    if (pos < 0) {
+        return false;
+    }
+    pos_ = pos;
+    return true;
+}
+
+int32_t NfsFs::Read(void* buf, size_t len) {
+    if (fd_ < 0 || mode_ != kReadFile) {
+        return -1;
+    }
+    char* out = (char*)buf;
+    size_t n_copied = 0;
+    while (n_copied < len) {
+        int64_t buf_end = read_buf_offset_ + read_buf_.size();
+        if (pos_ >= read_buf_offset_ && pos_ < buf_end) {
+            size_t n = std::min((size_t)(buf_end - pos_), len - n_copied);
+            memcpy(out + n_copied, read_buf_.data() + (pos_ - read_buf_offset_), n);
+            n_copied += n;
+            pos_ += n;
+            continue;
+        }
+        int64_t offset = pos_ / sNfsReadChunk * sNfsReadChunk;
+        read_buf_.resize(sNfsReadChunk);
+        ssize_t n_read = ::pread(fd_, &read_buf_[0], sNfsReadChunk, offset);
+        if (n_read < 0) {
+            LOG(WARNING, "pread %s at %ld fail, %s", path_.c_str(), offset, strerror(errno));
+            read_buf_.clear();
+            return n_copied > 0 ? (int32_t)n_copied : -1;
+        }
+        read_buf_.resize(n_read);
+        read_buf_offset_ = offset;
+        if (offset + n_read <= pos_) {
+            break; //EOF
+        }
+    }
+    return n_copied;
+}
+
+int32_t NfsFs::Write(void* buf, size_t len) {
+    if (fd_ < 0 || mode_ != kWriteFile) {
+        return -1;
+    }
+    const char* in = (const char*)buf;
+    size_t n_left = len;
+    while (n_left > 0) {
+        size_t n = std::min(n_left, sNfsWriteChunk - write_buf_.size());
+        write_buf_.append(in, n);
+        in += n;
+        n_left -= n;
+        if (write_buf_.size() == sNfsWriteChunk) {
+            std::string* chunk = new std::string();
+            chunk->reserve(sNfsWriteChunk);
+            chunk->swap(write_buf_);
+            if (!QueueWrite(chunk)) {
+                return -1;
+            }
+        }
+    }
+    pos_ += len;
+    return len;
+}
+
+bool NfsFs::QueueWrite(std::string* chunk) {
+    MutexLock lock(&mu_);
+    while (write_queue_.size() >= sNfsMaxQueuedWrites && !write_error_) {
+        not_full_.Wait();
+    }
+    if (write_error_) {
+        delete chunk;
+        return false;
+    }
+    write_queue_.push_back(chunk);
+    not_empty_.Signal();
+    return true;
+}
+
+void NfsFs::WriteBehindLoop() {
+    while (true) {
+        std::string* chunk = NULL;
+        int64_t offset = 0;
+        {
+            MutexLock lock(&mu_);
+            while (write_queue_.empty() && !write_stop_) {
+                not_empty_.Wait();
+            }
+            if (write_queue_.empty()) {
+                return;
+            }
+            chunk = write_queue_.front();
+            offset = write_offset_;
+        }
+        bool ok = PwriteAll(*chunk, offset);
+        MutexLock lock(&mu_);
+        write_queue_.pop_front();
+        write_offset_ += chunk->size();
+        delete chunk;
+        if (!ok) {
+            write_error_ = true;
+            std::deque<std::string*>::iterator it;
+            for (it = write_queue_.begin(); it != write_queue_.end(); it++) {
+                delete *it;
+            }
+            write_queue_.clear();
+        }
+        not_full_.Signal();
+    }
+}
+
+bool NfsFs::PwriteAll(const std::string& chunk, int64_t offset) {
+    size_t n_written = 0;
+    while (n_written < chunk.size()) {
+        ssize_t n = ::pwrite(fd_, chunk.data() + n_written,
+                             chunk.size() - n_written, offset + n_written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(WARNING, "pwrite %s at %ld fail, %s",
+                path_.c_str(), offset + n_written, strerror(errno));
+            return false;
+        }
+        n_written += n;
+    }
+    return true;
+}
+
+int64_t NfsFs::Tell() {
+    return pos_;
+}
+
+int64_t NfsFs::GetSize() {
+    if (mode_ == kWriteFile) {
+        return pos_;
+    }
+    struct stat buf;
+    if (fstat(fd_, &buf) != 0) {
+        return -1;
+    }
+    return buf.st_size;
+}
+
+bool NfsFs::Rename(const std::string& old_name, const std::string& new_name) {
+    return ::rename(old_name.c_str(), new_name.c_str()) == 0;
+}
+
+bool NfsFs::Remove(const std::string& path) {
+    return PosixRemove(path);
+}
+
+bool NfsFs::List(const std::string& dir, std::vector<FileInfo>* children) {
+    return PosixList(dir, children);
+}
+
+bool NfsFs::Glob(const std::string& dir, std::vector<FileInfo>* children) {
+    return PosixGlob(dir, children);
+}
+
+bool NfsFs::Mkdirs(const std::string& dir) {
+    return PosixMkdirs(dir);
+}
+
+bool NfsFs::Exist(const std::string& path) {
+    return PosixExist(path);
+}
+
 InfSeqFile::InfSeqFile() : fs_(NULL), sf_(NULL) {
 
 }
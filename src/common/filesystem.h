@@ -33,6 +33,13 @@ public:
     static FileSystem* CreateInfHdfs();
     static FileSystem* CreateInfHdfs(Param& param);
     static FileSystem* CreateLocalFs();
+    // local files mapped into memory, read only
+    static FileSystem* CreateMmapFs();
+    // files on a nfs mount, written behind in large aligned chunks
+    static FileSystem* CreateNfs();
+    // read only files kept by another minion, the path is its endpoint
+    // followed by the path relative to its spill dir, see shuffle_fs.cc
+    static FileSystem* CreateShuffleFs();
 
     virtual bool Open(const std::string& path,
                       OpenMode mode) = 0;
@@ -43,6 +50,11 @@ public:
     virtual bool Seek(int64_t pos) = 0;
     virtual int32_t Read(void* buf, size_t len) = 0;
     virtual int32_t Write(void* buf, size_t len) = 0;
+    // like Read, but *data points into memory owned by the file system,
+    // valid until Close. returns -1 if not supported
+    virtual int32_t ReadZeroCopy(const char** /*data*/, size_t /*len*/) {
+        return -1;
+    }
     virtual int64_t Tell() = 0;
     virtual int64_t GetSize() = 0;
     virtual bool Rename(const std::string& old_name, const std::string& new_name) = 0;
@@ -52,6 +64,7 @@ public:
     virtual bool Glob(const std::string& dir, std::vector<FileInfo>* children) = 0;
     virtual bool Mkdirs(const std::string& dir) = 0;
     virtual bool Exist(const std::string& path) = 0;
+    virtual ~FileSystem() { }
 };
 
 class InfSeqFile {
@@ -0,0 +1,88 @@
+#include "io_permit.h"
+
+#include <sstream>
+#include "logging.h"
+#include "mutex.h"
+
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+//seconds master holds a wait for permit
+const static int sPermitWaitSeconds = 10;
+
+static Mutex s_permit_mu;
+static int s_permit_no = 0;
+
+IoPermit::IoPermit(RpcClient* rpc_client, Master_Stub* master,
+                   const std::string& host, const std::string& holder) :
+                   rpc_client_(rpc_client), master_(master),
+                   host_(host), held_(false) {
+    std::stringstream ss;
+    {
+        MutexLock lock(&s_permit_mu);
+        ss << holder << "#" << s_permit_no++;
+    }
+    holder_ = ss.str();
+}
+
+IoPermit::~IoPermit() {
+    Release();
+}
+
+bool IoPermit::Acquire() {
+    if (master_ == NULL) {
+        return false;
+    }
+    if (held_) {
+        return true;
+    }
+    AcquireIoPermitRequest request;
+    request.set_host(host_);
+    request.set_holder(holder_);
+    request.set_timeout(sPermitWaitSeconds);
+    int n_waits = 0;
+    while (true) {
+        AcquireIoPermitResponse response;
+        if (!rpc_client_->SendRequest(master_, &Master_Stub::AcquireIoPermit,
+                                      &request, &response, sPermitWaitSeconds + 5, 3)) {
+            LOG(WARNING, "fail to acquire io permit of dfs %s, go on without it",
+                host_.c_str());
+            return false;
+        }
+        if (response.status() == kOk) {
+            break;
+        } else if (response.status() != kSuspend) {
+            LOG(WARNING, "fail to acquire io permit of dfs %s: %s, go on without it",
+                host_.c_str(), Status_Name(response.status()).c_str());
+            return false;
+        }
+        n_waits++;
+    }
+    if (n_waits > 0) {
+        LOG(INFO, "io permit of dfs %s granted after %d waits", host_.c_str(), n_waits);
+    }
+    held_ = true;
+    return true;
+}
+
+void IoPermit::Release() {
+    if (!held_) {
+        return;
+    }
+    held_ = false;
+    ReleaseIoPermitRequest request;
+    ReleaseIoPermitResponse response;
+    request.set_host(host_);
+    request.set_holder(holder_);
+    //an unreleased permit is taken back by master at the end of its lease
+    if (!rpc_client_->SendRequest(master_, &Master_Stub::ReleaseIoPermit,
+                                  &request, &response, 5, 1)) {
+        LOG(WARNING, "fail to release io permit of dfs %s", host_.c_str());
+    }
+}
+
+}
+}
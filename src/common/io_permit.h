@@ -0,0 +1,36 @@
+#ifndef _BAIDU_SHUTTLE_IO_PERMIT_H_
+#define _BAIDU_SHUTTLE_IO_PERMIT_H_
+#include <string>
+
+#include "common/rpc_client.h"
+#include "proto/app_master.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// a permit of master to open and read files of a dfs cluster, asked for
+// before a burst of io so that tasks starting together are paced
+class IoPermit {
+public:
+    // nothing is asked for if master is NULL, permits of one holder
+    // are told apart, so they may be held by several threads
+    IoPermit(RpcClient* rpc_client, Master_Stub* master,
+             const std::string& host, const std::string& holder);
+    // gives back the permit if held
+    ~IoPermit();
+    // waits until master grants it, false if master can not be reached,
+    // when the io should go on unpaced
+    bool Acquire();
+    void Release();
+private:
+    RpcClient* rpc_client_;
+    Master_Stub* master_;
+    std::string host_;
+    std::string holder_;
+    bool held_;
+};
+
+}
+}
+
+#endif
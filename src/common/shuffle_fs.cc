@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <string.h>
+#include <algorithm>
+#include <boost/scoped_ptr.hpp>
+
+#include "filesystem.h"
+#include "logging.h"
+#include "common/rpc_client.h"
+#include "proto/minion.pb.h"
+
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+//a reader asks for no less than this at once, blocks of a partition are
+//read one after another, so the rest of a chunk is usually read next
+const static int32_t sShuffleReadChunk = (1 << 20);
+const static int sShuffleReadTimeout = 30;
+
+static pthread_once_t s_rpc_client_once = PTHREAD_ONCE_INIT;
+static RpcClient* s_rpc_client = NULL;
+
+//files of a merge share one client, which keeps a channel per minion
+static void InitRpcClient() {
+    s_rpc_client = new RpcClient();
+}
+
+class ShuffleFs : public FileSystem {
+public:
+    ShuffleFs();
+    virtual ~ShuffleFs();
+    bool Open(const std::string& path,
+              OpenMode mode);
+    bool Open(const std::string& path,
+              Param& param,
+              OpenMode mode);
+    bool Close();
+    bool Seek(int64_t pos);
+    int32_t Read(void* buf, size_t len);
+    int32_t Write(void* /*buf*/, size_t /*len*/) {
+        return -1;
+    }
+    int64_t Tell();
+    int64_t GetSize();
+    bool Rename(const std::string& /*old_name*/, const std::string& /*new_name*/) {
+        return false;
+    }
+    bool Remove(const std::string& /*path*/) {
+        return false;
+    }
+    bool List(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
+        return false;
+    }
+    bool Glob(const std::string& /*dir*/, std::vector<FileInfo>* /*children*/) {
+        return false;
+    }
+    bool Mkdirs(const std::string& /*dir*/) {
+        return false;
+    }
+    bool Exist(const std::string& path);
+private:
+    bool ReadRange(int64_t offset, int32_t length, ReadSpillResponse* response);
+private:
+    Shuffle_Stub* stub_;
+    std::string endpoint_;
+    std::string path_;
+    int64_t size_;
+    int64_t pos_;
+    std::string read_buf_;
+    int64_t read_buf_offset_;
+};
+
+FileSystem* FileSystem::CreateShuffleFs() {
+    return new ShuffleFs();
+}
+
+ShuffleFs::ShuffleFs() : stub_(NULL), size_(0), pos_(0), read_buf_offset_(0) {
+    pthread_once(&s_rpc_client_once, InitRpcClient);
+}
+
+ShuffleFs::~ShuffleFs() {
+    delete stub_;
+}
+
+bool ShuffleFs::Open(const std::string& path, OpenMode mode) {
+    if (mode != kReadFile) {
+        LOG(WARNING, "spills of other minions are read only: %s", path.c_str());
+        return false;
+    }
+    size_t slash = path.find('/');
+    if (slash == std::string::npos || slash == 0) {
+        LOG(WARNING, "no endpoint in the path of a spill: %s", path.c_str());
+        return false;
+    }
+    delete stub_;
+    stub_ = NULL;
+    endpoint_ = path.substr(0, slash);
+    path_ = path.substr(slash + 1);
+    s_rpc_client->GetStub(endpoint_, &stub_);
+    ReadSpillResponse response;
+    if (!ReadRange(0, 0, &response)) {
+        return false;
+    }
+    size_ = response.file_size();
+    pos_ = 0;
+    read_buf_.clear();
+    read_buf_offset_ = 0;
+    return true;
+}
+
+bool ShuffleFs::Open(const std::string& path,
+                     Param& /*param*/,
+                     OpenMode mode) {
+    return Open(path, mode);
+}
+
+bool ShuffleFs::Close() {
+    if (stub_ == NULL) {
+        return false;
+    }
+    delete stub_;
+    stub_ = NULL;
+    read_buf_.clear();
+    return true;
+}
+
+bool ShuffleFs::Seek(int64_t pos) {
+    if (pos < 0 || pos > size_) {
+        return false;
+    }
+    pos_ = pos;
+    return true;
+}
+
+bool ShuffleFs::ReadRange(int64_t offset, int32_t length, ReadSpillResponse* response) {
+    ReadSpillRequest request;
+    request.set_path(path_);
+    request.set_offset(offset);
+    request.set_length(length);
+    bool ok = s_rpc_client->SendRequest(stub_, &Shuffle_Stub::ReadSpill,
+                                        &request, response, sShuffleReadTimeout, 3);
+    if (!ok || response->status() != kOk) {
+        LOG(WARNING, "fail to read %s at %ld from %s: %s", path_.c_str(), offset,
+            endpoint_.c_str(), ok ? Status_Name(response->status()).c_str() : "rpc fail");
+        return false;
+    }
+    return true;
+}
+
+int32_t ShuffleFs::Read(void* buf, size_t len) {
+    if (stub_ == NULL) {
+        return -1;
+    }
+    char* out = (char*)buf;
+    size_t n_copied = 0;
+    while (n_copied < len && pos_ < size_) {
+        int64_t buf_end = read_buf_offset_ + read_buf_.size();
+        if (pos_ >= read_buf_offset_ && pos_ < buf_end) {
+            size_t n = std::min((size_t)(buf_end - pos_), len - n_copied);
+            memcpy(out + n_copied, read_buf_.data() + (pos_ - read_buf_offset_), n);
+            n_copied += n;
+            pos_ += n;
+            continue;
+        }
+        int32_t length = std::max((int64_t)sShuffleReadChunk, (int64_t)(len - n_copied));
+        ReadSpillResponse response;
+        if (!ReadRange(pos_, length, &response)) {
+            read_buf_.clear();
+            return n_copied > 0 ? (int32_t)n_copied : -1;
+        }
+        if (response.data().empty()) {
+            break; //truncated under us
+        }
+        read_buf_.swap(*response.mutable_data());
+        read_buf_offset_ = pos_;
+    }
+    return n_copied;
+}
+
+int64_t ShuffleFs::Tell() {
+    return pos_;
+}
+
+int64_t ShuffleFs::GetSize() {
+    return size_;
+}
+
+bool ShuffleFs::Exist(const std::string& path) {
+    ShuffleFs fs;
+    return fs.Open(path, kReadFile);
+}
+
+}
+}
@@ -0,0 +1,75 @@
+#ifndef _BAIDU_SHUTTLE_COMMON_SLICE_H_
+#define _BAIDU_SHUTTLE_COMMON_SLICE_H_
+
+#include <string.h>
+#include <ostream>
+#include <string>
+
+namespace baidu {
+namespace shuttle {
+
+// A pointer + length reference to bytes owned by somebody else,
+// the user must make sure the referred memory outlives the slice
+class Slice {
+public:
+    Slice() : data_(""), size_(0) { }
+    Slice(const char* data, size_t size) : data_(data), size_(size) { }
+    Slice(const std::string& str) : data_(str.data()), size_(str.size()) { }
+    Slice(const char* str) : data_(str), size_(strlen(str)) { }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    char operator[](size_t n) const { return data_[n]; }
+    void clear() { data_ = ""; size_ = 0; }
+    void remove_prefix(size_t n) {
+        data_ += n;
+        size_ -= n;
+    }
+    std::string ToString() const { return std::string(data_, size_); }
+
+    int compare(const Slice& other) const {
+        const size_t min_len = (size_ < other.size_) ? size_ : other.size_;
+        int r = memcmp(data_, other.data_, min_len);
+        if (r == 0) {
+            if (size_ < other.size_) {
+                r = -1;
+            } else if (size_ > other.size_) {
+                r = 1;
+            }
+        }
+        return r;
+    }
+    bool starts_with(const Slice& prefix) const {
+        return size_ >= prefix.size_ && memcmp(data_, prefix.data_, prefix.size_) == 0;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+inline bool operator==(const Slice& x, const Slice& y) {
+    return x.size() == y.size() && memcmp(x.data(), y.data(), x.size()) == 0;
+}
+
+inline bool operator!=(const Slice& x, const Slice& y) {
+    return !(x == y);
+}
+
+inline bool operator<(const Slice& x, const Slice& y) {
+    return x.compare(y) < 0;
+}
+
+inline bool operator>=(const Slice& x, const Slice& y) {
+    return x.compare(y) >= 0;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Slice& slice) {
+    return os.write(slice.data(), slice.size());
+}
+
+} //namespace shuttle
+} //namespace baidu
+
+#endif
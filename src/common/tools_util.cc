@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <unistd.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <string>
@@ -71,6 +73,32 @@ bool PatternMatch(const std::string& origin, const std::string& pattern) {
     return !*pat;
 }
 
+std::string AbsolutePath(const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return path;
+    }
+    std::string relative = path;
+    while (boost::starts_with(relative, "./")) {
+        relative = relative.substr(2);
+    }
+    if (relative == ".") {
+        return cwd;
+    }
+    return std::string(cwd) + "/" + relative;
+}
+
+std::string PushedSegmentName(const std::string& push_dir, int map_no, int map_attempt,
+                              int file_no, int chunk_no) {
+    char file_name[4096];
+    snprintf(file_name, sizeof(file_name), "%s/map_%d_%d_%d_%d.sort",
+             push_dir.c_str(), map_no, map_attempt, file_no, chunk_no);
+    return file_name;
+}
+
 }
 }
 
@@ -15,6 +15,13 @@ static inline std::string GetLogName(const char* prefix) {
 
 void ParseHdfsAddress(const std::string& address, std::string* host, int* port, std::string* path);
 bool PatternMatch(const std::string& origin, const std::string& pattern);
+// a relative path resolved against the current dir, for the processes
+// started in other dirs
+std::string AbsolutePath(const std::string& path);
+// the local file of a chunk pushed to a reduce task, written by the
+// minion receiving it and read by the shuffle of the task
+std::string PushedSegmentName(const std::string& push_dir, int map_no, int map_attempt,
+                              int file_no, int chunk_no);
 
 }
 }
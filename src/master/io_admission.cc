@@ -0,0 +1,193 @@
+#include "io_admission.h"
+
+#include <algorithm>
+#include "logging.h"
+
+namespace baidu {
+namespace shuttle {
+
+const static int sMaxWaitSeconds = 60;
+
+IoAdmission::IoAdmission(int permits, int rate, int lease) :
+                         permits_(std::max(permits, 0)),
+                         rate_(std::max(rate, 0)),
+                         lease_(std::max(lease, 1)) {
+
+}
+
+IoAdmission::~IoAdmission() {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        std::map<std::string, DfsHost>::iterator it;
+        for (it = hosts_.begin(); it != hosts_.end(); ++it) {
+            std::list<IoWait>::iterator jt;
+            for (jt = it->second.waits.begin(); jt != it->second.waits.end(); ++jt) {
+                if (jt->done != NULL) {
+                    jt->response->set_status(kNoMore);
+                    dones.push_back(jt->done);
+                }
+            }
+        }
+        hosts_.clear();
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+void IoAdmission::Acquire(const std::string& host, const std::string& holder, int timeout,
+                          AcquireIoPermitResponse* response,
+                          ::google::protobuf::Closure* done) {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        time_t now = std::time(NULL);
+        std::map<std::string, DfsHost>::iterator it = hosts_.find(host);
+        if (it == hosts_.end()) {
+            DfsHost& dfs = hosts_[host];
+            dfs.tokens = rate_;
+            dfs.refill_time = now;
+            it = hosts_.find(host);
+        }
+        DfsHost& dfs = it->second;
+        std::map<std::string, time_t>::iterator held = dfs.holders.find(holder);
+        if (held != dfs.holders.end()) {
+            //granted while the holder was not waiting, or asked again to renew
+            held->second = now + lease_;
+            response->set_status(kOk);
+            response->set_lease(lease_);
+            dones.push_back(done);
+        } else {
+            std::list<IoWait>::iterator jt = dfs.waits.begin();
+            for (; jt != dfs.waits.end() && jt->holder != holder; ++jt) {
+            }
+            if (jt == dfs.waits.end()) {
+                jt = dfs.waits.insert(dfs.waits.end(), IoWait());
+                jt->holder = holder;
+            } else if (jt->done != NULL) {
+                //the response of the earlier wait may be lost
+                jt->response->set_status(kSuspend);
+                dones.push_back(jt->done);
+            }
+            jt->deadline = now + std::min(std::max(timeout, 0), sMaxWaitSeconds);
+            jt->response = response;
+            jt->done = done;
+        }
+        Grant(host, &dfs, &dones);
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+Status IoAdmission::Release(const std::string& host, const std::string& holder) {
+    std::vector< ::google::protobuf::Closure*> dones;
+    Status status = kNoSuchTask;
+    {
+        MutexLock lock(&mu_);
+        std::map<std::string, DfsHost>::iterator it = hosts_.find(host);
+        if (it == hosts_.end()) {
+            return status;
+        }
+        DfsHost& dfs = it->second;
+        if (dfs.holders.erase(holder) > 0) {
+            status = kOk;
+        }
+        //a holder giving up its place
+        std::list<IoWait>::iterator jt = dfs.waits.begin();
+        while (jt != dfs.waits.end()) {
+            if (jt->holder != holder) {
+                ++jt;
+                continue;
+            }
+            if (jt->done != NULL) {
+                jt->response->set_status(kSuspend);
+                dones.push_back(jt->done);
+            }
+            jt = dfs.waits.erase(jt);
+            status = kOk;
+        }
+        Grant(host, &dfs, &dones);
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+    return status;
+}
+
+void IoAdmission::Pace() {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        std::map<std::string, DfsHost>::iterator it = hosts_.begin();
+        while (it != hosts_.end()) {
+            Grant(it->first, &it->second, &dones);
+            if (it->second.holders.empty() && it->second.waits.empty()) {
+                hosts_.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+void IoAdmission::Grant(const std::string& host, DfsHost* dfs,
+                        std::vector< ::google::protobuf::Closure*>* dones) {
+    mu_.AssertHeld();
+    time_t now = std::time(NULL);
+    if (rate_ > 0 && now > dfs->refill_time) {
+        int64_t refill = (int64_t)rate_ * (now - dfs->refill_time);
+        dfs->tokens = (int)std::min((int64_t)rate_, dfs->tokens + refill);
+        dfs->refill_time = now;
+    }
+    std::map<std::string, time_t>::iterator it = dfs->holders.begin();
+    while (it != dfs->holders.end()) {
+        if (it->second > now) {
+            ++it;
+            continue;
+        }
+        LOG(INFO, "permit of %s on dfs %s is out of lease",
+            it->first.c_str(), host.c_str());
+        dfs->holders.erase(it++);
+    }
+    while (!dfs->waits.empty()
+           && (permits_ == 0 || (int)dfs->holders.size() < permits_)
+           && (rate_ == 0 || dfs->tokens > 0)) {
+        IoWait& wait = dfs->waits.front();
+        dfs->holders[wait.holder] = now + lease_;
+        if (rate_ > 0) {
+            dfs->tokens--;
+        }
+        if (wait.done != NULL) {
+            wait.response->set_status(kOk);
+            wait.response->set_lease(lease_);
+            dones->push_back(wait.done);
+        }
+        dfs->waits.pop_front();
+    }
+    std::list<IoWait>::iterator jt = dfs->waits.begin();
+    while (jt != dfs->waits.end()) {
+        if (jt->deadline > now) {
+            ++jt;
+            continue;
+        }
+        if (jt->done == NULL) {
+            //never asked again in a lease, the task is gone
+            jt = dfs->waits.erase(jt);
+            continue;
+        }
+        jt->response->set_status(kSuspend);
+        dones->push_back(jt->done);
+        jt->response = NULL;
+        jt->done = NULL;
+        jt->deadline = now + lease_;
+        ++jt;
+    }
+}
+
+}
+}
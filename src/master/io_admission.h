@@ -0,0 +1,67 @@
+#ifndef _BAIDU_SHUTTLE_IO_ADMISSION_H_
+#define _BAIDU_SHUTTLE_IO_ADMISSION_H_
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include "mutex.h"
+#include "proto/app_master.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// hands out permits to open and read files of a dfs cluster, so that the
+// tasks of all jobs starting together come at it a few at a time,
+// in the order they asked
+class IoAdmission {
+public:
+    // permits: held at once per host, 0 means no limit
+    // rate: granted per second per host, 0 means no limit
+    // lease: seconds a permit is held by a task which neither releases
+    // nor asks for it again, as the task may be gone
+    IoAdmission(int permits, int rate, int lease);
+    // answers the pending waits with kNoMore
+    ~IoAdmission();
+
+    // done is run once the permit is granted, or with kSuspend after timeout
+    // seconds, when the caller should ask again, keeping its place for a lease
+    void Acquire(const std::string& host, const std::string& holder, int timeout,
+                 AcquireIoPermitResponse* response, ::google::protobuf::Closure* done);
+    Status Release(const std::string& host, const std::string& holder);
+    // takes back the permits out of lease and hands them to the waits,
+    // to be called every second as no timer watches the rate and the leases
+    void Pace();
+
+private:
+    struct IoWait {
+        std::string holder;
+        time_t deadline;
+        // NULL once answered with kSuspend, until the holder asks again
+        AcquireIoPermitResponse* response;
+        ::google::protobuf::Closure* done;
+    };
+    struct DfsHost {
+        // lease deadlines of the permits held
+        std::map<std::string, time_t> holders;
+        std::list<IoWait> waits;
+        int tokens;
+        time_t refill_time;
+    };
+    // grants the permits free to the waits in order, and answers the waits
+    // timed out, their closures are left to be run out of the lock
+    void Grant(const std::string& host, DfsHost* dfs,
+               std::vector< ::google::protobuf::Closure*>* dones);
+private:
+    Mutex mu_;
+    int permits_;
+    int rate_;
+    int lease_;
+    std::map<std::string, DfsHost> hosts_;
+};
+
+}
+}
+
+#endif
@@ -21,6 +21,8 @@
 #include "common/tools_util.h"
 #include "timer.h"
 #include "sort/sort_file.h"
+#include "sort/input_reader.h"
+#include "minion/partition.h"
 
 DECLARE_int32(galaxy_deploy_step);
 DECLARE_string(minion_path);
@@ -29,10 +31,13 @@ DECLARE_int32(time_tolerance);
 DECLARE_int32(replica_num);
 DECLARE_int32(replica_begin);
 DECLARE_int32(replica_begin_percent);
+DECLARE_int32(pipelined_reduce_begin_percent);
 DECLARE_int32(retry_bound);
 DECLARE_int32(left_percent);
 DECLARE_int32(max_counters_per_job);
 DECLARE_int32(parallel_attempts);
+DECLARE_int32(partition_sample_splits);
+DECLARE_int32(partition_samples_per_split);
 
 namespace baidu {
 namespace shuttle {
@@ -56,13 +61,20 @@ JobTracker::JobTracker(MasterImpl* master, ::baidu::galaxy::Galaxy* galaxy_sdk,
                       monitor_(NULL),
                       map_monitoring_(false),
                       reduce_monitoring_(false),
+                      map_phase_ended_(false),
                       fs_(NULL),
                       start_time_(0),
                       finish_time_(0),
                       ignored_map_failures_(0),
-                      ignored_reduce_failures_(0) {
+                      ignored_reduce_failures_(0),
+                      merge_coordinator_(NULL),
+                      map_outputs_(NULL) {
     job_descriptor_.CopyFrom(job);
     job_id_ = GenerateJobId();
+    if (!job_descriptor_.nfs_work_dir().empty()) {
+        //jobs sharing a nfs dir must not see each other's shuffle data
+        job_descriptor_.set_nfs_work_dir(job_descriptor_.nfs_work_dir() + "/" + job_id_);
+    }
     rpc_client_ = new RpcClient();
 
     if (!job_descriptor_.has_map_retry()) {
@@ -78,6 +90,8 @@ JobTracker::JobTracker(MasterImpl* master, ::baidu::galaxy::Galaxy* galaxy_sdk,
         }
     }
     monitor_ = new ThreadPool(1);
+    merge_coordinator_ = new MergeCoordinator(
+            boost::bind(&JobTracker::IsReduceRunning, this, _1, _2));
 
     map_allow_duplicates_ = job_descriptor_.map_allow_duplicates();
     reduce_allow_duplicates_ = job_descriptor_.reduce_allow_duplicates();
@@ -93,6 +107,8 @@ JobTracker::~JobTracker() {
         delete reduce_manager_;
     }
     delete rpc_client_;
+    delete merge_coordinator_;
+    delete map_outputs_;
     {
         MutexLock lock(&alloc_mu_);
         for (std::vector<AllocateItem*>::iterator it = allocation_table_.begin();
@@ -127,6 +143,18 @@ void JobTracker::BuildOutputFsPointer() {
     output_param_ = output_param;
 }
 
+void JobTracker::RemoveNfsWorkDir() {
+    const std::string& work_dir = job_descriptor_.nfs_work_dir();
+    if (work_dir.empty()) {
+        return;
+    }
+    LOG(INFO, "remove nfs work directory: %s", work_dir.c_str());
+    boost::scoped_ptr<FileSystem> nfs(FileSystem::CreateNfs());
+    if (!nfs->Remove(work_dir)) {
+        LOG(WARNING, "remove nfs work directory failed: %s", work_dir.c_str());
+    }
+}
+
 Status JobTracker::BuildResourceManagers() {
     std::vector<std::string> inputs;
     const ::google::protobuf::RepeatedPtrField<std::string>& input_filenames = job_descriptor_.inputs();
@@ -164,13 +192,71 @@ Status JobTracker::BuildResourceManagers() {
     }
 
     if (job_descriptor_.job_type() == kMapReduceJob) {
+        //a recovered job keeps the split points its maps partitioned by
+        if (job_descriptor_.partition() == kTotalOrderPartitioner
+            && job_descriptor_.split_points_size() == 0) {
+            SampleSplitPoints(input_param);
+        }
         reduce_manager_ = new IdManager(job_descriptor_.reduce_total());
+        map_outputs_ = new MapOutputManifest(sum_of_map);
     }
 
-    failed_count_.resize(sum_of_map, 0);
+    map_failed_count_.resize(sum_of_map, 0);
+    reduce_failed_count_.resize(job_descriptor_.reduce_total(), 0);
     return kOk;
 }
 
+// the first records of some splits spread over the input are sampled,
+// assuming maps keep the keys of their input as sorting jobs do
+void JobTracker::SampleSplitPoints(const FileSystem::Param& input_param) {
+    if (job_descriptor_.reduce_total() <= 1) {
+        return;
+    }
+    if (job_descriptor_.input_format() != kTextInput) {
+        LOG(WARNING, "only text input is sampled, all records go to reduce 0: %s",
+            job_id_.c_str());
+        return;
+    }
+    int n_splits = map_manager_->SumOfItem();
+    int n_sampled = std::min(n_splits, std::max(FLAGS_partition_sample_splits, 1));
+    std::vector<std::string> records;
+    for (int i = 0; i < n_sampled; i++) {
+        ResourceItem* split = map_manager_->CheckCertainItem((int64_t)n_splits * i / n_sampled);
+        if (split == NULL) {
+            continue;
+        }
+        boost::scoped_ptr<ResourceItem> split_guard(split);
+        FileSystem::Param param(input_param);
+        std::string path = split->input_file;
+        if (boost::starts_with(split->input_file, "hdfs://")) {
+            std::string host;
+            int port;
+            ParseHdfsAddress(split->input_file, &host, &port, &path);
+            param["host"] = host;
+            param["port"] = boost::lexical_cast<std::string>(port);
+        }
+        boost::scoped_ptr<InputReader> reader(InputReader::CreateHdfsTextReader());
+        if (reader->Open(path, param) != kOk) {
+            LOG(WARNING, "fail to open %s to sample keys", split->input_file.c_str());
+            continue;
+        }
+        InputReader::Iterator* it = reader->Read(split->offset, split->size);
+        for (int n = 0; n < FLAGS_partition_samples_per_split && !it->Done(); n++) {
+            records.push_back(it->Record());
+            it->Next();
+        }
+        delete it;
+        reader->Close();
+    }
+    std::vector<std::string> split_points;
+    PickSplitPoints(records, job_descriptor_, &split_points);
+    for (size_t i = 0; i < split_points.size(); i++) {
+        job_descriptor_.add_split_points(split_points[i]);
+    }
+    LOG(INFO, "%d split points picked from %d records of %d splits: %s",
+        split_points.size(), records.size(), n_sampled, job_id_.c_str());
+}
+
 void JobTracker::BuildEndGameCounters() {
     if (map_manager_ == NULL) {
         return;
@@ -185,6 +271,11 @@ void JobTracker::BuildEndGameCounters() {
         return;
     }
     reduce_begin_ = sum_of_map - sum_of_map * FLAGS_replica_begin_percent / 100;
+    if (job_descriptor_.pipelined_shuffle() || job_descriptor_.push_shuffle()) {
+        //reduce tasks take map outputs as they come, so start them early
+        int pipelined_begin = sum_of_map * FLAGS_pipelined_reduce_begin_percent / 100;
+        reduce_begin_ = std::max(std::min(reduce_begin_, pipelined_begin), 1);
+    }
     reduce_end_game_begin_ = reduce_manager_->SumOfItem() - FLAGS_replica_begin;
     temp = reduce_manager_->SumOfItem() * FLAGS_replica_begin_percent / 100;
     if (reduce_end_game_begin_ < temp) {
@@ -294,6 +385,11 @@ Status JobTracker::Kill(JobState end_state) {
 
 void JobTracker::CanMapDismiss(Status* status, const std::string& endpoint) {
     mu_.AssertHeld();
+    if (job_descriptor_.host_shuffle()) {
+        //map minions serve their spills till the job is done
+        *status = kSuspend;
+        return;
+    }
     int completed = map_manager_->Done();
     int not_done = job_descriptor_.map_total() - completed;
     int map_dismiss_minion_num = job_descriptor_.map_capacity() - (int)
@@ -505,7 +601,11 @@ void JobTracker::CancelOtherAttempts(
 
 Status JobTracker::FinishMap(int no, int attempt, TaskState state, 
                              const std::string& err_msg,
-                             const std::map<std::string, int64_t>& counters) {
+                             const std::map<std::string, int64_t>& counters,
+                             const MapOutput& output) {
+    const MapOutput* cur_output = &output;
+    MapOutput fake_output;
+    MapOutput host_output;
     AllocateItem* cur = NULL;
     {
         MutexLock lock(&alloc_mu_);
@@ -552,21 +652,34 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
             state = kTaskCompleted;
             if (job_descriptor_.job_type() != kMapOnlyJob) {//mapper of map-reduce
                 Status w_status;
-                SortFileWriter* writer = SortFileWriter::Create(kHdfsFile, &w_status);
+                bool on_nfs = !job_descriptor_.nfs_work_dir().empty();
+                SortFileWriter* writer = SortFileWriter::Create(on_nfs ? kNfsFile : kHdfsFile,
+                                                                &w_status);
                 if (w_status == kOk) {
                     std::stringstream ss;
-                    ss << job_descriptor_.output()
-                       << "/_temporary/shuffle/" 
-                       << "map_" << cur->resource_no << "/0.sort";
-                    std::string fake_sort_file = ss.str();
+                    if (on_nfs) {
+                        ss << job_descriptor_.nfs_work_dir() << "/shuffle/";
+                    } else {
+                        ss << job_descriptor_.output() << "/_temporary/shuffle/";
+                    }
+                    ss << "map_" << cur->resource_no;
+                    std::string fake_sort_dir = ss.str();
+                    std::string fake_sort_file = fake_sort_dir + "/0.sort";
                     LOG(WARNING, "make a empty sort file: %s", fake_sort_file.c_str());
                     FileSystem::Param the_param = output_param_;
                     mu_.Unlock();
+                    if (on_nfs) {
+                        FileSystem* nfs = FileSystem::CreateNfs();
+                        nfs->Mkdirs(fake_sort_dir);
+                        delete nfs;
+                    }
                     writer->Open(fake_sort_file, the_param);
                     w_status = writer->Close();
                     if (w_status != kOk) {
                         state = kTaskFailed;
                     }
+                    fake_output.add_files()->set_name("0.sort");
+                    cur_output = &fake_output;
                     mu_.Lock();
                 }
                 if (writer) {
@@ -582,11 +695,27 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
                 state = kTaskCanceled;
                 break;
             }
+            if (job_descriptor_.host_shuffle() && cur_output == &output
+                && output.files_size() > 0) {
+                //spills stay on the minion which ran the map
+                host_output.CopyFrom(*cur_output);
+                host_output.set_host(cur->endpoint);
+                cur_output = &host_output;
+            }
+            if (map_outputs_ != NULL && !map_outputs_->Add(cur->resource_no, *cur_output)) {
+                LOG(WARNING, "map output is lost with a reduce task, run it again: %s, %d",
+                    job_id_.c_str(), cur->resource_no);
+                map_manager_->RedoItem(cur->resource_no);
+                state = kTaskKilled;
+                ++ map_killed_;
+                break;
+            }
             AccumulateCounters(counters);
             int completed = map_manager_->Done();
             LOG(INFO, "complete a map task(%d/%d): %s",
                     completed, map_manager_->SumOfItem(), job_id_.c_str());
-            if (completed == reduce_begin_ && job_descriptor_.job_type() != kMapOnlyJob) {
+            if (completed == reduce_begin_ && reduce_ == NULL
+                && job_descriptor_.job_type() != kMapOnlyJob) {
                 LOG(INFO, "map phrase nearly ends, pull up reduce tasks: %s", job_id_.c_str());
                 reduce_ = new Gru(galaxy_, &job_descriptor_, job_id_, kReduce);
                 if (reduce_->Start() != kOk) {
@@ -608,11 +737,9 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
                     master_->RetractJob(job_id_, kCompleted);
                     mu_.Lock();
                     state_ = kCompleted;
-                } else {
+                } else if (!map_phase_ended_) {
                     LOG(INFO, "map phrase ends now: %s", job_id_.c_str());
-                    failed_count_.resize(0);
-                    failed_count_.resize(reduce_manager_->SumOfItem(), 0);
-                    failed_nodes_.clear();
+                    map_phase_ended_ = true;
                     mu_.Unlock();
                     {
                         MutexLock lock(&alloc_mu_);
@@ -640,25 +767,29 @@ Status JobTracker::FinishMap(int no, int attempt, TaskState state,
                         monitor_->AddTask(boost::bind(&JobTracker::KeepMonitoring,
                                     this, false));
                     }
-                    if (map_ != NULL) {
+                    if (map_ != NULL && !job_descriptor_.host_shuffle()) {
                         LOG(INFO, "map minion finished, kill: %s", job_id_.c_str());
                         delete map_;
                         map_ = NULL;
                     }
+                } else if (map_ != NULL && !job_descriptor_.host_shuffle()) {
+                    LOG(INFO, "maps run again are done, kill map minion: %s", job_id_.c_str());
+                    delete map_;
+                    map_ = NULL;
                 }
             }
             break;
         case kTaskFailed:
             map_manager_->ReturnBackItem(cur->resource_no);
             //only increment failed_count when fail on different nodes
-            if (failed_nodes_[cur->resource_no].find(cur_node) == failed_nodes_[cur->resource_no].end()) {
-                ++ failed_count_[cur->resource_no];
-                failed_nodes_[cur->resource_no].insert(cur_node);
+            if (map_failed_nodes_[cur->resource_no].find(cur_node) == map_failed_nodes_[cur->resource_no].end()) {
+                ++ map_failed_count_[cur->resource_no];
+                map_failed_nodes_[cur->resource_no].insert(cur_node);
                 LOG(WARNING, "failed map task: job_id: %s, no: %d, aid: %d, node: %s",
                     job_id_.c_str(), cur->resource_no, cur->attempt, cur_node.c_str());
             }
             ++ map_failed_;
-            if (failed_count_[cur->resource_no] >= job_descriptor_.map_retry()) {
+            if (map_failed_count_[cur->resource_no] >= job_descriptor_.map_retry()) {
                 if (ignored_map_failures_ < job_descriptor_.ignore_map_failures()) {
                     ignore_failure_mappers_.insert(cur->resource_no);
                     ignored_map_failures_++;
@@ -782,6 +913,7 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
                 if (!fs_->Remove(work_dir)) {
                     LOG(WARNING, "remove temp failed");
                 }
+                RemoveNfsWorkDir();
                 master_->RetractJob(job_id_, kCompleted);
                 mu_.Lock();
                 state_ = kCompleted;
@@ -790,14 +922,14 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
         case kTaskFailed:
             reduce_manager_->ReturnBackItem(cur->resource_no);
             //only increment failed_count when fail on different nodes
-            if (failed_nodes_[cur->resource_no].find(cur_node) == failed_nodes_[cur->resource_no].end()) {
-                ++ failed_count_[cur->resource_no];
-                failed_nodes_[cur->resource_no].insert(cur_node);
+            if (reduce_failed_nodes_[cur->resource_no].find(cur_node) == reduce_failed_nodes_[cur->resource_no].end()) {
+                ++ reduce_failed_count_[cur->resource_no];
+                reduce_failed_nodes_[cur->resource_no].insert(cur_node);
                 LOG(WARNING, "failed reduce task: job_id: %s, no: %d, aid: %d, node: %s",
                               job_id_.c_str(), cur->resource_no, cur->attempt, cur_node.c_str());
             }
             ++ reduce_failed_;
-            if (failed_count_[cur->resource_no] >= job_descriptor_.reduce_retry()) {
+            if (reduce_failed_count_[cur->resource_no] >= job_descriptor_.reduce_retry()) {
                 if (ignored_reduce_failures_ < job_descriptor_.ignore_reduce_failures()) {
                     ignore_failure_reducers_.insert(cur->resource_no);
                     ignored_reduce_failures_++;
@@ -827,6 +959,13 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
             LOG(WARNING, "unfamiliar task finish status: %d", state);
             return kNoMore;
         }
+        if (state != kTaskCompleted && map_outputs_ != NULL
+            && job_descriptor_.push_shuffle()
+            && !reduce_manager_->IsDone(cur->resource_no)) {
+            std::vector<int> lost_maps;
+            map_outputs_->DropReceiver(cur->resource_no, cur->attempt, &lost_maps);
+            RedoMaps(lost_maps);
+        }
     }
     {
         MutexLock lock(&alloc_mu_);
@@ -847,6 +986,112 @@ Status JobTracker::FinishReduce(int no, int attempt, TaskState state,
     return kOk;
 }
 
+Status JobTracker::ClaimTuo(int no, int attempt, int level, int tuo_total,
+                            int prefer, int* tuo_no) {
+    if (!IsReduceRunning(no, attempt)) {
+        LOG(WARNING, "claim tuo from an inexist reduce task: < no - %d, attempt - %d >: %s",
+                no, attempt, job_id_.c_str());
+        return kNoSuchTask;
+    }
+    return merge_coordinator_->Claim(no, attempt, level, tuo_total, prefer, tuo_no);
+}
+
+Status JobTracker::FinishTuo(int no, int attempt, int level, int tuo_total,
+                             int tuo_no, bool succeeded) {
+    return merge_coordinator_->Finish(no, attempt, level, tuo_total, tuo_no, succeeded);
+}
+
+void JobTracker::WaitTuo(int level, int tuo_total, int timeout,
+                         WaitTuoResponse* response, ::google::protobuf::Closure* done) {
+    merge_coordinator_->Wait(level, tuo_total, timeout, response, done);
+}
+
+void JobTracker::PaceTuoWaits() {
+    merge_coordinator_->Pace();
+}
+
+void JobTracker::GetMapOutputs(int reduce_no, GetMapOutputsResponse* response) {
+    if (map_outputs_ == NULL) {
+        response->set_status(kNoMore);
+        return;
+    }
+    map_outputs_->GetSlice(reduce_no, response);
+    //trailing reduces with no records are left out of the spills
+    while (response->reduce_bytes_size() < job_descriptor_.reduce_total()) {
+        response->add_reduce_bytes(0);
+    }
+    //the manifest of a reloaded job misses the maps done before the reload,
+    //reduce tasks list the work dir for them as long as done counts them
+    if (map_manager_ != NULL) {
+        response->set_done(std::max(response->done(), map_manager_->Done()));
+    }
+    response->set_status(kOk);
+}
+
+void JobTracker::GetReduceEndpoints(GetReduceEndpointsResponse* response) {
+    MutexLock lock(&alloc_mu_);
+    std::map<int, std::map<int, AllocateItem*> >::iterator it;
+    for (it = reduce_index_.begin(); it != reduce_index_.end(); it++) {
+        std::map<int, AllocateItem*>::iterator jt;
+        for (jt = it->second.begin(); jt != it->second.end(); jt++) {
+            if (jt->second->state == kTaskRunning) {
+                ReduceEndpoint* reduce = response->add_reduces();
+                reduce->set_reduce_no(it->first);
+                reduce->set_attempt(jt->first);
+                reduce->set_endpoint(jt->second->endpoint);
+                break;
+            }
+        }
+    }
+    response->set_status(kOk);
+}
+
+Status JobTracker::ReportLostOutput(int map_no, int attempt) {
+    if (map_outputs_ == NULL || !job_descriptor_.host_shuffle()) {
+        return kInvalidArg;
+    }
+    MutexLock lock(&mu_);
+    //reported by every reduce task, but only the first one drops it
+    if (map_outputs_->DropHost(map_no, attempt)) {
+        RedoMaps(std::vector<int>(1, map_no));
+    }
+    return kOk;
+}
+
+// maps whose outputs are lost, they may run after the map phase ends
+void JobTracker::RedoMaps(const std::vector<int>& maps) {
+    mu_.AssertHeld();
+    int n_redo = 0;
+    std::vector<int>::const_iterator it;
+    for (it = maps.begin(); it != maps.end(); it++) {
+        if (map_manager_->RedoItem(*it)) {
+            n_redo++;
+        }
+    }
+    if (n_redo == 0) {
+        return;
+    }
+    LOG(WARNING, "%d maps run again for their outputs are lost: %s",
+        n_redo, job_id_.c_str());
+    map_dismissed_.clear();
+    if (map_ == NULL) {
+        map_ = new Gru(galaxy_, &job_descriptor_, job_id_, kMap);
+        if (map_->Start() != kOk) {
+            LOG(WARNING, "fail to pull up map minions again: %s", job_id_.c_str());
+        }
+    }
+}
+
+bool JobTracker::IsReduceRunning(int no, int attempt) {
+    MutexLock lock(&alloc_mu_);
+    std::map<int, std::map<int, AllocateItem*> >::iterator it = reduce_index_.find(no);
+    if (it == reduce_index_.end()) {
+        return false;
+    }
+    std::map<int, AllocateItem*>::iterator jt = it->second.find(attempt);
+    return jt != it->second.end() && jt->second->state == kTaskRunning;
+}
+
 void JobTracker::CancelCallback(const CancelTaskRequest* request, CancelTaskResponse* response, bool fail, int eno) {
     delete request;
     delete response;
@@ -956,18 +1201,37 @@ bool JobTracker::Load(const std::string& jobid, const JobState state,
     }
     if (job_descriptor_.reduce_total() != 0) {
         reduce_manager_ = new IdManager(job_descriptor_.reduce_total());
+        //outputs of the maps done before reloading are listed by reduce tasks
+        map_outputs_ = new MapOutputManifest(job_descriptor_.map_total());
         std::vector<IdItem> id_data;
         id_data.resize(reduce_manager_->SumOfItem());
         Replay(data, id_data, false);
         reduce_manager_->Load(id_data);
     }
     BuildEndGameCounters();
+    if (state_ == kRunning && job_descriptor_.host_shuffle()
+        && map_manager_ != NULL && reduce_manager_ != NULL) {
+        //the minions keeping the spills of the maps done are not saved,
+        //and reduce tasks can not list them, so the maps run again
+        int done_before = map_manager_->Done();
+        int n_redo = 0;
+        for (int i = 0; i < job_descriptor_.map_total(); i++) {
+            if (map_manager_->RedoItem(i)) {
+                n_redo++;
+            }
+        }
+        LOG(WARNING, "%d maps run again for the hosts of their outputs are lost: %s",
+            n_redo, job_id_.c_str());
+        if (done_before >= reduce_begin_) {
+            reduce_begin_ = -1; //reduce tasks were pulled up before the reload
+        }
+    }
     bool is_map = true;
-    failed_count_.resize(job_descriptor_.map_total());
+    map_failed_count_.resize(job_descriptor_.map_total(), 0);
+    reduce_failed_count_.resize(job_descriptor_.reduce_total(), 0);
     if (map_manager_ && map_manager_->Done() == job_descriptor_.map_total()) {
         is_map = false;
-        failed_count_.resize(0);
-        failed_count_.resize(job_descriptor_.reduce_total());
+        map_phase_ended_ = true;
     }
     MutexLock lock(&alloc_mu_);
     if (state_ == kRunning) {
@@ -12,6 +12,8 @@
 #include "proto/shuttle.pb.h"
 #include "proto/app_master.pb.h"
 #include "resource_manager.h"
+#include "merge_coordinator.h"
+#include "map_output_manifest.h"
 #include "gru.h"
 #include "common/rpc_client.h"
 #include "common/filesystem.h"
@@ -55,10 +57,22 @@ public:
     IdItem* AssignReduce(const std::string& endpoint, Status* status);
     Status FinishMap(int no, int attempt, TaskState state, 
                      const std::string& err_msg,
-                     const std::map<std::string, int64_t>& counters);
+                     const std::map<std::string, int64_t>& counters,
+                     const MapOutput& output);
     Status FinishReduce(int no, int attempt, TaskState state, 
                         const std::string& err_msg,
                         const std::map<std::string, int64_t>& counters);
+    Status ClaimTuo(int no, int attempt, int level, int tuo_total,
+                    int prefer, int* tuo_no);
+    Status FinishTuo(int no, int attempt, int level, int tuo_total,
+                     int tuo_no, bool succeeded);
+    void WaitTuo(int level, int tuo_total, int timeout,
+                 WaitTuoResponse* response, ::google::protobuf::Closure* done);
+    void PaceTuoWaits();
+    void GetMapOutputs(int reduce_no, GetMapOutputsResponse* response);
+    void GetReduceEndpoints(GetReduceEndpointsResponse* response);
+    // a reduce task fails to read the spills a minion keeps for a map
+    Status ReportLostOutput(int map_no, int attempt);
     bool AccumulateCounters(const std::map<std::string, int64_t>& counters);
     void FillCounters(ShowJobResponse* response);
     
@@ -118,7 +132,9 @@ public:
 
 private:
     void BuildOutputFsPointer();
+    void RemoveNfsWorkDir();
     Status BuildResourceManagers();
+    void SampleSplitPoints(const FileSystem::Param& input_param);
     void BuildEndGameCounters();
     void KeepMonitoring(bool map_now);
     std::string GenerateJobId();
@@ -128,6 +144,8 @@ private:
                              int no, int attempt) ;
     void CanReduceDismiss(Status* status, const std::string& endpoint);
     void CanMapDismiss(Status* status, const std::string& endpoint);
+    bool IsReduceRunning(int no, int attempt);
+    void RedoMaps(const std::vector<int>& maps);
 private:
     MasterImpl* master_;
     ::baidu::galaxy::Galaxy* galaxy_;
@@ -143,8 +161,11 @@ private:
     std::vector<AllocateItem*> allocation_table_;
     std::priority_queue<AllocateItem*, std::vector<AllocateItem*>,
                         AllocateItemComparator> time_heap_;
-    std::vector<int> failed_count_;
-    std::map<int, std::set<std::string> > failed_nodes_;
+    // maps may fail after the map phase ends, when they run again
+    std::vector<int> map_failed_count_;
+    std::map<int, std::set<std::string> > map_failed_nodes_;
+    std::vector<int> reduce_failed_count_;
+    std::map<int, std::set<std::string> > reduce_failed_nodes_;
     std::queue<int> map_slug_;
     std::queue<int> reduce_slug_;
     // Map resource
@@ -166,6 +187,8 @@ private:
     ThreadPool* monitor_;
     bool map_monitoring_;
     bool reduce_monitoring_;
+    // not again when the maps run again for lost outputs are done
+    bool map_phase_ended_;
     // To communicate with minion
     RpcClient* rpc_client_;
     // To check if output path is exists
@@ -181,6 +204,10 @@ private:
     int32_t ignored_map_failures_;
     int32_t ignored_reduce_failures_;
     FileSystem::Param output_param_;
+    // Tuo merges of the reduce tasks
+    MergeCoordinator* merge_coordinator_;
+    // Spill files of the completed maps, for the reduce tasks
+    MapOutputManifest* map_outputs_;
 };
 
 }
@@ -0,0 +1,159 @@
+#include "map_output_manifest.h"
+
+#include <algorithm>
+#include <limits>
+#include "logging.h"
+
+namespace baidu {
+namespace shuttle {
+
+MapOutputManifest::MapOutputManifest(int map_total) : n_done_(0) {
+    spills_.resize(map_total);
+    heads_.resize(map_total);
+    done_.resize(map_total, false);
+}
+
+bool MapOutputManifest::Add(int map_no, const MapOutput& output) {
+    MutexLock lock(&mu_);
+    if (map_no < 0 || map_no >= (int)done_.size()) {
+        LOG(WARNING, "ignore output of an unknown map: %d", map_no);
+        return true;
+    }
+    for (int i = 0; i < output.pushed_size(); i++) {
+        const PushedSegment& segment = output.pushed(i);
+        if (dropped_receivers_.find(std::make_pair(segment.reduce_no(),
+                                                   segment.reduce_attempt()))
+            != dropped_receivers_.end()) {
+            LOG(WARNING, "map %d pushed to a dropped reduce: < no - %d, attempt - %d >",
+                map_no, segment.reduce_no(), segment.reduce_attempt());
+            return false;
+        }
+    }
+    heads_[map_no].Clear();
+    heads_[map_no].set_attempt(output.attempt());
+    if (output.has_host()) {
+        heads_[map_no].set_host(output.host());
+    }
+    heads_[map_no].mutable_pushed()->CopyFrom(output.pushed());
+    std::vector<Spill>& spills = spills_[map_no];
+    CountBytes(spills, -1);
+    spills.clear();
+    spills.resize(output.files_size());
+    for (int i = 0; i < output.files_size(); i++) {
+        const SpillFile& file = output.files(i);
+        spills[i].name = file.name();
+        spills[i].size = file.size();
+        spills[i].partition_bytes.reserve(file.partition_bytes_size());
+        for (int j = 0; j < file.partition_bytes_size(); j++) {
+            int64_t bytes = std::min(file.partition_bytes(j),
+                                     (int64_t)std::numeric_limits<uint32_t>::max());
+            spills[i].partition_bytes.push_back(bytes);
+        }
+    }
+    CountBytes(spills, 1);
+    if (!done_[map_no]) {
+        done_[map_no] = true;
+        n_done_++;
+    }
+    return true;
+}
+
+int MapOutputManifest::Done() {
+    MutexLock lock(&mu_);
+    return n_done_;
+}
+
+void MapOutputManifest::CountBytes(const std::vector<Spill>& spills, int64_t sign) {
+    mu_.AssertHeld();
+    std::vector<Spill>::const_iterator it;
+    for (it = spills.begin(); it != spills.end(); it++) {
+        if (reduce_bytes_.size() < it->partition_bytes.size()) {
+            reduce_bytes_.resize(it->partition_bytes.size(), 0);
+        }
+        for (size_t i = 0; i < it->partition_bytes.size(); i++) {
+            reduce_bytes_[i] += sign * it->partition_bytes[i];
+        }
+    }
+}
+
+void MapOutputManifest::GetSlice(int reduce_no, GetMapOutputsResponse* response) {
+    MutexLock lock(&mu_);
+    response->set_done(n_done_);
+    std::vector<int64_t>::iterator bt;
+    for (bt = reduce_bytes_.begin(); bt != reduce_bytes_.end(); bt++) {
+        response->add_reduce_bytes(*bt);
+    }
+    for (size_t map_no = 0; map_no < spills_.size(); map_no++) {
+        const std::vector<Spill>& spills = spills_[map_no];
+        if (spills.empty()) {
+            continue;
+        }
+        MapOutput* output = response->add_outputs();
+        output->set_map_no(map_no);
+        const MapOutput& head = heads_[map_no];
+        output->set_attempt(head.attempt());
+        if (head.has_host()) {
+            output->set_host(head.host());
+        }
+        for (int i = 0; i < head.pushed_size(); i++) {
+            if (head.pushed(i).reduce_no() == reduce_no) {
+                output->add_pushed()->CopyFrom(head.pushed(i));
+            }
+        }
+        std::vector<Spill>::const_iterator it;
+        for (it = spills.begin(); it != spills.end(); it++) {
+            SpillFile* file = output->add_files();
+            file->set_name(it->name);
+            file->set_size(it->size);
+            if (reduce_no >= 0 && reduce_no < (int)it->partition_bytes.size()) {
+                file->add_partition_bytes(it->partition_bytes[reduce_no]);
+            } else if (!it->partition_bytes.empty()) {
+                file->add_partition_bytes(0); //trimmed trailing reduce
+            }
+        }
+    }
+}
+
+void MapOutputManifest::DropReceiver(int reduce_no, int attempt,
+                                     std::vector<int>* lost_maps) {
+    MutexLock lock(&mu_);
+    dropped_receivers_.insert(std::make_pair(reduce_no, attempt));
+    for (size_t map_no = 0; map_no < heads_.size(); map_no++) {
+        const MapOutput& head = heads_[map_no];
+        bool lost = false;
+        for (int i = 0; i < head.pushed_size() && !lost; i++) {
+            lost = (head.pushed(i).reduce_no() == reduce_no
+                    && head.pushed(i).reduce_attempt() == attempt);
+        }
+        if (!lost) {
+            continue;
+        }
+        CountBytes(spills_[map_no], -1);
+        spills_[map_no].clear();
+        heads_[map_no].Clear();
+        if (done_[map_no]) {
+            done_[map_no] = false;
+            n_done_--;
+        }
+        lost_maps->push_back(map_no);
+    }
+}
+
+bool MapOutputManifest::DropHost(int map_no, int attempt) {
+    MutexLock lock(&mu_);
+    if (map_no < 0 || map_no >= (int)done_.size() || !done_[map_no]
+        || heads_[map_no].host().empty() || heads_[map_no].attempt() != attempt) {
+        return false;
+    }
+    LOG(WARNING, "output of map < no - %d, attempt - %d > is lost with %s",
+        map_no, attempt, heads_[map_no].host().c_str());
+    CountBytes(spills_[map_no], -1);
+    spills_[map_no].clear();
+    heads_[map_no].Clear();
+    done_[map_no] = false;
+    n_done_--;
+    return true;
+}
+
+}
+}
@@ -0,0 +1,55 @@
+#ifndef _BAIDU_SHUTTLE_MAP_OUTPUT_MANIFEST_H_
+#define _BAIDU_SHUTTLE_MAP_OUTPUT_MANIFEST_H_
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "proto/app_master.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// spill files of the completed maps of a job, reduce tasks get their
+// slice of it instead of listing the map dirs of the shuffle work dir
+class MapOutputManifest {
+public:
+    explicit MapOutputManifest(int map_total);
+
+    // a map with no files is done, but left to be listed by reduce tasks.
+    // false if the output was pushed to a reduce attempt already dropped
+    bool Add(int map_no, const MapOutput& output);
+    int Done();
+    void GetSlice(int reduce_no, GetMapOutputsResponse* response);
+    // the segments pushed to a reduce attempt are lost with it, the maps
+    // which pushed them are not done any more and have to run again
+    void DropReceiver(int reduce_no, int attempt, std::vector<int>* lost_maps);
+    // the output of a map attempt kept by a minion which is gone, false if
+    // it was dropped already or a later attempt is done
+    bool DropHost(int map_no, int attempt);
+
+private:
+    struct Spill {
+        std::string name;
+        int64_t size;
+        // a spill holds no more than a memtable, so 32 bits fit a partition
+        std::vector<uint32_t> partition_bytes;
+    };
+    void CountBytes(const std::vector<Spill>& spills, int64_t sign);
+private:
+    Mutex mu_;
+    std::vector<std::vector<Spill> > spills_;
+    // attempt, host and pushed segments of each map, without spill files
+    std::vector<MapOutput> heads_;
+    std::set<std::pair<int, int> > dropped_receivers_;
+    std::vector<bool> done_;
+    int n_done_;
+    // bytes of each reduce in the spills above
+    std::vector<int64_t> reduce_bytes_;
+};
+
+}
+}
+
+#endif
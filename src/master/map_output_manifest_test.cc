@@ -0,0 +1,156 @@
+#include "map_output_manifest.h"
+
+#include <gtest/gtest.h>
+
+using namespace baidu::shuttle;
+
+static void AddSpill(MapOutput* output, const std::string& name, int64_t size,
+                     int64_t bytes_0, int64_t bytes_1) {
+    SpillFile* file = output->add_files();
+    file->set_name(name);
+    file->set_size(size);
+    file->add_partition_bytes(bytes_0);
+    file->add_partition_bytes(bytes_1);
+}
+
+TEST(MapOutputManifestTest, Slice) {
+    MapOutputManifest manifest(3);
+    MapOutput output;
+    AddSpill(&output, "0.sort", 100, 10, 0);
+    AddSpill(&output, "1.sort", 200, 0, 20);
+    manifest.Add(2, output);
+    manifest.Add(0, MapOutput());
+    EXPECT_EQ(manifest.Done(), 2);
+
+    GetMapOutputsResponse response;
+    manifest.GetSlice(1, &response);
+    EXPECT_EQ(response.done(), 2);
+    //a map with no files is left out
+    ASSERT_EQ(response.outputs_size(), 1);
+    const MapOutput& slice = response.outputs(0);
+    EXPECT_EQ(slice.map_no(), 2);
+    ASSERT_EQ(slice.files_size(), 2);
+    EXPECT_EQ(slice.files(1).name(), "1.sort");
+    EXPECT_EQ(slice.files(1).size(), 200);
+    ASSERT_EQ(slice.files(0).partition_bytes_size(), 1);
+    EXPECT_EQ(slice.files(0).partition_bytes(0), 0);
+    EXPECT_EQ(slice.files(1).partition_bytes(0), 20);
+
+    //trimmed reduces have no bytes
+    response.Clear();
+    manifest.GetSlice(5, &response);
+    EXPECT_EQ(response.outputs(0).files(0).partition_bytes(0), 0);
+}
+
+TEST(MapOutputManifestTest, ReduceBytes) {
+    MapOutputManifest manifest(2);
+    MapOutput output;
+    AddSpill(&output, "0.sort", 100, 10, 0);
+    AddSpill(&output, "1.sort", 200, 5, 20);
+    output.set_attempt(1);
+    output.set_host("host:1");
+    manifest.Add(0, output);
+    manifest.Add(1, output);
+    GetMapOutputsResponse response;
+    manifest.GetSlice(0, &response);
+    ASSERT_EQ(response.reduce_bytes_size(), 2);
+    EXPECT_EQ(response.reduce_bytes(0), 30);
+    EXPECT_EQ(response.reduce_bytes(1), 40);
+    //a later attempt replaces the bytes of the map, a lost one drops them
+    output.mutable_files()->RemoveLast();
+    manifest.Add(1, output);
+    EXPECT_TRUE(manifest.DropHost(0, 1));
+    response.Clear();
+    manifest.GetSlice(1, &response);
+    ASSERT_EQ(response.reduce_bytes_size(), 2);
+    EXPECT_EQ(response.reduce_bytes(0), 10);
+    EXPECT_EQ(response.reduce_bytes(1), 0);
+}
+
+TEST(MapOutputManifestTest, Replace) {
+    MapOutputManifest manifest(1);
+    MapOutput output;
+    AddSpill(&output, "0.sort", 100, 10, 0);
+    AddSpill(&output, "1.sort", 100, 10, 0);
+    manifest.Add(0, output);
+    output.mutable_files()->RemoveLast();
+    manifest.Add(0, output);
+    manifest.Add(1, output);
+    EXPECT_EQ(manifest.Done(), 1);
+    GetMapOutputsResponse response;
+    manifest.GetSlice(0, &response);
+    ASSERT_EQ(response.outputs_size(), 1);
+    EXPECT_EQ(response.outputs(0).files_size(), 1);
+}
+
+TEST(MapOutputManifestTest, Pushed) {
+    MapOutputManifest manifest(3);
+    for (int map_no = 0; map_no < 3; map_no++) {
+        MapOutput output;
+        AddSpill(&output, "0.sort", 100, 0, 10);
+        output.set_attempt(1);
+        PushedSegment* segment = output.add_pushed();
+        segment->set_reduce_no(0);
+        segment->set_reduce_attempt(map_no == 2 ? 2 : 1);
+        segment->set_file_no(0);
+        segment->set_chunks(1);
+        EXPECT_TRUE(manifest.Add(map_no, output));
+    }
+    GetMapOutputsResponse response;
+    manifest.GetSlice(1, &response);
+    EXPECT_EQ(response.outputs(0).pushed_size(), 0);
+    response.Clear();
+    manifest.GetSlice(0, &response);
+    ASSERT_EQ(response.outputs_size(), 3);
+    EXPECT_EQ(response.outputs(0).attempt(), 1);
+    ASSERT_EQ(response.outputs(0).pushed_size(), 1);
+    EXPECT_EQ(response.outputs(0).pushed(0).chunks(), 1);
+
+    //maps which pushed to a lost reduce attempt run again
+    std::vector<int> lost_maps;
+    manifest.DropReceiver(0, 1, &lost_maps);
+    ASSERT_EQ(lost_maps.size(), 2u);
+    EXPECT_EQ(lost_maps[1], 1);
+    EXPECT_EQ(manifest.Done(), 1);
+    MapOutput late;
+    late.add_pushed()->set_reduce_no(0);
+    late.mutable_pushed(0)->set_reduce_attempt(1);
+    EXPECT_FALSE(manifest.Add(0, late));
+    EXPECT_EQ(manifest.Done(), 1);
+}
+
+TEST(MapOutputManifestTest, Host) {
+    MapOutputManifest manifest(2);
+    MapOutput output;
+    AddSpill(&output, "1_0.sort", 100, 10, 10);
+    output.set_attempt(1);
+    output.set_host("host1:7900");
+    manifest.Add(0, output);
+    output.clear_host();
+    manifest.Add(1, output);
+    GetMapOutputsResponse response;
+    manifest.GetSlice(0, &response);
+    ASSERT_EQ(response.outputs_size(), 2);
+    EXPECT_EQ(response.outputs(0).host(), "host1:7900");
+    EXPECT_FALSE(response.outputs(1).has_host());
+
+    //outputs on the shuffle fs and of other attempts are not dropped
+    EXPECT_FALSE(manifest.DropHost(1, 1));
+    EXPECT_FALSE(manifest.DropHost(0, 0));
+    EXPECT_TRUE(manifest.DropHost(0, 1));
+    EXPECT_FALSE(manifest.DropHost(0, 1));
+    EXPECT_EQ(manifest.Done(), 1);
+    output.set_attempt(2);
+    output.set_host("host2:7900");
+    manifest.Add(0, output);
+    EXPECT_EQ(manifest.Done(), 2);
+    response.Clear();
+    manifest.GetSlice(0, &response);
+    EXPECT_EQ(response.outputs(0).host(), "host2:7900");
+    EXPECT_EQ(response.outputs(0).attempt(), 2);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
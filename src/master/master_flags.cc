@@ -10,6 +10,7 @@ DEFINE_int32(time_tolerance, 120, "longest time interval of the monitor sleep");
 DEFINE_int32(replica_num, 3, "max replicas of a single task");
 DEFINE_int32(replica_begin, 100, "the last tasks that are suitable for end game strategy");
 DEFINE_int32(replica_begin_percent, 10, "the last percentage of tasks for end game strategy");
+DEFINE_int32(pipelined_reduce_begin_percent, 50, "percentage of maps done before reduce tasks of a pipelined shuffle start");
 DEFINE_int32(left_percent, 120, "percentage of left minions when there's no more resource for minion");
 DEFINE_int32(parallel_attempts, 4, "max running replica of a certain task");
 DEFINE_string(nexus_root_path, "/shuttle/", "root of nexus path, compatible with galaxy nexus system");
@@ -28,3 +29,8 @@ DEFINE_bool(enable_memory_soft_limit, false, "enable memory soft limit or not");
 DEFINE_string(galaxy_node_label, "", "set deploying node label on Galaxy");
 DEFINE_bool(ignore_ins_error, false, "whether ignore nexus errors");
 DEFINE_bool(skip_history, false, "whether skip history when master restarting");
+DEFINE_int32(io_permits_per_host, 200, "tasks opening files of a dfs cluster at once, 0 means no limit");
+DEFINE_int32(io_permit_rate, 0, "io permits granted per second on a dfs cluster, 0 means no limit");
+DEFINE_int32(io_permit_lease, 60, "seconds an io permit lasts if its task neither releases nor renews it");
+DEFINE_int32(partition_sample_splits, 10, "input splits sampled for the split points of a total order partitioner");
+DEFINE_int32(partition_samples_per_split, 10000, "records sampled from each of these splits");
@@ -24,15 +24,22 @@ DECLARE_int32(backup_interval);
 DECLARE_bool(recovery);
 DECLARE_bool(ignore_ins_error);
 DECLARE_bool(skip_history);
+DECLARE_int32(io_permits_per_host);
+DECLARE_int32(io_permit_rate);
+DECLARE_int32(io_permit_lease);
 
 namespace baidu {
 namespace shuttle {
 
-MasterImpl::MasterImpl() {
+MasterImpl::MasterImpl() : io_admission_(FLAGS_io_permits_per_host,
+                                           FLAGS_io_permit_rate,
+                                           FLAGS_io_permit_lease) {
     srand(time(NULL));
     galaxy_sdk_ = ::baidu::galaxy::Galaxy::ConnectGalaxy(FLAGS_galaxy_address);
     nexus_ = new ::galaxy::ins::sdk::InsSDK(FLAGS_nexus_server_list);
     gc_.AddTask(boost::bind(&MasterImpl::KeepGarbageCollecting, this));
+    gc_.AddTask(boost::bind(&MasterImpl::KeepPacingIo, this));
+    gc_.AddTask(boost::bind(&MasterImpl::KeepPacingTuoWaits, this));
 }
 
 MasterImpl::~MasterImpl() {
@@ -44,6 +51,9 @@ MasterImpl::~MasterImpl() {
     for (it = dead_trackers_.begin(); it != dead_trackers_.end(); ++it) {
         delete it->second;
     }
+    //gc_ may still pace the waits of trackers until it is stopped
+    job_trackers_.clear();
+    dead_trackers_.clear();
     delete galaxy_sdk_;
     delete nexus_;
 }
@@ -310,7 +320,8 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
                                            request->attempt_id(),
                                            request->task_state(),
                                            request->error_msg(),
-                                           counters);
+                                           counters,
+                                           request->map_output());
         }
         response->set_status(status);
     } else {
@@ -331,6 +342,138 @@ void MasterImpl::FinishTask(::google::protobuf::RpcController* /*controller*/,
     done->Run();
 }
 
+JobTracker* MasterImpl::GetRunningTracker(const std::string& jobid) {
+    MutexLock lock(&(tracker_mu_));
+    std::map<std::string, JobTracker*>::iterator it = job_trackers_.find(jobid);
+    if (it == job_trackers_.end()) {
+        return NULL;
+    }
+    return it->second;
+}
+
+void MasterImpl::ClaimTuo(::google::protobuf::RpcController* /*controller*/,
+                          const ::baidu::shuttle::ClaimTuoRequest* request,
+                          ::baidu::shuttle::ClaimTuoResponse* response,
+                          ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker != NULL) {
+        int tuo_no = -1;
+        Status status = jobtracker->ClaimTuo(request->reduce_no(),
+                                             request->attempt_id(),
+                                             request->level(),
+                                             request->tuo_total(),
+                                             request->prefer(),
+                                             &tuo_no);
+        response->set_status(status);
+        if (status == kOk) {
+            response->set_tuo_no(tuo_no);
+        }
+    } else {
+        LOG(WARNING, "claim tuo failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
+void MasterImpl::FinishTuo(::google::protobuf::RpcController* /*controller*/,
+                           const ::baidu::shuttle::FinishTuoRequest* request,
+                           ::baidu::shuttle::FinishTuoResponse* response,
+                           ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker != NULL) {
+        Status status = jobtracker->FinishTuo(request->reduce_no(),
+                                              request->attempt_id(),
+                                              request->level(),
+                                              request->tuo_total(),
+                                              request->tuo_no(),
+                                              request->succeeded());
+        response->set_status(status);
+    } else {
+        LOG(WARNING, "finish tuo failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
+void MasterImpl::WaitTuo(::google::protobuf::RpcController* /*controller*/,
+                         const ::baidu::shuttle::WaitTuoRequest* request,
+                         ::baidu::shuttle::WaitTuoResponse* response,
+                         ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker == NULL) {
+        LOG(WARNING, "wait tuo failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+        done->Run();
+        return;
+    }
+    //done is run by the tracker once the level is merged or the wait times out
+    jobtracker->WaitTuo(request->level(), request->tuo_total(),
+                        request->timeout(), response, done);
+}
+
+void MasterImpl::GetMapOutputs(::google::protobuf::RpcController* /*controller*/,
+                               const ::baidu::shuttle::GetMapOutputsRequest* request,
+                               ::baidu::shuttle::GetMapOutputsResponse* response,
+                               ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker != NULL) {
+        jobtracker->GetMapOutputs(request->reduce_no(), response);
+    } else {
+        LOG(WARNING, "get map outputs failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
+void MasterImpl::GetReduceEndpoints(::google::protobuf::RpcController* /*controller*/,
+                                    const ::baidu::shuttle::GetReduceEndpointsRequest* request,
+                                    ::baidu::shuttle::GetReduceEndpointsResponse* response,
+                                    ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker != NULL) {
+        jobtracker->GetReduceEndpoints(response);
+    } else {
+        LOG(WARNING, "get reduce endpoints failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
+void MasterImpl::ReportLostOutput(::google::protobuf::RpcController* /*controller*/,
+                                  const ::baidu::shuttle::ReportLostOutputRequest* request,
+                                  ::baidu::shuttle::ReportLostOutputResponse* response,
+                                  ::google::protobuf::Closure* done) {
+    JobTracker* jobtracker = GetRunningTracker(request->jobid());
+    if (jobtracker != NULL) {
+        LOG(WARNING, "output of map < no - %d, attempt - %d > at %s is reported lost: %s",
+            request->map_no(), request->attempt(), request->host().c_str(),
+            request->jobid().c_str());
+        response->set_status(jobtracker->ReportLostOutput(request->map_no(),
+                                                          request->attempt()));
+    } else {
+        LOG(WARNING, "report lost output failed: job inexist: %s", request->jobid().c_str());
+        response->set_status(kNoSuchJob);
+    }
+    done->Run();
+}
+
+void MasterImpl::AcquireIoPermit(::google::protobuf::RpcController* /*controller*/,
+                                 const ::baidu::shuttle::AcquireIoPermitRequest* request,
+                                 ::baidu::shuttle::AcquireIoPermitResponse* response,
+                                 ::google::protobuf::Closure* done) {
+    //done is run once the permit is granted or the wait times out
+    io_admission_.Acquire(request->host(), request->holder(),
+                          request->timeout(), response, done);
+}
+
+void MasterImpl::ReleaseIoPermit(::google::protobuf::RpcController* /*controller*/,
+                                 const ::baidu::shuttle::ReleaseIoPermitRequest* request,
+                                 ::baidu::shuttle::ReleaseIoPermitResponse* response,
+                                 ::google::protobuf::Closure* done) {
+    response->set_status(io_admission_.Release(request->host(), request->holder()));
+    done->Run();
+}
+
 Status MasterImpl::RetractJob(const std::string& jobid, JobState end_state) {
     MutexLock lock(&(tracker_mu_));
     MutexLock lock2(&(dead_mu_));
@@ -492,6 +635,22 @@ void MasterImpl::KeepDataPersistence() {
     gc_.DelayTask(FLAGS_backup_interval, boost::bind(&MasterImpl::KeepDataPersistence, this));
 }
 
+void MasterImpl::KeepPacingIo() {
+    io_admission_.Pace();
+    gc_.DelayTask(1000, boost::bind(&MasterImpl::KeepPacingIo, this));
+}
+
+void MasterImpl::KeepPacingTuoWaits() {
+    {
+        MutexLock lock(&tracker_mu_);
+        for (std::map<std::string, JobTracker*>::iterator it = job_trackers_.begin();
+                it != job_trackers_.end(); ++it) {
+            it->second->PaceTuoWaits();
+        }
+    }
+    gc_.DelayTask(1000, boost::bind(&MasterImpl::KeepPacingTuoWaits, this));
+}
+
 void MasterImpl::Reload() {
     JobDescriptor job;
     JobState state;
@@ -10,6 +10,7 @@
 #include "thread_pool.h"
 #include "proto/app_master.pb.h"
 #include "job_tracker.h"
+#include "io_admission.h"
 
 namespace baidu {
 namespace shuttle {
@@ -50,6 +51,38 @@ public:
                     const ::baidu::shuttle::FinishTaskRequest* request,
                     ::baidu::shuttle::FinishTaskResponse* response,
                     ::google::protobuf::Closure* done);
+    void ClaimTuo(::google::protobuf::RpcController* controller,
+                  const ::baidu::shuttle::ClaimTuoRequest* request,
+                  ::baidu::shuttle::ClaimTuoResponse* response,
+                  ::google::protobuf::Closure* done);
+    void FinishTuo(::google::protobuf::RpcController* controller,
+                   const ::baidu::shuttle::FinishTuoRequest* request,
+                   ::baidu::shuttle::FinishTuoResponse* response,
+                   ::google::protobuf::Closure* done);
+    void WaitTuo(::google::protobuf::RpcController* controller,
+                 const ::baidu::shuttle::WaitTuoRequest* request,
+                 ::baidu::shuttle::WaitTuoResponse* response,
+                 ::google::protobuf::Closure* done);
+    void GetMapOutputs(::google::protobuf::RpcController* controller,
+                       const ::baidu::shuttle::GetMapOutputsRequest* request,
+                       ::baidu::shuttle::GetMapOutputsResponse* response,
+                       ::google::protobuf::Closure* done);
+    void GetReduceEndpoints(::google::protobuf::RpcController* controller,
+                            const ::baidu::shuttle::GetReduceEndpointsRequest* request,
+                            ::baidu::shuttle::GetReduceEndpointsResponse* response,
+                            ::google::protobuf::Closure* done);
+    void ReportLostOutput(::google::protobuf::RpcController* controller,
+                          const ::baidu::shuttle::ReportLostOutputRequest* request,
+                          ::baidu::shuttle::ReportLostOutputResponse* response,
+                          ::google::protobuf::Closure* done);
+    void AcquireIoPermit(::google::protobuf::RpcController* controller,
+                         const ::baidu::shuttle::AcquireIoPermitRequest* request,
+                         ::baidu::shuttle::AcquireIoPermitResponse* response,
+                         ::google::protobuf::Closure* done);
+    void ReleaseIoPermit(::google::protobuf::RpcController* controller,
+                         const ::baidu::shuttle::ReleaseIoPermitRequest* request,
+                         ::baidu::shuttle::ReleaseIoPermitResponse* response,
+                         ::google::protobuf::Closure* done);
 
     Status RetractJob(const std::string& jobid, JobState end_state);
 
@@ -61,8 +94,11 @@ private:
                                    ::galaxy::ins::sdk::SDKError err);
     void OnLockChange(const std::string& lock_session_id);
     std::string SelfEndpoint();
+    JobTracker* GetRunningTracker(const std::string& jobid);
     void KeepGarbageCollecting();
     void KeepDataPersistence();
+    void KeepPacingIo();
+    void KeepPacingTuoWaits();
     void Reload();
     bool GetJobInfoFromNexus(std::string& jobid, JobDescriptor& job, JobState& state,
                              std::vector<AllocateItem>& history,
@@ -89,6 +125,8 @@ private:
     std::map<std::string, JobTracker*> job_trackers_;
     Mutex dead_mu_;
     std::map<std::string, JobTracker*> dead_trackers_;
+    // shared by the tasks of all jobs, outlives the pacing of gc_
+    IoAdmission io_admission_;
     ThreadPool gc_;
     // For persistent of meta data and addressing of minion
     ::galaxy::ins::sdk::InsSDK* nexus_;
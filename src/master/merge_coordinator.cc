@@ -0,0 +1,177 @@
+#include "merge_coordinator.h"
+
+#include <algorithm>
+#include "logging.h"
+
+namespace baidu {
+namespace shuttle {
+
+const static int sMaxWaitSeconds = 60;
+
+MergeCoordinator::MergeCoordinator(const AliveFunc& is_alive) : is_alive_(is_alive) {
+
+}
+
+MergeCoordinator::~MergeCoordinator() {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        std::list<TuoWait>::iterator it;
+        for (it = waits_.begin(); it != waits_.end(); it++) {
+            it->response->set_status(kNoSuchJob);
+            dones.push_back(it->done);
+        }
+        waits_.clear();
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+MergeCoordinator::TuoLevel* MergeCoordinator::GetLevel(int level, int tuo_total) {
+    mu_.AssertHeld();
+    if (level < 0 || tuo_total <= 0) {
+        return NULL;
+    }
+    std::map<int, TuoLevel>::iterator it = levels_.find(level);
+    if (it == levels_.end()) {
+        TuoLevel& cur = levels_[level];
+        cur.states.resize(tuo_total, kTuoPending);
+        cur.holders.resize(tuo_total, std::make_pair(-1, -1));
+        cur.n_done = 0;
+        return &cur;
+    }
+    if ((int)it->second.states.size() != tuo_total) {
+        LOG(WARNING, "tuo total of level %d mismatch: %d, %d",
+            level, it->second.states.size(), tuo_total);
+        return NULL;
+    }
+    return &it->second;
+}
+
+Status MergeCoordinator::Claim(int no, int attempt, int level, int tuo_total,
+                               int prefer, int* tuo_no) {
+    MutexLock lock(&mu_);
+    TuoLevel* cur = GetLevel(level, tuo_total);
+    if (cur == NULL) {
+        return kInvalidArg;
+    }
+    const std::pair<int, int> holder(no, attempt);
+    //the response of an earlier claim may have been lost
+    for (int i = 0; i < tuo_total; i++) {
+        if (cur->states[i] == kTuoMerging && cur->holders[i] == holder) {
+            *tuo_no = i;
+            return kOk;
+        }
+    }
+    int chosen = -1;
+    if (prefer >= 0 && prefer < tuo_total && cur->states[prefer] == kTuoPending) {
+        chosen = prefer;
+    }
+    //reduce tasks start looking at different tuo, so that they rarely meet
+    for (int i = 0; i < tuo_total && chosen < 0; i++) {
+        int candidate = (no + i) % tuo_total;
+        if (cur->states[candidate] == kTuoPending) {
+            chosen = candidate;
+        }
+    }
+    for (int i = 0; i < tuo_total && chosen < 0; i++) {
+        if (cur->states[i] == kTuoMerging
+            && !is_alive_(cur->holders[i].first, cur->holders[i].second)) {
+            LOG(INFO, "take over tuo %d of level %d from < no - %d, attempt - %d >",
+                i, level, cur->holders[i].first, cur->holders[i].second);
+            chosen = i;
+        }
+    }
+    if (chosen < 0) {
+        return kNoMore;
+    }
+    cur->states[chosen] = kTuoMerging;
+    cur->holders[chosen] = holder;
+    *tuo_no = chosen;
+    return kOk;
+}
+
+Status MergeCoordinator::Finish(int no, int attempt, int level, int tuo_total,
+                                int tuo_no, bool succeeded) {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        TuoLevel* cur = GetLevel(level, tuo_total);
+        if (cur == NULL || tuo_no < 0 || tuo_no >= tuo_total) {
+            return kInvalidArg;
+        }
+        if (cur->states[tuo_no] == kTuoDone) {
+            return kOk;
+        }
+        if (succeeded) {
+            cur->states[tuo_no] = kTuoDone;
+            cur->n_done++;
+            LOG(INFO, "tuo %d of level %d done, %d/%d",
+                tuo_no, level, cur->n_done, tuo_total);
+        } else if (cur->holders[tuo_no] == std::make_pair(no, attempt)) {
+            cur->states[tuo_no] = kTuoPending;
+        }
+        PopWaits(&dones);
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+    return kOk;
+}
+
+void MergeCoordinator::Wait(int level, int tuo_total, int timeout,
+                            WaitTuoResponse* response,
+                            ::google::protobuf::Closure* done) {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        if (GetLevel(level, tuo_total) == NULL) {
+            response->set_status(kInvalidArg);
+            dones.push_back(done);
+        } else {
+            TuoWait wait;
+            wait.level = level;
+            wait.deadline = std::time(NULL) + std::min(std::max(timeout, 0), sMaxWaitSeconds);
+            wait.response = response;
+            wait.done = done;
+            waits_.push_back(wait);
+        }
+        PopWaits(&dones);
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+void MergeCoordinator::Pace() {
+    std::vector< ::google::protobuf::Closure*> dones;
+    {
+        MutexLock lock(&mu_);
+        PopWaits(&dones);
+    }
+    for (size_t i = 0; i < dones.size(); i++) {
+        dones[i]->Run();
+    }
+}
+
+void MergeCoordinator::PopWaits(std::vector< ::google::protobuf::Closure*>* dones) {
+    mu_.AssertHeld();
+    time_t now = std::time(NULL);
+    std::list<TuoWait>::iterator it = waits_.begin();
+    while (it != waits_.end()) {
+        const TuoLevel& cur = levels_[it->level];
+        bool level_done = (cur.n_done == (int)cur.states.size());
+        if (!level_done && it->deadline > now) {
+            ++it;
+            continue;
+        }
+        it->response->set_status(level_done ? kOk : kSuspend);
+        it->response->set_done(cur.n_done);
+        dones->push_back(it->done);
+        it = waits_.erase(it);
+    }
+}
+
+}
+}
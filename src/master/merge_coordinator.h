@@ -0,0 +1,68 @@
+#ifndef _BAIDU_SHUTTLE_MERGE_COORDINATOR_H_
+#define _BAIDU_SHUTTLE_MERGE_COORDINATOR_H_
+#include <list>
+#include <map>
+#include <vector>
+#include <ctime>
+#include <boost/function.hpp>
+
+#include "mutex.h"
+#include "proto/app_master.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// hands out the tuo merges of the reduce tasks of a job, level by level,
+// so that no tuo is merged twice while its merger is still running
+class MergeCoordinator {
+public:
+    typedef boost::function<bool (int reduce_no, int attempt)> AliveFunc;
+    explicit MergeCoordinator(const AliveFunc& is_alive);
+    // answers the pending waits with kNoSuchJob
+    ~MergeCoordinator();
+
+    // kNoMore if every tuo of the level is done or being merged
+    Status Claim(int no, int attempt, int level, int tuo_total,
+                 int prefer, int* tuo_no);
+    Status Finish(int no, int attempt, int level, int tuo_total,
+                  int tuo_no, bool succeeded);
+    // done is run once every tuo of the level is done, or with kSuspend
+    // after timeout seconds, when the caller should try to claim again
+    void Wait(int level, int tuo_total, int timeout,
+              WaitTuoResponse* response, ::google::protobuf::Closure* done);
+    // answers the waits timed out, to be called every second so that
+    // a lone waiter learns in time that it should claim again
+    void Pace();
+
+private:
+    enum TuoState {
+        kTuoPending = 0,
+        kTuoMerging = 1,
+        kTuoDone = 2
+    };
+    struct TuoLevel {
+        std::vector<TuoState> states;
+        std::vector<std::pair<int, int> > holders;
+        int n_done;
+    };
+    struct TuoWait {
+        int level;
+        time_t deadline;
+        WaitTuoResponse* response;
+        ::google::protobuf::Closure* done;
+    };
+    TuoLevel* GetLevel(int level, int tuo_total);
+    // answers the waits whose level is done or which timed out,
+    // their closures are left to be run out of the lock
+    void PopWaits(std::vector< ::google::protobuf::Closure*>* dones);
+private:
+    Mutex mu_;
+    AliveFunc is_alive_;
+    std::map<int, TuoLevel> levels_;
+    std::list<TuoWait> waits_;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include "merge_coordinator.h"
+
+#include <set>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+#include <google/protobuf/stubs/common.h>
+
+using namespace baidu::shuttle;
+
+std::set<std::pair<int, int> > dead_tasks;
+
+bool IsAlive(int no, int attempt) {
+    return dead_tasks.find(std::make_pair(no, attempt)) == dead_tasks.end();
+}
+
+void Count(int* n_done) {
+    (*n_done)++;
+}
+
+TEST(MergeCoordinatorTest, ClaimOnce) {
+    MergeCoordinator coordinator(boost::bind(&IsAlive, _1, _2));
+    std::set<int> claimed;
+    for (int no = 0; no < 5; no++) {
+        int tuo_no = -1;
+        EXPECT_EQ(coordinator.Claim(no, 0, 0, 5, no, &tuo_no), kOk);
+        EXPECT_EQ(tuo_no, no);
+        claimed.insert(tuo_no);
+    }
+    EXPECT_EQ(claimed.size(), 5u);
+    int tuo_no = -1;
+    EXPECT_EQ(coordinator.Claim(5, 0, 0, 5, -1, &tuo_no), kNoMore);
+    //claimed again by the same attempt
+    EXPECT_EQ(coordinator.Claim(3, 0, 0, 5, -1, &tuo_no), kOk);
+    EXPECT_EQ(tuo_no, 3);
+    EXPECT_EQ(coordinator.Claim(3, 0, 0, 6, -1, &tuo_no), kInvalidArg);
+}
+
+TEST(MergeCoordinatorTest, TakeOver) {
+    MergeCoordinator coordinator(boost::bind(&IsAlive, _1, _2));
+    int tuo_no = -1;
+    EXPECT_EQ(coordinator.Claim(0, 0, 0, 2, 0, &tuo_no), kOk);
+    EXPECT_EQ(coordinator.Claim(1, 0, 0, 2, 1, &tuo_no), kOk);
+    EXPECT_EQ(coordinator.Claim(2, 0, 0, 2, -1, &tuo_no), kNoMore);
+    //a failed merge is handed out again
+    EXPECT_EQ(coordinator.Finish(1, 0, 0, 2, 1, false), kOk);
+    EXPECT_EQ(coordinator.Claim(2, 0, 0, 2, -1, &tuo_no), kOk);
+    EXPECT_EQ(tuo_no, 1);
+    //so is the merge of a task not running any more
+    dead_tasks.insert(std::make_pair(0, 0));
+    EXPECT_EQ(coordinator.Claim(0, 1, 0, 2, -1, &tuo_no), kOk);
+    EXPECT_EQ(tuo_no, 0);
+    dead_tasks.clear();
+}
+
+TEST(MergeCoordinatorTest, Wait) {
+    int n_done = 0;
+    WaitTuoResponse response1;
+    WaitTuoResponse response2;
+    {
+        MergeCoordinator coordinator(boost::bind(&IsAlive, _1, _2));
+        int tuo_no = -1;
+        coordinator.Wait(0, 2, 60, &response1,
+                         google::protobuf::NewCallback(&Count, &n_done));
+        EXPECT_EQ(n_done, 0);
+        EXPECT_EQ(coordinator.Claim(0, 0, 0, 2, 0, &tuo_no), kOk);
+        EXPECT_EQ(coordinator.Finish(0, 0, 0, 2, 0, true), kOk);
+        EXPECT_EQ(n_done, 0);
+        //reported by a task finding the tuo merged
+        EXPECT_EQ(coordinator.Finish(1, 0, 0, 2, 1, true), kOk);
+        EXPECT_EQ(n_done, 1);
+        EXPECT_EQ(response1.status(), kOk);
+        EXPECT_EQ(response1.done(), 2);
+        EXPECT_EQ(coordinator.Claim(2, 0, 0, 2, -1, &tuo_no), kNoMore);
+
+        coordinator.Wait(1, 3, 0, &response2,
+                         google::protobuf::NewCallback(&Count, &n_done));
+        EXPECT_EQ(n_done, 2);
+        EXPECT_EQ(response2.status(), kSuspend);
+        coordinator.Wait(1, 3, 60, &response2,
+                         google::protobuf::NewCallback(&Count, &n_done));
+    }
+    EXPECT_EQ(n_done, 3);
+    EXPECT_EQ(response2.status(), kNoSuchJob);
+}
+
+TEST(MergeCoordinatorTest, Pace) {
+    MergeCoordinator coordinator(boost::bind(&IsAlive, _1, _2));
+    int n_done = 0;
+    int tuo_no = -1;
+    WaitTuoResponse response;
+    EXPECT_EQ(coordinator.Claim(0, 0, 0, 2, 0, &tuo_no), kOk);
+    coordinator.Wait(0, 2, 1, &response,
+                     google::protobuf::NewCallback(&Count, &n_done));
+    coordinator.Pace();
+    EXPECT_EQ(n_done, 0);
+    //answered with no other wait or finish coming
+    sleep(2);
+    coordinator.Pace();
+    EXPECT_EQ(n_done, 1);
+    EXPECT_EQ(response.status(), kSuspend);
+    EXPECT_EQ(response.done(), 0);
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -148,6 +148,23 @@ bool IdManager::FinishItem(int no) {
     return false;
 }
 
+bool IdManager::RedoItem(int no) {
+    size_t n = static_cast<size_t>(no);
+    MutexLock lock(&mu_);
+    if (n >= resource_pool_.size()) {
+        LOG(WARNING, "this resource is not valid for redoing: %d", no);
+        return false;
+    }
+    IdItem* cur = resource_pool_[n];
+    if (cur->status != kResDone) {
+        return false;
+    }
+    cur->status = kResPending;
+    pending_res_.push_front(cur);
+    -- done_; ++ pending_;
+    return true;
+}
+
 bool IdManager::IsAllocated(int no) {
     size_t n = static_cast<size_t>(no);
     MutexLock lock(&mu_);
@@ -372,6 +389,20 @@ bool ResourceManager::FinishItem(int no) {
     return manager_->FinishItem(n);
 }
 
+bool ResourceManager::RedoItem(int no) {
+    size_t n = static_cast<size_t>(no);
+    MutexLock lock(&mu_);
+    if (n >= resource_pool_.size()) {
+        LOG(WARNING, "this resource is not valid for redoing: %d", no);
+        return false;
+    }
+    if (!manager_->RedoItem(n)) {
+        return false;
+    }
+    resource_pool_[n]->status = kResPending;
+    return true;
+}
+
 bool ResourceManager::IsAllocated(int no) {
     size_t n = static_cast<size_t>(no);
     MutexLock lock(&mu_);
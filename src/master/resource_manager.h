@@ -77,6 +77,8 @@ public:
     virtual Resource* CheckCertainItem(int no) = 0;
     virtual void ReturnBackItem(int no) = 0;
     virtual bool FinishItem(int no) = 0;
+    // a done item is pending again, for its output has been lost
+    virtual bool RedoItem(int no) = 0;
     virtual bool IsAllocated(int no) = 0;
     virtual bool IsDone(int no) = 0;
     virtual int SumOfItem() = 0;
@@ -97,6 +99,7 @@ public:
     virtual IdItem* CheckCertainItem(int no);
     virtual void ReturnBackItem(int no);
     virtual bool FinishItem(int no);
+    virtual bool RedoItem(int no);
 
     virtual bool IsAllocated(int no);
     virtual bool IsDone(int no);
@@ -148,6 +151,7 @@ public:
     virtual ResourceItem* CheckCertainItem(int no);
     virtual void ReturnBackItem(int no);
     virtual bool FinishItem(int no);
+    virtual bool RedoItem(int no);
 
     virtual bool IsAllocated(int no);
     virtual bool IsDone(int no);
@@ -200,6 +204,7 @@ public:
      * virtual ResourceItem* GetCertainItem(int no);
      * virtual void ReturnBackItem(int no);
      * virtual bool FinishItem(int no);
+     * virtual bool RedoItem(int no);
 
      * virtual ResourceItem* const CheckCertainItem(int no);
 
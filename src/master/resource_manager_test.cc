@@ -89,6 +89,23 @@ TEST(ResManTest, ReturnBackItemTest) {
     delete cur;
 }
 
+TEST(ResManTest, RedoItemTest) {
+    IdManager idman(2);
+    IdItem* cur = idman.GetItem();
+    EXPECT_FALSE(idman.RedoItem(cur->no));
+    EXPECT_TRUE(idman.FinishItem(cur->no));
+    EXPECT_EQ(idman.Done(), 1);
+    EXPECT_TRUE(idman.RedoItem(cur->no));
+    EXPECT_FALSE(idman.RedoItem(cur->no));
+    EXPECT_EQ(idman.Done(), 0);
+    EXPECT_EQ(idman.Pending(), 2);
+    IdItem* again = idman.GetItem();
+    EXPECT_EQ(again->no, cur->no);
+    EXPECT_EQ(again->attempt, 2);
+    delete again;
+    delete cur;
+}
+
 int main(int argc, char** argv) {
     if (argc < 3) {
         printf("Usage: resman_test [hdfs work dir] [sum of items]\n");
@@ -88,9 +88,15 @@ then
 	if [ "${minion_decompress_input}" == "true" ]; then
 		decompress_input="-decompress_input"
 	fi
+	master_flags=""
+	if [ "${minion_master_endpoint}" != "" ]; then
+		master_flags="-master_endpoint=${minion_master_endpoint} -jobid=${mapred_job_id} \
+		-map_no=${mapred_task_partition} -attempt_id=${mapred_attempt_id}"
+	fi
 	input_cmd="./input_tool -file=${map_input_file} \
 	-offset=${map_input_start} \
-	-len=${map_input_length} ${dfs_flags} ${format} ${pipe_style} ${is_nline} ${decompress_input}"
+	-len=${map_input_length} ${dfs_flags} ${format} ${pipe_style} ${is_nline} ${decompress_input} \
+	${master_flags}"
 	(InputRun $input_cmd | JailRun) 2>./stderr
 	exit $?
 elif [ "${mapred_task_is_map}" == "false" ]
@@ -113,10 +119,42 @@ then
 	if [ "${minion_pipe_style}" != "" ]; then
 		pipe_style="-pipe ${minion_pipe_style}"
 	fi
+	compression=""
+	if [ "${minion_shuffle_compression}" != "" ]; then
+		compression="-compression=${minion_shuffle_compression}"
+	fi
+	shuffle_fs=""
+	if [ "${minion_shuffle_fs}" != "" ]; then
+		shuffle_fs="-fs=${minion_shuffle_fs}"
+	fi
+	merge_combiner=""
+	if [ "${minion_merge_combiner}" != "" ]; then
+		merge_combiner="-merge_combiner=${minion_merge_combiner}"
+	fi
+	local_shuffle=""
+	if [ "${minion_local_shuffle}" != "" ]; then
+		local_shuffle="-local_shuffle=${minion_local_shuffle}"
+	fi
+	if [ "${minion_push_dir}" != "" ]; then
+		local_shuffle="$local_shuffle -push_dir=${minion_push_dir}"
+	fi
+	merge_threads=""
+	if [ "${minion_shuffle_merge_threads}" != "" ]; then
+		merge_threads="-merge_threads=${minion_shuffle_merge_threads}"
+	fi
+	memory_limit=""
+	if [ "${mapred_memory_limit}" != "" ]; then
+		memory_limit="-memory_limit=${mapred_memory_limit}"
+	fi
+	master_flags=""
+	if [ "${minion_master_endpoint}" != "" ]; then
+		master_flags="-master_endpoint=${minion_master_endpoint} -jobid=${mapred_job_id}"
+	fi
 	shuffle_cmd="./shuffle_tool -total=${mapred_map_tasks} \
-	-work_dir=${minion_shuffle_work_dir} \
+	-work_dir=${minion_shuffle_work_dir} $shuffle_fs $merge_threads $merge_combiner $memory_limit \
+	$master_flags $local_shuffle \
 	-reduce_no=${mapred_task_partition} \
-	-attempt_id=${mapred_attempt_id} $dfs_flags $pipe_style"
+	-attempt_id=${mapred_attempt_id} $dfs_flags $pipe_style $compression"
 	(ShuffleRun $shuffle_cmd | JailRun) 2>./stderr
 	exit $?
 else
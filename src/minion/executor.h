@@ -24,20 +24,29 @@ const size_t sMaxCounters = 10000;
 
 class Partitioner;
 class Emitter;
+class SegmentPusher;
 
 class Executor {
 public:
     virtual ~Executor();
     static Executor* GetExecutor(WorkMode mode);
     void SetEnv(const std::string& jobid, const TaskInfo& task, WorkMode mode);
+    // maps of a push shuffle ask master where the reduce tasks run
+    void SetMasterEndpoint(const std::string& endpoint);
     virtual TaskState Exec(const TaskInfo& task) = 0;
     void Stop(int32_t task_id);
     std::string GetErrorMsg(const TaskInfo& task, bool is_map);
     void UploadErrorMsg(const TaskInfo& task, bool is_map, const std::string& error_msg);
     static void FillParam(FileSystem::Param& param, const TaskInfo& task);
+    static bool ShuffleOnNfs(const TaskInfo& task);
+    // spills stay on the local disk, served by the minion
+    static bool ShuffleOnHost(const TaskInfo& task);
+    static FileSystem* CreateShuffleFs(const TaskInfo& task);
     bool ParseCounters(const TaskInfo& task,
                        std::map<std::string, int64_t>* counters,
                        bool is_map);
+    // spill files of the last completed map, left empty by other executors
+    virtual void GetMapOutput(MapOutput* output);
 protected:
     Executor() ;
     bool ShouldStop(int32_t task_id);
@@ -49,6 +58,7 @@ protected:
     bool MoveTempToShuffle(const TaskInfo& task);
     bool MoveByPassData(const TaskInfo& task, FileSystem* fs, bool is_map);
     const std::string GetShuffleWorkDir(const TaskInfo& task);
+    const std::string GetMapSpillDir(const TaskInfo& task);
 
     bool ReadLine(FILE* user_app, std::string* line);
     bool ReadRecord(FILE* user_app, std::string* key, std::string* value);
@@ -64,6 +74,8 @@ protected:
 
 protected:
     char* line_buf_;
+    std::string jobid_;
+    std::string master_endpoint_;
 
 private:
     std::set<int32_t> stop_task_ids_;
@@ -80,6 +92,11 @@ public:
                               const Partitioner* partitioner, Emitter* emitter);
     TaskState BiStreamingShuffle(FILE* user_app, const TaskInfo& task,
                                 const Partitioner* partitioner, Emitter* emitter);
+    virtual void GetMapOutput(MapOutput* output);
+private:
+    bool FillSpillSizes(const TaskInfo& task, MapOutput* output);
+private:
+    MapOutput map_output_;
 };
 
 class ReduceExecutor : public Executor {
@@ -3,6 +3,12 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include "common/compressor.h"
+
+DECLARE_int32(shuffle_merge_threads);
+DECLARE_string(push_dir);
+DECLARE_string(spill_dir);
 
 namespace baidu {
 namespace shuttle {
@@ -15,6 +21,14 @@ Executor::~Executor() {
     free(line_buf_);
 }
 
+void Executor::GetMapOutput(MapOutput* /*output*/) {
+
+}
+
+void Executor::SetMasterEndpoint(const std::string& endpoint) {
+    master_endpoint_ = endpoint;
+}
+
 void Executor::Stop(int32_t task_id) {
     MutexLock locker(&mu_);
     stop_task_ids_.insert(task_id);
@@ -54,6 +68,7 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
         MutexLock locker(&mu_);
         stop_task_ids_.clear();
     }
+    jobid_ = jobid;
     for (int i = 0; i < task.job().cmdenvs_size(); i++) {
         const std::string& env_kv = task.job().cmdenvs(i);
         std::size_t sep_idx = env_kv.find_first_of("=");
@@ -98,6 +113,18 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
              boost::lexical_cast<std::string>(task.attempt_id()).c_str(),
              1);
     ::setenv("minion_shuffle_work_dir", GetShuffleWorkDir(task).c_str(), 1);
+    ::setenv("minion_shuffle_fs", ShuffleOnNfs(task) ? "nfs" : "hdfs", 1);
+    if (task.job().has_merge_combiner()) {
+        ::setenv("minion_merge_combiner", task.job().merge_combiner().c_str(), 1);
+    }
+    //pushed records are kept on the local disk of a reduce task,
+    //spills kept by minions are read as the maps are done
+    bool local_shuffle = task.job().local_shuffle() || task.job().pipelined_shuffle()
+                         || task.job().push_shuffle() || task.job().host_shuffle();
+    ::setenv("minion_local_shuffle", local_shuffle ? "true" : "", 1);
+    ::setenv("minion_push_dir", task.job().push_shuffle() ? FLAGS_push_dir.c_str() : "", 1);
+    ::setenv("minion_shuffle_merge_threads",
+             boost::lexical_cast<std::string>(FLAGS_shuffle_merge_threads).c_str(), 1);
     ::setenv("minion_input_dfs_host", task.job().input_dfs().host().c_str(), 1);
     ::setenv("minion_input_dfs_port", task.job().input_dfs().port().c_str(), 1);
     ::setenv("minion_input_dfs_user", task.job().input_dfs().user().c_str(), 1);
@@ -157,6 +184,8 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
     } else if (task.job().output_format() == kBinaryOutput) {
         ::setenv("minion_output_format", "binary", 1);
     }
+    ::setenv("minion_shuffle_compression",
+             Compressor::Name(task.job().shuffle_compression()).c_str(), 1);
     if (task.job().pipe_style() == kStreaming) {
         ::setenv("minion_pipe_style", "streaming", 1);
     } else if (task.job().pipe_style() == kBiStreaming) {
@@ -165,10 +194,53 @@ void Executor::SetEnv(const std::string& jobid, const TaskInfo& task,
 }
 
 const std::string Executor::GetShuffleWorkDir(const TaskInfo& task) {
+    if (ShuffleOnNfs(task)) {
+        return task.job().nfs_work_dir() + "/shuffle";
+    }
     std::string shuffle_work_dir = task.job().output() + "/_temporary/shuffle";
     return shuffle_work_dir;
 }
 
+const std::string Executor::GetMapSpillDir(const TaskInfo& task) {
+    char spill_dir[4096];
+    if (ShuffleOnHost(task)) {
+        //attempts of a map share the dir, spills are named by attempt
+        snprintf(spill_dir, sizeof(spill_dir), "%s/map_%d",
+                 FLAGS_spill_dir.c_str(), task.task_id());
+        return spill_dir;
+    }
+    if (!ShuffleOnNfs(task)) {
+        return GetMapWorkDir(task);
+    }
+    snprintf(spill_dir, sizeof(spill_dir),
+            "%s/map_%d/attempt_%d",
+            task.job().nfs_work_dir().c_str(),
+            task.task_id(),
+            task.attempt_id()
+            );
+    return spill_dir;
+}
+
+bool Executor::ShuffleOnNfs(const TaskInfo& task) {
+    return !task.job().nfs_work_dir().empty();
+}
+
+bool Executor::ShuffleOnHost(const TaskInfo& task) {
+    return task.job().host_shuffle();
+}
+
+FileSystem* Executor::CreateShuffleFs(const TaskInfo& task) {
+    if (ShuffleOnNfs(task)) {
+        return FileSystem::CreateNfs();
+    }
+    if (ShuffleOnHost(task)) {
+        return FileSystem::CreateLocalFs();
+    }
+    FileSystem::Param param;
+    FillParam(param, task);
+    return FileSystem::CreateInfHdfs(param);
+}
+
 const std::string Executor::GetMapWorkFilename(const TaskInfo& task) {
     char output_file_name[4096];
     snprintf(output_file_name, sizeof(output_file_name), 
@@ -245,20 +317,44 @@ bool Executor::MoveTempToOutput(const TaskInfo& task, FileSystem* fs, bool is_ma
 }
 
 bool Executor::MoveTempToShuffle(const TaskInfo& task) {
-    std::string old_dir = GetMapWorkDir(task);
+    std::string old_dir = GetMapSpillDir(task);
     char new_dir[4096];
     snprintf(new_dir, sizeof(new_dir), 
-            "%s/_temporary/shuffle/map_%d",
-            task.job().output().c_str(),
+            "%s/map_%d",
+            GetShuffleWorkDir(task).c_str(),
             task.task_id());
     FileSystem::Param param;
     FillParam(param, task);
     FileSystem* fs = FileSystem::CreateInfHdfs(param);
     boost::scoped_ptr<FileSystem> fs_guard(fs);
     MoveByPassData(task, fs, true);
+    if (ShuffleOnHost(task)) {
+        return true; //spills are written where the minion serves them
+    }
+    FileSystem* shuffle_fs = CreateShuffleFs(task);
+    boost::scoped_ptr<FileSystem> shuffle_fs_guard(shuffle_fs);
     LOG(INFO, "rename %s -> %s", old_dir.c_str(), new_dir);
-    fs->Rename(old_dir, new_dir);
-    if (fs->Exist(new_dir)) {
+    shuffle_fs->Rename(old_dir, new_dir);
+    if (task.job().push_shuffle() && shuffle_fs->Exist(old_dir)) {
+        //a map run again for its pushed records were lost finds its dir
+        //taken, its spill files are named by attempt and moved one by one
+        std::vector<FileInfo> children;
+        if (!shuffle_fs->List(old_dir, &children)) {
+            LOG(WARNING, "fail to list %s", old_dir.c_str());
+            return false;
+        }
+        std::vector<FileInfo>::iterator it;
+        for (it = children.begin(); it != children.end(); it++) {
+            size_t slash = it->name.find_last_of('/');
+            const std::string base_name = it->name.substr(slash + 1);
+            if (!shuffle_fs->Rename(old_dir + "/" + base_name,
+                                    std::string(new_dir) + "/" + base_name)) {
+                LOG(WARNING, "fail to move %s to %s", base_name.c_str(), new_dir);
+                return false;
+            }
+        }
+    }
+    if (shuffle_fs->Exist(new_dir)) {
         return true;
     }
     return false;
@@ -4,11 +4,16 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
+#include <map>
 #include <sstream>
 #include <vector>
+#include <boost/scoped_ptr.hpp>
 #include <logging.h>
 #include "sort/sort_file.h"
+#include "common/compressor.h"
 #include "partition.h"
+#include "segment_pusher.h"
 
 using baidu::common::WARNING;
 using baidu::common::INFO;
@@ -18,6 +23,8 @@ namespace shuttle {
 
 const static size_t sMaxInMemTable = 512 << 20;
 const static size_t sMaxRecordSize = 2 << 20;
+const static char* sSpillCompressThreads = "2";
+const static size_t sPushChunkSize = 8 << 20;
 
 struct EmitItem {
     int reduce_no;
@@ -47,7 +54,8 @@ struct EmitItemLess {
 
 class Emitter {
 public:
-    Emitter(const std::string& work_dir, const TaskInfo& task) : task_(task) {
+    Emitter(const std::string& work_dir, const TaskInfo& task,
+            SegmentPusher* pusher) : task_(task), pusher_(pusher) {
         work_dir_ = work_dir;
         cur_byte_size_ = 0;
         file_no_ = 0;
@@ -56,12 +64,20 @@ public:
     Status Emit(int reduce_no, const std::string& key, const std::string& record) ;
     void Reset();
     Status FlushMemTable();
+    // names and partition bytes of the files spilled, sizes are unknown
+    const MapOutput& Output() {return output_;}
+private:
+    void PushSegments(std::vector<bool>* pushed);
+    bool PushRange(int reduce_no, std::vector<EmitItem*>::const_iterator begin,
+                   std::vector<EmitItem*>::const_iterator end, int* chunks);
 private:
     std::string work_dir_;
     size_t cur_byte_size_;
     std::vector<EmitItem*> mem_table_;
     int file_no_;
     const TaskInfo& task_;
+    SegmentPusher* pusher_;
+    MapOutput output_;
 };
 
 MapExecutor::MapExecutor() {
@@ -74,6 +90,7 @@ MapExecutor::~MapExecutor() {
 
 TaskState MapExecutor::Exec(const TaskInfo& task) {
     LOG(INFO, "exec map task");
+    map_output_.Clear();
     ::setenv("mapred_work_output_dir", GetMapWorkDir(task).c_str(), 1);
     std::string cmd = "sh ./app_wrapper.sh \"" + task.job().map_command() + "\"";
     LOG(INFO, "map command is: %s", cmd.c_str());
@@ -86,18 +103,28 @@ TaskState MapExecutor::Exec(const TaskInfo& task) {
 
     KeyFieldBasedPartitioner key_field_partition(task);
     IntHashPartitioner int_hash_partition(task);
+    TotalOrderPartitioner total_order_partition(task);
     Partitioner* partitioner = &key_field_partition;
     if (task.job().partition() == kIntHashPartitioner) {
         partitioner =  &int_hash_partition;
+    } else if (task.job().partition() == kTotalOrderPartitioner) {
+        partitioner = &total_order_partition;
     }
 
-    FileSystem::Param param;
-    FillParam(param, task);
-    FileSystem* fs = FileSystem::CreateInfHdfs(param);
-    fs->Mkdirs(GetShuffleWorkDir(task));
+    FileSystem* fs = CreateShuffleFs(task);
+    if (!ShuffleOnHost(task)) {
+        fs->Mkdirs(GetShuffleWorkDir(task));
+    }
+    if (ShuffleOnNfs(task) || ShuffleOnHost(task)) {
+        fs->Mkdirs(GetMapSpillDir(task)); //hdfs creates parents on open, nfs does not
+    }
     delete fs;
 
-    Emitter emitter(GetMapWorkDir(task), task);
+    boost::scoped_ptr<SegmentPusher> pusher;
+    if (task.job().push_shuffle()) {
+        pusher.reset(new SegmentPusher(master_endpoint_, jobid_, task));
+    }
+    Emitter emitter(GetMapSpillDir(task), task, pusher.get());
     if (task.job().pipe_style() == kStreaming) {
         TaskState state = StreamingShuffle(user_app, task, partitioner, &emitter);
         if (state != kTaskCompleted) {
@@ -126,9 +153,59 @@ TaskState MapExecutor::Exec(const TaskInfo& task) {
         LOG(WARNING, "move map result to shuffle dir fail");
         return kTaskFailed;
     }
+    map_output_ = emitter.Output();
+    map_output_.set_map_no(task.task_id());
+    map_output_.set_attempt(task.attempt_id());
+    if (!FillSpillSizes(task, &map_output_)) {
+        if (ShuffleOnHost(task)) {
+            //reduce tasks only find spills kept by minions through master
+            LOG(WARNING, "fail to list the spill files kept by this minion");
+            return kTaskFailed;
+        }
+        LOG(WARNING, "spill files are left to be listed by reduce tasks");
+        map_output_.Clear();
+    }
     return kTaskCompleted;
 }
 
+void MapExecutor::GetMapOutput(MapOutput* output) {
+    output->CopyFrom(map_output_);
+}
+
+// one listing here saves every reduce task from listing the map dir
+bool MapExecutor::FillSpillSizes(const TaskInfo& task, MapOutput* output) {
+    char map_dir[4096];
+    if (ShuffleOnHost(task)) {
+        snprintf(map_dir, sizeof(map_dir), "%s", GetMapSpillDir(task).c_str());
+    } else {
+        snprintf(map_dir, sizeof(map_dir), "%s/map_%d",
+                 GetShuffleWorkDir(task).c_str(), task.task_id());
+    }
+    FileSystem* fs = CreateShuffleFs(task);
+    boost::scoped_ptr<FileSystem> fs_guard(fs);
+    std::vector<FileInfo> children;
+    if (!fs->List(map_dir, &children)) {
+        LOG(WARNING, "fail to list %s", map_dir);
+        return false;
+    }
+    std::map<std::string, int64_t> sizes;
+    std::vector<FileInfo>::iterator it;
+    for (it = children.begin(); it != children.end(); it++) {
+        size_t slash = it->name.find_last_of('/');
+        sizes[it->name.substr(slash + 1)] = it->size;
+    }
+    for (int i = 0; i < output->files_size(); i++) {
+        SpillFile* file = output->mutable_files(i);
+        std::map<std::string, int64_t>::iterator jt = sizes.find(file->name());
+        if (jt == sizes.end()) {
+            LOG(WARNING, "spill file missing: %s/%s", map_dir, file->name().c_str());
+            return false;
+        }
+        file->set_size(jt->second);
+    }
+    return output->files_size() > 0;
+}
+
 Emitter::~Emitter() {
     Reset();
 }
@@ -159,22 +236,90 @@ Status Emitter::Emit(int reduce_no, const std::string& key, const std::string& r
     return FlushMemTable();
 }
 
+// the records of a reduce task are pushed to its running attempt in chunks,
+// false if a chunk fails, the chunks pushed are not listed then
+bool Emitter::PushRange(int reduce_no, std::vector<EmitItem*>::const_iterator begin,
+                        std::vector<EmitItem*>::const_iterator end, int* chunks) {
+    const std::string prefix = PartitionPrefix(reduce_no);
+    std::string data;
+    int chunk_no = 0;
+    std::vector<EmitItem*>::const_iterator it;
+    for (it = begin; it != end; it++) {
+        AppendPushRecord(prefix + (*it)->key, (*it)->record, &data);
+        if (data.size() < sPushChunkSize && it + 1 != end) {
+            continue;
+        }
+        if (pusher_->Push(reduce_no, file_no_, chunk_no, data) != kOk) {
+            return false;
+        }
+        chunk_no++;
+        data.clear();
+    }
+    *chunks = chunk_no;
+    return true;
+}
+
+// the records of reduce tasks running now are pushed to them,
+// the others are left to the spill file
+void Emitter::PushSegments(std::vector<bool>* pushed) {
+    pusher_->Refresh();
+    std::vector<EmitItem*>::const_iterator begin = mem_table_.begin();
+    while (begin != mem_table_.end()) {
+        int reduce_no = (*begin)->reduce_no;
+        std::vector<EmitItem*>::const_iterator end = begin;
+        while (end != mem_table_.end() && (*end)->reduce_no == reduce_no) {
+            end++;
+        }
+        int attempt = pusher_->Receiver(reduce_no);
+        int chunks = 0;
+        if (attempt >= 0 && PushRange(reduce_no, begin, end, &chunks)) {
+            PushedSegment* segment = output_.add_pushed();
+            segment->set_reduce_no(reduce_no);
+            segment->set_reduce_attempt(attempt);
+            segment->set_file_no(file_no_);
+            segment->set_chunks(chunks);
+            if ((size_t)reduce_no >= pushed->size()) {
+                pushed->resize(reduce_no + 1, false);
+            }
+            (*pushed)[reduce_no] = true;
+        }
+        begin = end;
+    }
+}
+
 Status Emitter::FlushMemTable() {
     SortFileWriter* writer = NULL;
     Status status = kOk;
     char file_name[4096];
-    char s_reduce_no[256];
+    std::vector<int64_t> partition_bytes;
+    std::vector<bool> pushed;
+    std::sort(mem_table_.begin(), mem_table_.end(), EmitItemLess());
+    if (pusher_ != NULL) {
+        PushSegments(&pushed);
+    }
     do {
-        std::sort(mem_table_.begin(), mem_table_.end(), EmitItemLess());
-        writer = SortFileWriter::Create(kHdfsFile, &status);
+        FileType file_type = Executor::ShuffleOnNfs(task_) ? kNfsFile : kHdfsFile;
+        if (Executor::ShuffleOnHost(task_)) {
+            file_type = kLocalFile;
+        }
+        writer = SortFileWriter::Create(file_type, &status);
         if (status != kOk) {
             break;
         }
         FileSystem::Param param;
         Executor::FillParam(param, task_);
         param["replica"] = "3";
-        snprintf(file_name, sizeof(file_name), "%s/%d.sort",
-                 work_dir_.c_str(), file_no_);
+        param["compression"] = Compressor::Name(task_.job().shuffle_compression());
+        param["partitioned"] = "true";
+        param["compress_threads"] = sSpillCompressThreads; //keep sorting while blocks are written
+        if (pusher_ != NULL || Executor::ShuffleOnHost(task_)) {
+            //spills of the attempts of a map may end up in one dir
+            snprintf(file_name, sizeof(file_name), "%s/%d_%d.sort",
+                     work_dir_.c_str(), task_.attempt_id(), file_no_);
+        } else {
+            snprintf(file_name, sizeof(file_name), "%s/%d.sort",
+                     work_dir_.c_str(), file_no_);
+        }
         status = writer->Open(file_name, param);
         if (status != kOk) {
             break;
@@ -186,19 +331,31 @@ Status Emitter::FlushMemTable() {
         std::vector<EmitItem*>::iterator it;
         for (it = mem_table_.begin(); it != mem_table_.end(); it++) {
             EmitItem* item = *it;
-            snprintf(s_reduce_no, sizeof(s_reduce_no), "%05d", item->reduce_no);
-            std::string raw_key = s_reduce_no;
-            raw_key += "\t";
+            if ((size_t)item->reduce_no < pushed.size() && pushed[item->reduce_no]) {
+                continue;
+            }
+            std::string raw_key = PartitionPrefix(item->reduce_no);
             raw_key += item->key;
             status = writer->Put(raw_key, item->record);
             if (status != kOk) {
                 break;
             }
+            if ((size_t)item->reduce_no >= partition_bytes.size()) {
+                partition_bytes.resize(item->reduce_no + 1, 0);
+            }
+            partition_bytes[item->reduce_no] += raw_key.size() + item->record.size();
         }
     } while(0);
     
     if (status == kOk) {
         status = writer->Close();
+    }
+    if (status == kOk) {
+        SpillFile* file = output_.add_files();
+        file->set_name(strrchr(file_name, '/') + 1);
+        for (size_t i = 0; i < partition_bytes.size(); i++) {
+            file->add_partition_bytes(partition_bytes[i]);
+        }
         file_no_ ++;
     }
     delete writer;
@@ -10,3 +10,6 @@ DEFINE_int32(suspend_time, 60, "suspend time in seconds when receive suspend op"
 DEFINE_int32(max_minions, 25, "max number of minions at one machine");
 DEFINE_int64(flow_limit_10gb, 250L * 1024 * 1024, "the limit of network traffic for 10gb machine, default is 384M");
 DEFINE_int64(flow_limit_1gb, 84L * 1024 * 1024, "the limit of network traffic for 1gb machine, default is 64M");
+DEFINE_string(push_dir, "./pushed_segments", "local dir keeping the records pushed to the reduce task of this minion");
+DEFINE_string(spill_dir, "./map_spills", "local dir keeping the spills of the maps of this minion, if they are served to reduce tasks by it");
+DEFINE_int32(shuffle_merge_threads, 1, "threads merging a tuo in key ranges when a reduce task shuffles, 1 means one thread");
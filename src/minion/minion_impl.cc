@@ -9,6 +9,9 @@
 #include <gflags/gflags.h>
 #include "logging.h"
 #include "proto/app_master.pb.h"
+#include "common/filesystem.h"
+#include "common/tools_util.h"
+#include "segment_pusher.h"
 
 DECLARE_string(master_nexus_path);
 DECLARE_string(nexus_addr);
@@ -18,6 +21,7 @@ DECLARE_bool(kill_task);
 DECLARE_int32(suspend_time);
 DECLARE_int64(flow_limit_10gb);
 DECLARE_int64(flow_limit_1gb);
+DECLARE_string(push_dir);
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -65,6 +69,7 @@ MinionImpl::MinionImpl() : ins_(FLAGS_nexus_addr),
     cur_task_id_ = -1;
     cur_attempt_id_ = -1;
     cur_task_state_ = kTaskUnknown;
+    accept_push_ = false;
     watch_dog_.AddTask(boost::bind(&MinionImpl::WatchDogTask, this));
 }
 
@@ -156,6 +161,45 @@ void MinionImpl::CancelTask(::google::protobuf::RpcController* controller,
     done->Run();
 }
 
+void MinionImpl::PushSegment(::google::protobuf::RpcController* controller,
+                             const ::baidu::shuttle::PushSegmentRequest* request,
+                             ::baidu::shuttle::PushSegmentResponse* response,
+                             ::google::protobuf::Closure* done) {
+    (void)controller;
+    bool accept = false;
+    {
+        MutexLock locker(&mu_);
+        accept = accept_push_ && request->job_id() == jobid_
+                 && request->reduce_no() == cur_task_id_
+                 && request->reduce_attempt() == cur_attempt_id_
+                 && cur_task_state_ == kTaskRunning;
+    }
+    if (!accept) {
+        response->set_status(kNoSuchTask);
+        done->Run();
+        return;
+    }
+    const std::string file_name = PushedSegmentName(FLAGS_push_dir, request->map_no(),
+                                                    request->map_attempt(),
+                                                    request->file_no(),
+                                                    request->chunk_no());
+    //chunks are written out of the lock, each to its own file
+    response->set_status(WriteSegment(request->data(), file_name));
+    done->Run();
+}
+
+// records pushed to an earlier task are dropped
+bool MinionImpl::PreparePushDir() {
+    FileSystem* fs = FileSystem::CreateLocalFs();
+    boost::scoped_ptr<FileSystem> fs_guard(fs);
+    fs->Remove(FLAGS_push_dir);
+    if (!fs->Mkdirs(FLAGS_push_dir)) {
+        LOG(WARNING, "fail to make push dir: %s", FLAGS_push_dir.c_str());
+        return false;
+    }
+    return true;
+}
+
 void MinionImpl::SetEndpoint(const std::string& endpoint) {
     LOG(INFO, "minon bind endpoint on : %s", endpoint.c_str());
     endpoint_ = endpoint;
@@ -219,11 +263,19 @@ void MinionImpl::Loop() {
         const TaskInfo& task = response.task();
         SaveBreakpoint(task);
         executor_->SetEnv(jobid_, task, work_mode_);
+        executor_->SetMasterEndpoint(master_endpoint_);
+        ::setenv("minion_master_endpoint", master_endpoint_.c_str(), 1);
+        bool accept_push = false;
+        if (work_mode_ == kReduce && task.job().push_shuffle()) {
+            //maps spill records of this task to the shuffle fs if it refuses
+            accept_push = PreparePushDir();
+        }
         {
             MutexLock locker(&mu_);
             cur_task_id_ = task.task_id();
             cur_attempt_id_ = task.attempt_id();
             cur_task_state_ = kTaskRunning;
+            accept_push_ = accept_push;
         }
         LOG(INFO, "try exec task: %s, %d, %d", jobid_.c_str(), cur_task_id_, cur_attempt_id_);
         TaskState task_state = executor_->Exec(task); //exec here~~
@@ -252,6 +304,9 @@ void MinionImpl::Loop() {
         fn_request.set_endpoint(endpoint_);
         fn_request.set_work_mode(work_mode_);
         fn_request.set_error_msg(error_msg);
+        if (task_state == kTaskCompleted && work_mode_ == kMap) {
+            executor_->GetMapOutput(fn_request.mutable_map_output());
+        }
 
         std::map<std::string, int64_t>::iterator it;
         for (it = counters.begin(); it != counters.end(); it++) {
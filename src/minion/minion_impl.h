@@ -26,6 +26,10 @@ public:
                     const ::baidu::shuttle::CancelTaskRequest* request,
                     ::baidu::shuttle::CancelTaskResponse* response,
                     ::google::protobuf::Closure* done);
+    void PushSegment(::google::protobuf::RpcController* controller,
+                     const ::baidu::shuttle::PushSegmentRequest* request,
+                     ::baidu::shuttle::PushSegmentResponse* response,
+                     ::google::protobuf::Closure* done);
     void SetEndpoint(const std::string& endpoint);
     void SetJobId(const std::string& jobid);
     bool Run();
@@ -37,6 +41,7 @@ private:
     void CheckUnfinishedTask(Master_Stub* master_stub);
     void SleepRandomTime();
     void WatchDogTask();
+    bool PreparePushDir();
     std::string endpoint_;
     ThreadPool pool_;
     std::string master_endpoint_;
@@ -49,6 +54,7 @@ private:
     int32_t cur_task_id_;
     int32_t cur_attempt_id_;
     TaskState cur_task_state_;
+    bool accept_push_;
     WorkMode work_mode_;
     ThreadPool watch_dog_;
     NetStatistics netstat_;
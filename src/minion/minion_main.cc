@@ -9,7 +9,9 @@
 #include <gflags/gflags.h>
 #include "logging.h"
 #include "util.h"
+#include "common/tools_util.h"
 #include "minion_impl.h"
+#include "shuffle_service.h"
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -19,6 +21,8 @@ using baidu::common::WARNING;
 DECLARE_int32(minion_port);
 DECLARE_string(jobid);
 DECLARE_int32(max_minions);
+DECLARE_string(spill_dir);
+DECLARE_string(push_dir);
 
 static volatile bool s_quit = false;
 static void SignalIntHandler(int /*sig*/){
@@ -31,6 +35,11 @@ int main(int argc, char* argv[]) {
         LOG(WARNING, "use --jobid=[job id] to start minion");
         exit(-2);
     }
+    //tasks are run in dirs of their own, and told of these dirs
+    FLAGS_push_dir = baidu::shuttle::AbsolutePath(FLAGS_push_dir);
+    FLAGS_spill_dir = baidu::shuttle::AbsolutePath(FLAGS_spill_dir);
+    LOG(INFO, "push dir: %s, spill dir: %s",
+        FLAGS_push_dir.c_str(), FLAGS_spill_dir.c_str());
     baidu::shuttle::MinionImpl * minion = new baidu::shuttle::MinionImpl();
     sofa::pbrpc::RpcServerOptions options;
     sofa::pbrpc::RpcServer rpc_server(options);
@@ -38,6 +47,12 @@ int main(int argc, char* argv[]) {
         LOG(WARNING, "failed to register minion service");
         exit(-1);
     }
+    baidu::shuttle::ShuffleServiceImpl* shuffle =
+        new baidu::shuttle::ShuffleServiceImpl(FLAGS_spill_dir);
+    if (!rpc_server.RegisterService(static_cast<baidu::shuttle::Shuffle*>(shuffle))) {
+        LOG(WARNING, "failed to register shuffle service");
+        exit(-1);
+    }
 
     int retry_count = 0;
     std::string endpoint = "0.0.0.0:" + boost::lexical_cast<std::string>(FLAGS_minion_port);
@@ -4,6 +4,22 @@
 namespace baidu {
 namespace shuttle {
 
+// the first num_key_fields fields of a line, the same key
+// KeyFieldBasedPartitioner sorts the records by
+static void ExtractKey(const std::string& line, int num_key_fields,
+                       const std::string& separator, std::string* key) {
+    const char* head = line.data();
+    const char* p = head;
+    const char* end = head + line.size();
+    for (int i = 0; i < num_key_fields && p < end; i++) {
+        p += (strcspn(p, separator.c_str()) + 1);
+    }
+    if (p == head) {
+        p = head + 1;
+    }
+    key->assign(head, p - 1);
+}
+
 int Partitioner::HashCode(const std::string& str) const{
     int h = 1;
     if (str.empty()) {
@@ -135,5 +151,82 @@ int IntHashPartitioner::Calc(const std::string& key) const{
     return hash_code % reduce_total_;
 }
 
+TotalOrderPartitioner::TotalOrderPartitioner(const TaskInfo& task)
+  : num_key_fields_(0) {
+    num_key_fields_ = task.job().key_fields_num();
+    split_points_.assign(task.job().split_points().begin(),
+                         task.job().split_points().end());
+    separator_ = task.job().key_separator();
+    if (num_key_fields_ == 0) {
+        num_key_fields_ = 1;
+    }
+    if (separator_.empty()) {
+        separator_ = "\t";
+    }
+}
+
+TotalOrderPartitioner::TotalOrderPartitioner(int num_key_fields,
+                                             const std::vector<std::string>& split_points,
+                                             const std::string& separator) {
+    num_key_fields_ = num_key_fields;
+    split_points_ = split_points;
+    separator_ = separator;
+    if (num_key_fields_ == 0) {
+        num_key_fields_ = 1;
+    }
+    if (separator_.empty()) {
+        separator_ = "\t";
+    }
+}
+
+int TotalOrderPartitioner::Calc(const std::string& line, std::string* key) const {
+    assert(key);
+    ExtractKey(line, num_key_fields_, separator_, key);
+    return Calc(*key);
+}
+
+int TotalOrderPartitioner::Calc(const std::string& key) const {
+    //keys equal to a split point go to the range it starts
+    return std::upper_bound(split_points_.begin(), split_points_.end(), key)
+           - split_points_.begin();
+}
+
+void PickSplitPoints(const std::vector<std::string>& records,
+                     const JobDescriptor& job,
+                     std::vector<std::string>* split_points) {
+    assert(split_points);
+    split_points->clear();
+    int num_key_fields = job.key_fields_num();
+    std::string separator = job.key_separator();
+    if (num_key_fields == 0) {
+        num_key_fields = 1;
+    }
+    if (separator.empty()) {
+        separator = "\t";
+    }
+    std::vector<std::string> keys(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        ExtractKey(records[i], num_key_fields, separator, &keys[i]);
+    }
+    std::sort(keys.begin(), keys.end());
+    int reduce_total = job.reduce_total();
+    for (int i = 1; i < reduce_total && !keys.empty(); i++) {
+        std::vector<std::string>::const_iterator key;
+        key = keys.begin() + keys.size() * i / reduce_total;
+        //ranges must not be empty, a key taking many records takes one alone.
+        //reduce 0 takes the keys less than the first split point
+        if (*key == keys.front()) {
+            key = std::upper_bound(keys.begin(), keys.end(), keys.front());
+            if (key == keys.end()) {
+                break;
+            }
+        }
+        if (!split_points->empty() && *key <= split_points->back()) {
+            continue;
+        }
+        split_points->push_back(*key);
+    }
+}
+
 } //namespace shuttle
 } //namespace baidu
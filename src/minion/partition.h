@@ -2,6 +2,7 @@
 #define _BAIDU_SHUTTLE_MINION_PARTITION_H_
 
 #include <string>
+#include <vector>
 #include "proto/shuttle.pb.h"
 
 namespace baidu {
@@ -45,6 +46,29 @@ private:
     std::string separator_;
 };
 
+// keys are sorted into reduce tasks by the split points of the job,
+// so that part-00000 ... part-N hold globally ordered records
+class TotalOrderPartitioner : public Partitioner {
+public:
+    TotalOrderPartitioner(const TaskInfo& task);
+    TotalOrderPartitioner(int num_key_fields,
+                          const std::vector<std::string>& split_points,
+                          const std::string& separator);
+    virtual ~TotalOrderPartitioner(){};
+    int Calc(const std::string& line, std::string* key) const;
+    int Calc(const std::string& key) const;
+private:
+    int num_key_fields_;
+    std::vector<std::string> split_points_;
+    std::string separator_;
+};
+
+// picks reduce_total - 1 keys of the sampled records, cutting them into
+// ranges of about the same number of records, fewer if the keys repeat
+void PickSplitPoints(const std::vector<std::string>& records,
+                     const JobDescriptor& job,
+                     std::vector<std::string>* split_points);
+
 } //namespace shuttle
 } //namespace baidu
 
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include "partition.h"
 
 using namespace baidu::shuttle;
@@ -80,6 +81,52 @@ TEST(Partitioner, IntHashInValid) {
     EXPECT_EQ(key, "aaaaaaaaaaaaazzzzzzzz");
 }
 
+TEST(Partitioner, TotalOrder) {
+    TaskInfo task;
+    task.mutable_job()->set_reduce_total(3);
+    task.mutable_job()->add_split_points("g");
+    task.mutable_job()->add_split_points("p");
+    TotalOrderPartitioner to_parti(task);
+    std::string key;
+    int reduce_no = to_parti.Calc("apple\tred", &key);
+    EXPECT_EQ(key, "apple");
+    EXPECT_EQ(reduce_no, 0);
+    reduce_no = to_parti.Calc("g\tgreen", &key);
+    EXPECT_EQ(key, "g");
+    EXPECT_EQ(reduce_no, 1);
+    EXPECT_EQ(to_parti.Calc("orange"), 1);
+    EXPECT_EQ(to_parti.Calc("pear"), 2);
+    EXPECT_EQ(to_parti.Calc(""), 0);
+}
+
+TEST(Partitioner, PickSplitPoints) {
+    JobDescriptor job;
+    job.set_reduce_total(4);
+    std::vector<std::string> records;
+    for (int i = 0; i < 100; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%03d\tvalue", 99 - i);
+        records.push_back(buf);
+    }
+    std::vector<std::string> split_points;
+    PickSplitPoints(records, job, &split_points);
+    ASSERT_EQ(split_points.size(), 3u);
+    EXPECT_EQ(split_points[0], "025");
+    EXPECT_EQ(split_points[1], "050");
+    EXPECT_EQ(split_points[2], "075");
+    //a key taking most records is not cut into several ranges
+    records.assign(90, "same\tvalue");
+    records.push_back("zzz\tvalue");
+    PickSplitPoints(records, job, &split_points);
+    ASSERT_EQ(split_points.size(), 1u);
+    EXPECT_EQ(split_points[0], "zzz");
+    records.assign(90, "same\tvalue");
+    PickSplitPoints(records, job, &split_points);
+    EXPECT_TRUE(split_points.empty());
+    PickSplitPoints(std::vector<std::string>(), job, &split_points);
+    EXPECT_TRUE(split_points.empty());
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
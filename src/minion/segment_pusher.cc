@@ -0,0 +1,164 @@
+#include "segment_pusher.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <boost/scoped_ptr.hpp>
+#include "logging.h"
+#include "proto/app_master.pb.h"
+#include "proto/minion.pb.h"
+#include "sort/sort_file.h"
+
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+const static int sPushTimeout = 30;
+
+void AppendPushRecord(const std::string& key, const std::string& value,
+                      std::string* data) {
+    uint32_t key_len = key.size();
+    uint32_t value_len = value.size();
+    data->append((const char*)(&key_len), sizeof(key_len));
+    data->append(key);
+    data->append((const char*)(&value_len), sizeof(value_len));
+    data->append(value);
+}
+
+Status WriteSegment(const std::string& data, const std::string& file_name) {
+    Status status = kOk;
+    SortFileWriter* writer = SortFileWriter::Create(kLocalFile, &status);
+    boost::scoped_ptr<SortFileWriter> writer_guard(writer);
+    if (status != kOk) {
+        return status;
+    }
+    const std::string temp_name = file_name + ".tmp";
+    FileSystem::Param param;
+    status = writer->Open(temp_name, param);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open %s for write", temp_name.c_str());
+        return status;
+    }
+    size_t pos = 0;
+    while (pos < data.size() && status == kOk) {
+        uint32_t key_len = 0;
+        uint32_t value_len = 0;
+        if (pos + sizeof(key_len) > data.size()) {
+            status = kInvalidArg;
+            break;
+        }
+        memcpy(&key_len, data.data() + pos, sizeof(key_len));
+        pos += sizeof(key_len);
+        if (pos + key_len + sizeof(value_len) > data.size()) {
+            status = kInvalidArg;
+            break;
+        }
+        Slice key(data.data() + pos, key_len);
+        pos += key_len;
+        memcpy(&value_len, data.data() + pos, sizeof(value_len));
+        pos += sizeof(value_len);
+        if (pos + value_len > data.size()) {
+            status = kInvalidArg;
+            break;
+        }
+        status = writer->Put(key, Slice(data.data() + pos, value_len));
+        pos += value_len;
+    }
+    Status close_status = writer->Close();
+    if (status == kOk) {
+        status = close_status;
+    }
+    if (status == kOk && rename(temp_name.c_str(), file_name.c_str()) != 0) {
+        LOG(WARNING, "fail to rename %s, %s", temp_name.c_str(), strerror(errno));
+        status = kWriteFileFail;
+    }
+    if (status != kOk) {
+        LOG(WARNING, "fail to write segment %s: %s",
+            file_name.c_str(), Status_Name(status).c_str());
+        remove(temp_name.c_str());
+    }
+    return status;
+}
+
+SegmentPusher::SegmentPusher(const std::string& master_endpoint,
+                             const std::string& jobid,
+                             const TaskInfo& task) :
+                             master_endpoint_(master_endpoint),
+                             jobid_(jobid), task_(task) {
+
+}
+
+bool SegmentPusher::Refresh() {
+    Master_Stub* stub = NULL;
+    rpc_client_.GetStub(master_endpoint_, &stub);
+    boost::scoped_ptr<Master_Stub> stub_guard(stub);
+    GetReduceEndpointsRequest request;
+    GetReduceEndpointsResponse response;
+    request.set_jobid(jobid_);
+    bool ok = rpc_client_.SendRequest(stub, &Master_Stub::GetReduceEndpoints,
+                                      &request, &response, 5, 1);
+    if (!ok || response.status() != kOk) {
+        LOG(WARNING, "fail to get reduce endpoints, spill without pushing");
+        receivers_.clear();
+        return false;
+    }
+    receivers_.clear();
+    for (int i = 0; i < response.reduces_size(); i++) {
+        const ReduceEndpoint& reduce = response.reduces(i);
+        if (failed_receivers_.find(std::make_pair(reduce.reduce_no(), reduce.attempt()))
+            != failed_receivers_.end()) {
+            continue;
+        }
+        receivers_[reduce.reduce_no()] = std::make_pair(reduce.attempt(), reduce.endpoint());
+    }
+    LOG(INFO, "%d reduce tasks take pushed records", receivers_.size());
+    return true;
+}
+
+int SegmentPusher::Receiver(int reduce_no) const {
+    std::map<int, std::pair<int, std::string> >::const_iterator it;
+    it = receivers_.find(reduce_no);
+    if (it == receivers_.end()) {
+        return -1;
+    }
+    return it->second.first;
+}
+
+Status SegmentPusher::Push(int reduce_no, int file_no, int chunk_no,
+                           const std::string& data) {
+    std::map<int, std::pair<int, std::string> >::iterator it;
+    it = receivers_.find(reduce_no);
+    if (it == receivers_.end()) {
+        return kNoSuchTask;
+    }
+    Minion_Stub* stub = NULL;
+    rpc_client_.GetStub(it->second.second, &stub);
+    boost::scoped_ptr<Minion_Stub> stub_guard(stub);
+    PushSegmentRequest request;
+    PushSegmentResponse response;
+    request.set_job_id(jobid_);
+    request.set_reduce_no(reduce_no);
+    request.set_reduce_attempt(it->second.first);
+    request.set_map_no(task_.task_id());
+    request.set_map_attempt(task_.attempt_id());
+    request.set_file_no(file_no);
+    request.set_chunk_no(chunk_no);
+    request.set_data(data);
+    bool ok = rpc_client_.SendRequest(stub, &Minion_Stub::PushSegment,
+                                      &request, &response, sPushTimeout, 1);
+    Status status = ok ? response.status() : kUnKnown;
+    if (status != kOk) {
+        LOG(WARNING, "fail to push to reduce < no - %d, attempt - %d > at %s: %s",
+            reduce_no, it->second.first, it->second.second.c_str(),
+            Status_Name(status).c_str());
+        failed_receivers_.insert(std::make_pair(reduce_no, it->second.first));
+        receivers_.erase(it);
+    }
+    return status;
+}
+
+}
+}
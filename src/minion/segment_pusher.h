@@ -0,0 +1,47 @@
+#ifndef _BAIDU_SHUTTLE_SEGMENT_PUSHER_H_
+#define _BAIDU_SHUTTLE_SEGMENT_PUSHER_H_
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "common/rpc_client.h"
+#include "proto/shuttle.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// appends a record to the data of a PushSegmentRequest
+void AppendPushRecord(const std::string& key, const std::string& value,
+                      std::string* data);
+
+// writes the records of a pushed segment to a local sort file,
+// which shows up only when all of them are written
+Status WriteSegment(const std::string& data, const std::string& file_name);
+
+// pushes the records of the reduce tasks in a spill of a map
+// to the minions running them
+class SegmentPusher {
+public:
+    SegmentPusher(const std::string& master_endpoint, const std::string& jobid,
+                  const TaskInfo& task);
+    // asks master which reduce attempts are running, false if it can not tell
+    bool Refresh();
+    // the attempt taking the records of a reduce task, -1 if none is running
+    int Receiver(int reduce_no) const;
+    // a receiver failing a push is not pushed to again by this map
+    Status Push(int reduce_no, int file_no, int chunk_no, const std::string& data);
+private:
+    std::string master_endpoint_;
+    std::string jobid_;
+    const TaskInfo& task_;
+    RpcClient rpc_client_;
+    // attempts and endpoints of the running reduce tasks
+    std::map<int, std::pair<int, std::string> > receivers_;
+    std::set<std::pair<int, int> > failed_receivers_;
+};
+
+}
+}
+
+#endif
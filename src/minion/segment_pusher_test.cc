@@ -0,0 +1,75 @@
+#include "segment_pusher.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include "common/filesystem.h"
+#include "common/tools_util.h"
+#include "sort/sort_file.h"
+
+using namespace baidu::shuttle;
+
+TEST(SegmentPusherTest, AbsolutePath) {
+    char cwd[4096];
+    ASSERT_TRUE(getcwd(cwd, sizeof(cwd)) != NULL);
+    EXPECT_EQ(AbsolutePath("/tmp/pushed"), "/tmp/pushed");
+    EXPECT_EQ(AbsolutePath("./pushed"), std::string(cwd) + "/pushed");
+    EXPECT_EQ(AbsolutePath("pushed/a"), std::string(cwd) + "/pushed/a");
+    EXPECT_EQ(AbsolutePath(""), "");
+}
+
+// written in the dir of the minion, read by a shuffle run in the dir of the task
+TEST(SegmentPusherTest, ReadInTaskDir) {
+    char base[] = "/tmp/segment_pusher_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(base) != NULL);
+    char cwd[4096];
+    ASSERT_TRUE(getcwd(cwd, sizeof(cwd)) != NULL);
+    ASSERT_EQ(chdir(base), 0);
+
+    const std::string push_dir = AbsolutePath("./pushed_segments");
+    boost::scoped_ptr<FileSystem> fs(FileSystem::CreateLocalFs());
+    ASSERT_TRUE(fs->Mkdirs(push_dir));
+    std::string data;
+    char key[256];
+    char value[256];
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "key_%05d", i);
+        snprintf(value, sizeof(value), "value_%d", i);
+        AppendPushRecord(key, value, &data);
+    }
+    EXPECT_EQ(WriteSegment(data, PushedSegmentName(push_dir, 3, 1, 0, 0)), kOk);
+    EXPECT_EQ(WriteSegment("broken", PushedSegmentName(push_dir, 3, 1, 0, 1)), kInvalidArg);
+
+    ASSERT_EQ(mkdir("reduce_0_0", 0755), 0);
+    ASSERT_EQ(chdir("reduce_0_0"), 0);
+    EXPECT_FALSE(fs->Exist(PushedSegmentName("./pushed_segments", 3, 1, 0, 0)));
+    std::vector<std::string> file_names;
+    file_names.push_back(PushedSegmentName(push_dir, 3, 1, 0, 0));
+    MergeFileReader reader;
+    FileSystem::Param param;
+    ASSERT_EQ(reader.Open(file_names, param, kLocalFile), kOk);
+    SortFileReader::Iterator* it = reader.Scan("", "");
+    boost::scoped_ptr<SortFileReader::Iterator> it_guard(it);
+    int n = 0;
+    for (; !it->Done(); it->Next()) {
+        snprintf(key, sizeof(key), "key_%05d", n);
+        EXPECT_EQ(it->Key().ToString(), key);
+        n++;
+    }
+    EXPECT_EQ(n, 100);
+    reader.Close();
+    EXPECT_FALSE(fs->Exist(PushedSegmentName(push_dir, 3, 1, 0, 1)));
+
+    ASSERT_EQ(chdir(cwd), 0);
+    EXPECT_TRUE(fs->Remove(base));
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,101 @@
+#include "shuffle_service.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include "logging.h"
+
+using baidu::common::INFO;
+using baidu::common::WARNING;
+
+namespace baidu {
+namespace shuttle {
+
+//a response holds no more than this, readers ask again for the rest
+const static int32_t sMaxReadSpill = (8 << 20);
+
+ShuffleServiceImpl::ShuffleServiceImpl(const std::string& spill_dir) :
+                                       spill_dir_(spill_dir) {
+
+}
+
+ShuffleServiceImpl::~ShuffleServiceImpl() {
+
+}
+
+// nothing out of the spill dir is served
+static bool InSpillDir(const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+    std::vector<std::string> parts;
+    boost::split(parts, path, boost::is_any_of("/"));
+    return std::find(parts.begin(), parts.end(), "..") == parts.end();
+}
+
+void ShuffleServiceImpl::ReadSpill(::google::protobuf::RpcController* /*controller*/,
+                                   const ::baidu::shuttle::ReadSpillRequest* request,
+                                   ::baidu::shuttle::ReadSpillResponse* response,
+                                   ::google::protobuf::Closure* done) {
+    const std::string& path = request->path();
+    if (!InSpillDir(path) || request->offset() < 0 || request->length() < 0) {
+        LOG(WARNING, "refuse to read spill: %s", path.c_str());
+        response->set_status(kInvalidArg);
+        done->Run();
+        return;
+    }
+    response->set_status(ReadRange(spill_dir_ + "/" + path, request->offset(),
+                                   std::min(request->length(), sMaxReadSpill),
+                                   response));
+    done->Run();
+}
+
+Status ShuffleServiceImpl::ReadRange(const std::string& path, int64_t offset,
+                                     int32_t length, ReadSpillResponse* response) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(WARNING, "open %s fail, %s", path.c_str(), strerror(errno));
+        return kOpenFileFail;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        LOG(WARNING, "stat %s fail, %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return kReadFileFail;
+    }
+    response->set_file_size(st.st_size);
+    if (offset >= st.st_size || length == 0) {
+        ::close(fd);
+        return kOk;
+    }
+    length = std::min((int64_t)length, (int64_t)st.st_size - offset);
+    std::string* data = response->mutable_data();
+    data->resize(length);
+    int32_t n_read = 0;
+    while (n_read < length) {
+        ssize_t n = ::pread(fd, &(*data)[n_read], length - n_read, offset + n_read);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        n_read += n;
+    }
+    ::close(fd);
+    if (n_read < length) {
+        LOG(WARNING, "pread %s at %ld fail, %s", path.c_str(), offset + n_read,
+            strerror(errno));
+        data->clear();
+        return kReadFileFail;
+    }
+    return kOk;
+}
+
+}
+}
@@ -0,0 +1,31 @@
+#ifndef _BAIDU_SHUTTLE_SHUFFLE_SERVICE_H_
+#define _BAIDU_SHUTTLE_SHUFFLE_SERVICE_H_
+#include <string>
+
+#include "proto/minion.pb.h"
+
+namespace baidu {
+namespace shuttle {
+
+// serves byte ranges of the spills maps left under the spill dir of this
+// minion, reduce tasks read them through FileSystem::CreateShuffleFs
+class ShuffleServiceImpl : public Shuffle {
+public:
+    explicit ShuffleServiceImpl(const std::string& spill_dir);
+    virtual ~ShuffleServiceImpl();
+
+    void ReadSpill(::google::protobuf::RpcController* controller,
+                   const ::baidu::shuttle::ReadSpillRequest* request,
+                   ::baidu::shuttle::ReadSpillResponse* response,
+                   ::google::protobuf::Closure* done);
+private:
+    Status ReadRange(const std::string& path, int64_t offset, int32_t length,
+                     ReadSpillResponse* response);
+private:
+    std::string spill_dir_;
+};
+
+}
+}
+
+#endif
@@ -117,6 +117,17 @@ bool ShuttleImpl::SubmitJob(const sdk::JobDescription& job_desc, std::string& jo
     for (size_t i = 0; i < job_desc.cmdenvs.size(); i++) {
         job->add_cmdenvs(job_desc.cmdenvs[i]);   
     }
+    job->set_shuffle_compression((CompressionType)job_desc.shuffle_compression);
+    if (!job_desc.nfs_work_dir.empty()) {
+        job->set_nfs_work_dir(job_desc.nfs_work_dir);
+    }
+    if (!job_desc.merge_combiner.empty()) {
+        job->set_merge_combiner(job_desc.merge_combiner);
+    }
+    job->set_pipelined_shuffle(job_desc.pipelined_shuffle);
+    job->set_local_shuffle(job_desc.local_shuffle);
+    job->set_push_shuffle(job_desc.push_shuffle);
+    job->set_host_shuffle(job_desc.host_shuffle);
     bool ok = rpc_client_.SendRequest(master_stub_, &Master_Stub::SubmitJob,
                                       &request, &response, rpc_timeout_, 1);
     if (!ok) {
@@ -256,6 +267,13 @@ bool ShuttleImpl::ShowJob(const std::string& job_id,
     job.desc.map_retry = desc.map_retry();
     job.desc.reduce_retry = desc.reduce_retry();
     job.desc.split_size = desc.split_size();
+    job.desc.shuffle_compression = (sdk::CompressionType)desc.shuffle_compression();
+    job.desc.nfs_work_dir = desc.nfs_work_dir();
+    job.desc.merge_combiner = desc.merge_combiner();
+    job.desc.pipelined_shuffle = desc.pipelined_shuffle();
+    job.desc.local_shuffle = desc.local_shuffle();
+    job.desc.push_shuffle = desc.push_shuffle();
+    job.desc.host_shuffle = desc.host_shuffle();
 
     job.jobid = joboverview.jobid();
     job.state = (sdk::JobState)joboverview.state();
@@ -359,6 +377,13 @@ bool ShuttleImpl::ListJobs(std::vector<sdk::JobInstance>& jobs,
         job.desc.map_retry = desc.map_retry();
         job.desc.reduce_retry = desc.reduce_retry();
         job.desc.split_size = desc.split_size();
+        job.desc.shuffle_compression = (sdk::CompressionType)desc.shuffle_compression();
+        job.desc.nfs_work_dir = desc.nfs_work_dir();
+        job.desc.merge_combiner = desc.merge_combiner();
+        job.desc.pipelined_shuffle = desc.pipelined_shuffle();
+        job.desc.local_shuffle = desc.local_shuffle();
+        job.desc.push_shuffle = desc.push_shuffle();
+        job.desc.host_shuffle = desc.host_shuffle();
 
         job.jobid = it->jobid();
         job.state = (sdk::JobState)it->state();
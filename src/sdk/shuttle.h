@@ -43,7 +43,8 @@ enum TaskState {
 
 enum PartitionMethod {
     kKeyFieldBased = 0,
-    kIntHash = 1
+    kIntHash = 1,
+    kTotalOrder = 2
 };
 
 enum InputFormat {
@@ -69,6 +70,13 @@ enum PipeStyle {
     kBiStreaming = 1
 };
 
+enum CompressionType {
+    kSnappy = 0,
+    kNoCompression = 1,
+    kLz4 = 2,
+    kZstd = 3
+};
+
 struct TaskStatistics {
     int32_t total;
     int32_t pending;
@@ -121,6 +129,13 @@ struct JobDescription {
     std::string combine_command;
     bool compress_output;
     std::vector<std::string> cmdenvs;
+    CompressionType shuffle_compression;
+    std::string nfs_work_dir;
+    std::string merge_combiner;
+    bool pipelined_shuffle;
+    bool local_shuffle;
+    bool push_shuffle;
+    bool host_shuffle;
 };
 
 struct TaskInstance {
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <sstream>
 #include <iostream>
 #include <limits>
 #include <boost/lexical_cast.hpp>
@@ -10,6 +11,7 @@
 #include "input_reader.h"
 #include "logging.h"
 #include "common/tools_util.h"
+#include "common/io_permit.h"
 
 using baidu::common::INFO;
 using baidu::common::WARNING;
@@ -29,6 +31,10 @@ DEFINE_string(format, "text", "input format: text/binary");
 DEFINE_string(pipe, "streaming", "pipe style: streaming/bistreaming");
 DEFINE_bool(is_nline, false, "whether NlineInputformat");
 DEFINE_bool(decompress_input, false, "whether decompreess input file");
+DEFINE_string(master_endpoint, "", "master pacing the opens of input files, empty means no pacing");
+DEFINE_string(jobid, "", "id of the job, to talk with master");
+DEFINE_int32(map_no, 0, "the map number of this map task");
+DEFINE_int32(attempt_id, 0, "the attempt_id of this map task");
 
 void FillParam(FileSystem::Param& param) {
     if (boost::ends_with(FLAGS_file, ".gz")) {
@@ -73,7 +79,21 @@ void DoRead() {
     }
     FileSystem::Param param;
     FillParam(param);
+    RpcClient* rpc_client = NULL;
+    Master_Stub* master = NULL;
+    if (FLAGS_fs == "hdfs" && !FLAGS_master_endpoint.empty() && !FLAGS_jobid.empty()) {
+        rpc_client = new RpcClient();
+        rpc_client->GetStub(FLAGS_master_endpoint, &master);
+    }
+    std::stringstream holder;
+    holder << FLAGS_jobid << "_map_" << FLAGS_map_no << "_" << FLAGS_attempt_id;
+    //maps starting together open their inputs a few at a time
+    IoPermit permit(rpc_client, master, FLAGS_dfs_host, holder.str());
+    permit.Acquire();
     Status status = reader->Open(FLAGS_file, param);
+    permit.Release();
+    delete master;
+    delete rpc_client;
     if (status != kOk) {
         std::cerr << "fail to open: " << FLAGS_file << std::endl;
         exit(-1);
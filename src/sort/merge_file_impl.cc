@@ -1,6 +1,8 @@
 #include "sort_file.h"
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <logging.h>
+#include "timer.h"
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -12,6 +14,10 @@ namespace shuttle {
 
 const static int sParallelLevel = 3;
 
+MergeFileReader::MergeFileReader() : parallelism_(sParallelLevel) {
+
+}
+
 MergeFileReader::~MergeFileReader() {
     std::vector<SortFileReader*>::iterator it;
     for (it = readers_.begin(); it != readers_.end(); it++) {
@@ -20,13 +26,20 @@ MergeFileReader::~MergeFileReader() {
 }
 
 void MergeFileReader::AddReader(const std::string& file_name, FileSystem::Param param, 
-                                FileType file_type, Status* status) {
+                                FileType file_type, size_t slot, Status* status) {
+    {
+        MutexLock lock(&mu_);
+        if (*status != kOk) {
+            return; //another file failed, the merge is given up
+        }
+    }
     Status st;
     SortFileReader* reader = SortFileReader::Create(file_type, &st);
     if (st == kOk) {
         st = reader->Open(file_name, param);
     }
     if (st != kOk) {
+        delete reader;
         {
             MutexLock lock(&mu_);
             *status = st;
@@ -37,7 +50,7 @@ void MergeFileReader::AddReader(const std::string& file_name, FileSystem::Param
         return;
     } else {
         MutexLock lock(&mu_);
-        readers_.push_back(reader);
+        readers_[slot] = reader;
     }
 }
 
@@ -47,20 +60,34 @@ Status MergeFileReader::Open(const std::vector<std::string>& files,
     if (files.size() == 0) {
         return kInvalidArg;
     }
+    if (param.find("merge_parallelism") != param.end()) {
+        parallelism_ = atoi(param["merge_parallelism"].c_str());
+        if (parallelism_ <= 0) {
+            LOG(WARNING, "invalid merge parallelism: %d", parallelism_);
+            return kInvalidArg;
+        }
+    }
     Status status = kOk;
-    Status* st = new Status();
-    std::vector<std::string>::const_iterator it;
+    //a slot for each file keeps the readers in the order of files
+    readers_.assign(files.size(), NULL);
+    int64_t start = common::timer::get_micros();
 	LOG(INFO, "wait for #%d readers open", files.size());
-    for (it = files.begin(); it != files.end(); it++) {
-        const std::string& file_name = *it;
-        AddReader(file_name, param, file_type, st);
-        if (*st != kOk) {
-            break;
+    {
+        ThreadPool pool(std::min((size_t)parallelism_, files.size()));
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.AddTask(boost::bind(&MergeFileReader::AddReader, this,
+                                     files[i], param, file_type, i, &status));
         }
+        pool.Stop(true);
     }
-    LOG(INFO, "wait file open done");
-    status = *st; 
-    delete st;
+    readers_.erase(std::remove(readers_.begin(), readers_.end(), (SortFileReader*)NULL),
+                   readers_.end());
+    ReaderStatistics stat;
+    GetStatistics(&stat);
+    LOG(INFO, "wait file open done, #%d files in %ld ms, %ld us per file, %ld us at most",
+        readers_.size(), (common::timer::get_micros() - start) / 1000,
+        readers_.empty() ? 0 : stat.open_micros / (int64_t)readers_.size(),
+        stat.max_open_micros);
     return status;
 }
 
@@ -77,7 +104,7 @@ Status MergeFileReader::Close() {
     std::vector<SortFileReader*>::iterator it;
     Status status = kOk;
 	Status* st = new Status();
-	ThreadPool pool(sParallelLevel);
+	ThreadPool pool(parallelism_);
 	LOG(INFO, "wait #%d readers close", readers_.size());
     for (it = readers_.begin(); it != readers_.end(); it++) {
 		SortFileReader* reader = *it;
@@ -90,10 +117,24 @@ Status MergeFileReader::Close() {
     return status;
 }
 
+void MergeFileReader::GetStatistics(ReaderStatistics* stat) {
+    std::vector<SortFileReader*>::iterator it;
+    for (it = readers_.begin(); it != readers_.end(); it++) {
+        ReaderStatistics reader_stat;
+        (*it)->GetStatistics(&reader_stat);
+        stat->blocks_decoded += reader_stat.blocks_decoded;
+        stat->blocks_skipped += reader_stat.blocks_skipped;
+        stat->stall_micros += reader_stat.stall_micros;
+        stat->filtered += reader_stat.filtered;
+        stat->open_micros += reader_stat.open_micros;
+        stat->max_open_micros = std::max(stat->max_open_micros, reader_stat.max_open_micros);
+    }
+}
+
 void MergeFileReader::AddIter(std::vector<SortFileReader::Iterator*>* iters,
                               SortFileReader* reader,
-                              const std::string& start_key,
-                              const std::string& end_key,
+                              ScanFunc scan,
+                              size_t slot,
                               bool* has_error) {
     {
         MutexLock lock(&mu_);
@@ -102,10 +143,10 @@ void MergeFileReader::AddIter(std::vector<SortFileReader::Iterator*>* iters,
             return;
         }
     }
-    SortFileReader::Iterator* it = reader->Scan(start_key, end_key);
+    SortFileReader::Iterator* it = scan(reader);
     {
         MutexLock lock(&mu_);
-        iters->push_back(it);
+        (*iters)[slot] = it;
         if (it->Error() != kOk && it->Error() != kNoMore) {
             *has_error = true;
             err_file_ = it->GetFileName();
@@ -114,19 +155,44 @@ void MergeFileReader::AddIter(std::vector<SortFileReader::Iterator*>* iters,
 }
 
 SortFileReader::Iterator* MergeFileReader::Scan(const std::string& start_key, const std::string& end_key) {
-    std::vector<SortFileReader::Iterator*>* iters = new std::vector<SortFileReader::Iterator*>();
+    return ScanAll(boost::bind(&SortFileReader::Scan, _1, start_key, end_key));
+}
+
+SortFileReader::Iterator* MergeFileReader::ScanPartition(int32_t partition) {
+    return ScanAll(boost::bind(&SortFileReader::ScanPartition, _1, partition));
+}
+
+Status MergeFileReader::GetIndexKeys(std::vector<std::string>* keys) {
     std::vector<SortFileReader*>::iterator it;
-    ThreadPool pool(sParallelLevel);
+    for (it = readers_.begin(); it != readers_.end(); it++) {
+        Status status = (*it)->GetIndexKeys(keys);
+        if (status != kOk) {
+            err_file_ = (*it)->GetFileName();
+            LOG(WARNING, "failed to get index keys of %s, %s",
+                err_file_.c_str(), Status_Name(status).c_str());
+            return status;
+        }
+    }
+    std::sort(keys->begin(), keys->end());
+    return kOk;
+}
+
+SortFileReader::Iterator* MergeFileReader::ScanAll(ScanFunc scan) {
+    //a slot for each reader, so that equal keys come out in the order of files
+    std::vector<SortFileReader::Iterator*>* iters =
+        new std::vector<SortFileReader::Iterator*>(readers_.size(), NULL);
+    ThreadPool pool(parallelism_);
     bool* has_error   = new bool(false);
 	LOG(INFO, "wait for iterators init...");
-    for (it = readers_.begin(); it != readers_.end(); it++) {
-        SortFileReader * const& reader = *it;
+    for (size_t i = 0; i < readers_.size(); i++) {
         pool.AddTask(boost::bind(
-                    &MergeFileReader::AddIter, this, iters, reader, 
-                    start_key, end_key, has_error
+                    &MergeFileReader::AddIter, this, iters, readers_[i],
+                    scan, i, has_error
         ));
     }
 	pool.Stop(true);
+    iters->erase(std::remove(iters->begin(), iters->end(), (SortFileReader::Iterator*)NULL),
+                 iters->end());
     LOG(INFO, "all iterators done. #%d", iters->size());
     delete has_error;
     MergeIterator* merge_it = new MergeIterator(*iters, this);
@@ -139,14 +205,11 @@ MergeFileReader::MergeIterator::MergeIterator(const std::vector<SortFileReader::
     merge_reader_ = reader;
     std::vector<SortFileReader::Iterator*>::const_iterator it;
     status_ = kOk;
-    int offset = 0;
     for (it = iters.begin(); it != iters.end(); it++) {
         SortFileReader::Iterator * const& reader_it = *it;
         bool drained = false;
         if (!reader_it->Done()) {
-            queue_.push(MergeItem(reader_it->Key(), reader_it->Value(), offset));
             iters_.push_back(reader_it);
-            offset++;
         } else {
             drained = true;
         }
@@ -158,9 +221,14 @@ MergeFileReader::MergeIterator::MergeIterator(const std::vector<SortFileReader::
             delete reader_it;
         }
     }
-    if (status_ == kOk && !queue_.empty()) {
-        key_ = queue_.top().key_;
-        value_ = queue_.top().value_;
+    if (!iters_.empty()) {
+        keys_.resize(iters_.size());
+        drained_.resize(iters_.size(), false);
+        for (size_t i = 0; i < iters_.size(); i++) {
+            keys_[i] = iters_[i]->Key();
+        }
+        tree_.resize(iters_.size());
+        tree_[0] = BuildTree(1);
     }
 }
 
@@ -172,21 +240,61 @@ MergeFileReader::MergeIterator::~MergeIterator() {
     }
 }
 
+int MergeFileReader::MergeIterator::BuildTree(int node) {
+    int k = iters_.size();
+    if (node >= k) {
+        return node - k; //a leaf
+    }
+    int left = BuildTree(node * 2);
+    int right = BuildTree(node * 2 + 1);
+    if (Less(right, left)) {
+        std::swap(left, right);
+    }
+    tree_[node] = right;
+    return left;
+}
+
+bool MergeFileReader::MergeIterator::Less(int a, int b) {
+    //drained iterators lose to all, equal keys come out in the order of iterators
+    if (drained_[a]) {
+        return false;
+    }
+    if (drained_[b]) {
+        return true;
+    }
+    int cmp = keys_[a].compare(keys_[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
 bool MergeFileReader::MergeIterator::Done() {
-    return queue_.empty();
+    return iters_.empty() || drained_[tree_[0]];
+}
+
+Slice MergeFileReader::MergeIterator::Key() {
+    if (Done()) {
+        return Slice();
+    }
+    return keys_[tree_[0]];
+}
+
+Slice MergeFileReader::MergeIterator::Value() {
+    if (Done()) {
+        return Slice();
+    }
+    return iters_[tree_[0]]->Value();
 }
 
 void MergeFileReader::MergeIterator::Next() {
-    if (queue_.empty()) {
+    if (Done()) {
         return;
     }
-    const MergeItem& top = queue_.top();
-    int offset = top.it_offset_;
-    SortFileReader::Iterator* reader_it = iters_[offset];
+    int winner = tree_[0];
+    SortFileReader::Iterator* reader_it = iters_[winner];
     reader_it->Next();
-    queue_.pop();
-    if (!reader_it->Done()) {
-        queue_.push(MergeItem(reader_it->Key(), reader_it->Value(), offset));
+    if (reader_it->Done()) {
+        drained_[winner] = true;
+    } else {
+        keys_[winner] = reader_it->Key();
     }
     if (reader_it->Error() != kOk && reader_it->Error() != kNoMore) {
         status_ = reader_it->Error();
@@ -194,10 +302,50 @@ void MergeFileReader::MergeIterator::Next() {
         LOG(WARNING, "failed to call next of %s, %s", 
             merge_reader_->err_file_.c_str(), Status_Name(status_).c_str());
     }
-    if (!queue_.empty()) {
-        key_ = queue_.top().key_;
-        value_ = queue_.top().value_;
+    //replay the matches on the path from the leaf to the root
+    int k = iters_.size();
+    for (int node = (winner + k) / 2; node > 0; node /= 2) {
+        if (Less(tree_[node], winner)) {
+            std::swap(tree_[node], winner);
+        }
+    }
+    tree_[0] = winner;
+}
+
+GroupIterator::GroupIterator(SortFileReader::Iterator* it) : it_(it), values_(this) {
+    done_ = it_->Done();
+    if (!done_) {
+        Slice key = it_->Key();
+        key_.assign(key.data(), key.size());
+    }
+}
+
+bool GroupIterator::Done() {
+    return done_;
+}
+
+void GroupIterator::Next() {
+    while (!values_.Done()) {
+        values_.Next();
     }
+    done_ = it_->Done();
+    if (!done_) {
+        Slice key = it_->Key();
+        key_.assign(key.data(), key.size());
+    }
+}
+
+bool GroupIterator::ValueIterator::Done() {
+    SortFileReader::Iterator* it = group_->it_;
+    return it->Done() || it->Key() != Slice(group_->key_);
+}
+
+void GroupIterator::ValueIterator::Next() {
+    group_->it_->Next();
+}
+
+Slice GroupIterator::ValueIterator::Value() {
+    return group_->it_->Value();
 }
 
 }
@@ -70,7 +70,7 @@ TEST(Merge, Read1) {
     EXPECT_EQ(status, kOk);
     SortFileReader::Iterator* it = reader->Scan("", "");
     while (!it->Done()) {
-        printf("%s --> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s --> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
         EXPECT_EQ(it->Error(), kOk);
     }
@@ -145,7 +145,7 @@ TEST(Merge, Read2) {
     int ct = 0;
     SortFileReader::Iterator* it = reader->Scan("", "");
     while (!it->Done()) {
-        //printf("%s --> %s\n", it->Key().c_str(), it->Value().c_str());
+        //printf("%s --> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
         EXPECT_EQ(it->Error(), kOk);
         ct++;
@@ -155,7 +155,7 @@ TEST(Merge, Read2) {
     ct = 0;
     it = reader->Scan("key_000010000", "key_000020000");
     while (!it->Done()) {
-        //printf("%s --> %s\n", it->Key().c_str(), it->Value().c_str());
+        //printf("%s --> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
         EXPECT_EQ(it->Error(), kOk);
         ct++;
@@ -165,7 +165,7 @@ TEST(Merge, Read2) {
     ct = 0;
     it = reader->Scan("key_000080000", "key_000090000");
     while (!it->Done()) {
-        //printf("%s --> %s\n", it->Key().c_str(), it->Value().c_str());
+        //printf("%s --> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
         EXPECT_EQ(it->Error(), kOk);
         ct++;
@@ -177,6 +177,170 @@ TEST(Merge, Read2) {
     delete reader;    
 }
 
+TEST(Merge, ReadGroup) {
+    MergeFileReader* reader = new MergeFileReader();
+    std::vector<std::string> file_names;
+    file_names.push_back(g_work_dir + "/merge_test1.data");
+    file_names.push_back(g_work_dir + "/merge_test2.data");
+    file_names.push_back(g_work_dir + "/merge_test3.data");
+    FileSystem::Param param;
+    Status status = reader->Open(file_names, param, g_file_type);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator* it = reader->Scan("key_000010000", "key_000020000");
+    GroupIterator groups(it);
+    int n_keys = 0;
+    while (!groups.Done()) {
+        //key i is in the third file too if i % 3 == 0
+        int i = 10000 + n_keys;
+        char key[256];
+        snprintf(key, sizeof(key), "key_%09d", i);
+        EXPECT_EQ(groups.Key(), std::string(key));
+        int n = 0;
+        GroupIterator::ValueIterator* values = groups.Values();
+        //leave the second value of every other key to Next()
+        while (!values->Done() && !(n == 1 && i % 2 == 0)) {
+            char value[256];
+            snprintf(value, sizeof(value), "value_%d", i * 2);
+            EXPECT_EQ(values->Value(), std::string(value));
+            values->Next();
+            n++;
+        }
+        EXPECT_EQ(n, (i % 3 == 0 && i % 2 != 0) ? 2 : 1);
+        n_keys++;
+        groups.Next();
+        EXPECT_TRUE(groups.Error() == kOk || groups.Error() == kNoMore);
+    }
+    EXPECT_EQ(n_keys, 10000);
+    delete it;
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(Merge, PutMany) {
+    //key i goes to every file whose number divides i, so keys repeat across files
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int f = 1; f <= 100; f++) {
+        Status status;
+        SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+        EXPECT_EQ(status, kOk);
+        FileSystem::Param param;
+        snprintf(key, sizeof(key), "/merge_many%d.data", f);
+        status = writer->Open(g_work_dir + key, param);
+        EXPECT_EQ(status, kOk);
+        for (int i = f; i <= 10000; i += f) {
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d", f);
+            status = writer->Put(key, value);
+            EXPECT_EQ(status, kOk);
+        }
+        status = writer->Close();
+        EXPECT_EQ(status, kOk);
+        delete writer;
+    }
+}
+
+TEST(Merge, ReadMany) {
+    MergeFileReader* reader = new MergeFileReader();
+    std::vector<std::string> file_names;
+    char file_name[256] = {'\0'};
+    int total = 0;
+    for (int f = 1; f <= 100; f++) {
+        snprintf(file_name, sizeof(file_name), "/merge_many%d.data", f);
+        file_names.push_back(g_work_dir + file_name);
+        total += 10000 / f;
+    }
+    FileSystem::Param param;
+    param["merge_parallelism"] = "8";
+    Status status = reader->Open(file_names, param, g_file_type);
+    EXPECT_EQ(status, kOk);
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
+    EXPECT_GE(stat.open_micros, stat.max_open_micros);
+    int ct = 0;
+    std::string last_key;
+    SortFileReader::Iterator* it = reader->Scan("", "");
+    while (!it->Done()) {
+        std::string key = it->Key().ToString();
+        EXPECT_LE(last_key, key);
+        last_key = key;
+        it->Next();
+        EXPECT_EQ(it->Error(), kOk);
+        ct++;
+    }
+    delete it;
+    EXPECT_EQ(ct, total);
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(Merge, OpenMissing) {
+    std::vector<std::string> file_names;
+    char file_name[256] = {'\0'};
+    for (int f = 1; f <= 100; f++) {
+        snprintf(file_name, sizeof(file_name), "/merge_many%d.data", f);
+        file_names.push_back(g_work_dir + file_name);
+    }
+    file_names[50] = g_work_dir + "/merge_missing.data";
+    FileSystem::Param param;
+    param["merge_parallelism"] = "8";
+    MergeFileReader* reader = new MergeFileReader();
+    Status status = reader->Open(file_names, param, g_file_type);
+    EXPECT_EQ(status, kOpenFileFail);
+    EXPECT_EQ(reader->GetErrorFile(), file_names[50]);
+    delete reader;
+    param["merge_parallelism"] = "0";
+    reader = new MergeFileReader();
+    status = reader->Open(file_names, param, g_file_type);
+    EXPECT_EQ(status, kInvalidArg);
+    delete reader;
+}
+
+TEST(Merge, EqualKeysInFileOrder) {
+    //the same keys in every file, the scans are set up by many threads
+    std::vector<std::string> file_names;
+    char file_name[256] = {'\0'};
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    Status status;
+    for (int f = 0; f < 16; f++) {
+        SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+        EXPECT_EQ(status, kOk);
+        snprintf(file_name, sizeof(file_name), "/merge_same%d.data", f);
+        file_names.push_back(g_work_dir + file_name);
+        FileSystem::Param param;
+        EXPECT_EQ(writer->Open(file_names.back(), param), kOk);
+        for (int i = 0; i < 100; i++) {
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d", f);
+            EXPECT_EQ(writer->Put(key, value), kOk);
+        }
+        EXPECT_EQ(writer->Close(), kOk);
+        delete writer;
+    }
+    FileSystem::Param param;
+    param["merge_parallelism"] = "8";
+    for (int round = 0; round < 5; round++) {
+        MergeFileReader* reader = new MergeFileReader();
+        status = reader->Open(file_names, param, g_file_type);
+        EXPECT_EQ(status, kOk);
+        SortFileReader::Iterator* it = reader->Scan("", "");
+        int ct = 0;
+        while (!it->Done()) {
+            snprintf(value, sizeof(value), "value_%d", ct % 16);
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            ct++;
+        }
+        EXPECT_EQ(ct, 1600);
+        delete it;
+        EXPECT_EQ(reader->Close(), kOk);
+        delete reader;
+    }
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         printf("./merge_test [hdfs work dir] [filetype](optional) \n");
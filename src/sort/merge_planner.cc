@@ -0,0 +1,323 @@
+#include "merge_planner.h"
+#include <assert.h>
+#include <algorithm>
+#include <sstream>
+
+namespace baidu {
+namespace shuttle {
+
+MergePlan::MergePlan() : n_inputs_(0), rewritten_bytes_(0) {
+
+}
+
+int32_t MergePlan::Passes() const {
+    return levels_.size();
+}
+
+int32_t MergePlan::Inputs() const {
+    return n_inputs_;
+}
+
+int32_t MergePlan::Groups(int32_t level) const {
+    assert(level >= 0 && level < Passes());
+    return levels_[level].size();
+}
+
+const std::vector<int32_t>& MergePlan::Members(int32_t level, int32_t group) const {
+    assert(group >= 0 && group < Groups(level));
+    return levels_[level][group];
+}
+
+bool MergePlan::PassThrough(int32_t level, int32_t group) const {
+    return Members(level, group).size() == 1;
+}
+
+int32_t MergePlan::Parent(int32_t level, int32_t group) const {
+    assert(group >= 0 && group < Groups(level));
+    if (level + 1 >= Passes()) {
+        return -1;
+    }
+    return parents_[level][group];
+}
+
+int32_t MergePlan::MaxFanIn(int32_t level) const {
+    size_t fan_in = 0;
+    for (int32_t i = 0; i < Groups(level); i++) {
+        fan_in = std::max(fan_in, levels_[level][i].size());
+    }
+    return fan_in;
+}
+
+int64_t MergePlan::RewrittenBytes() const {
+    return rewritten_bytes_;
+}
+
+const std::vector<int32_t>& MergePlan::FastReduces() const {
+    return fast_reduces_;
+}
+
+void MergePlan::Reset(int32_t n_inputs) {
+    n_inputs_ = n_inputs;
+    rewritten_bytes_ = 0;
+    levels_.clear();
+    parents_.clear();
+    fast_reduces_.clear();
+}
+
+void MergePlan::AddLevel(const std::vector<std::vector<int32_t> >& groups) {
+    if (!levels_.empty()) {
+        parents_.push_back(std::vector<int32_t>(levels_.back().size(), -1));
+        for (size_t g = 0; g < groups.size(); g++) {
+            for (size_t i = 0; i < groups[g].size(); i++) {
+                parents_.back()[groups[g][i]] = g;
+            }
+        }
+    }
+    levels_.push_back(groups);
+}
+
+void MergePlan::SetRewrittenBytes(int64_t bytes) {
+    rewritten_bytes_ = bytes;
+}
+
+void MergePlan::SetFastReduces(const std::vector<int32_t>& reduces) {
+    fast_reduces_ = reduces;
+}
+
+std::string MergePlan::ToString() const {
+    std::stringstream ss;
+    ss << "merge_plan " << n_inputs_ << " " << levels_.size()
+       << " " << rewritten_bytes_ << "\n";
+    for (size_t level = 0; level < levels_.size(); level++) {
+        for (size_t g = 0; g < levels_[level].size(); g++) {
+            const std::vector<int32_t>& members = levels_[level][g];
+            ss << (g == 0 ? "" : " ");
+            for (size_t i = 0; i < members.size(); i++) {
+                ss << (i == 0 ? "" : ",") << members[i];
+            }
+        }
+        ss << "\n";
+    }
+    if (!fast_reduces_.empty()) {
+        ss << "fast ";
+        for (size_t i = 0; i < fast_reduces_.size(); i++) {
+            ss << (i == 0 ? "" : ",") << fast_reduces_[i];
+        }
+        ss << "\n";
+    }
+    ss << "end\n";
+    return ss.str();
+}
+
+bool MergePlan::FromString(const std::string& text) {
+    std::istringstream in(text);
+    std::string line;
+    std::string magic;
+    int32_t n_inputs = 0;
+    int32_t n_levels = 0;
+    int64_t rewritten_bytes = 0;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    std::istringstream header(line);
+    if (!(header >> magic >> n_inputs >> n_levels >> rewritten_bytes)
+        || magic != "merge_plan" || n_inputs < 0 || n_levels < 0) {
+        return false;
+    }
+    Reset(n_inputs);
+    int32_t n_items = n_inputs;
+    for (int32_t level = 0; level < n_levels; level++) {
+        if (!std::getline(in, line)) {
+            return false;
+        }
+        std::vector<std::vector<int32_t> > groups;
+        std::vector<bool> used(n_items, false);
+        int32_t n_used = 0;
+        std::istringstream groups_in(line);
+        std::string group;
+        while (groups_in >> group) {
+            groups.push_back(std::vector<int32_t>());
+            std::istringstream members_in(group);
+            int32_t member = 0;
+            char comma = ',';
+            while (comma == ',' && members_in >> member) {
+                if (member < 0 || member >= n_items || used[member]) {
+                    return false;
+                }
+                used[member] = true;
+                n_used++;
+                groups.back().push_back(member);
+                comma = 0;
+                members_in >> comma;
+            }
+            if (groups.back().empty() || !members_in.eof()) {
+                return false;
+            }
+        }
+        //every item of the level below is taken by exactly one group
+        if (n_used != n_items) {
+            return false;
+        }
+        AddLevel(groups);
+        n_items = groups.size();
+    }
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    if (line.compare(0, 5, "fast ") == 0) {
+        std::istringstream fast_in(line.substr(5));
+        int32_t reduce_no = 0;
+        char comma = ',';
+        while (comma == ',' && fast_in >> reduce_no) {
+            fast_reduces_.push_back(reduce_no);
+            comma = 0;
+            fast_in >> comma;
+        }
+        if (fast_reduces_.empty() || !fast_in.eof() || !std::getline(in, line)) {
+            return false;
+        }
+    }
+    if (line != "end") {
+        return false;
+    }
+    SetRewrittenBytes(rewritten_bytes);
+    return true;
+}
+
+// consecutive items cut into n_groups of similar bytes,
+// a group is cut again if it has more files than fan_in
+static void GroupAll(const std::vector<MergeInput>& items, int64_t n_groups,
+                     int32_t fan_in, std::vector<std::vector<int32_t> >* groups) {
+    int64_t total_bytes = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        total_bytes += items[i].bytes;
+    }
+    int64_t prefix = 0;
+    int64_t last_slot = -1;
+    int64_t group_files = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        int64_t slot = 0;
+        if (total_bytes > 0) {
+            slot = (prefix + items[i].bytes / 2) * n_groups / total_bytes;
+        } else {
+            slot = i * n_groups / items.size();
+        }
+        prefix += items[i].bytes;
+        if (groups->empty() || slot != last_slot
+            || group_files + items[i].files > fan_in) {
+            groups->push_back(std::vector<int32_t>());
+            group_files = 0;
+        }
+        last_slot = slot;
+        groups->back().push_back(i);
+        group_files += items[i].files;
+    }
+}
+
+// the smallest items merged until the files are fewer by n_reduce,
+// items left alone are passed through
+static void GroupSmallest(const std::vector<MergeInput>& items, int64_t n_reduce,
+                          int32_t fan_in, std::vector<std::vector<int32_t> >* groups) {
+    std::vector<std::pair<int64_t, int32_t> > order;
+    for (size_t i = 0; i < items.size(); i++) {
+        order.push_back(std::make_pair(items[i].bytes, (int32_t)i));
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<bool> merged(items.size(), false);
+    std::vector<int32_t> cur;
+    int64_t cur_files = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (cur.size() >= 2 && n_reduce <= cur_files - 1) {
+            break;
+        }
+        int32_t item = order[i].second;
+        if (items[item].files > fan_in) {
+            continue;
+        }
+        if (!cur.empty() && cur_files + items[item].files > fan_in) {
+            if (cur.size() >= 2) {
+                n_reduce -= cur_files - 1;
+                groups->push_back(cur);
+            }
+            cur.clear();
+            cur_files = 0;
+        }
+        cur.push_back(item);
+        cur_files += items[item].files;
+    }
+    if (cur.size() >= 2) {
+        groups->push_back(cur);
+    }
+    for (size_t g = 0; g < groups->size(); g++) {
+        for (size_t i = 0; i < (*groups)[g].size(); i++) {
+            merged[(*groups)[g][i]] = true;
+        }
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!merged[i]) {
+            groups->push_back(std::vector<int32_t>(1, i));
+        }
+    }
+}
+
+void PlanMerge(const std::vector<MergeInput>& inputs,
+               const MergeBudget& budget, MergePlan* plan) {
+    assert(plan);
+    plan->Reset(inputs.size());
+    int32_t final_fan_in = std::max(budget.final_fan_in, 2);
+    int32_t merge_fan_in = std::max(budget.merge_fan_in, 2);
+    std::vector<MergeInput> items(inputs);
+    int64_t rewritten_bytes = 0;
+    while (true) {
+        int64_t total_files = 0;
+        for (size_t i = 0; i < items.size(); i++) {
+            total_files += items[i].files;
+        }
+        if (total_files <= final_fan_in) {
+            break;
+        }
+        std::vector<std::vector<int32_t> > groups;
+        int64_t n_merges = (total_files + merge_fan_in - 1) / merge_fan_in;
+        if (n_merges > final_fan_in) {
+            GroupAll(items, n_merges, merge_fan_in, &groups);
+        } else {
+            GroupSmallest(items, total_files - final_fan_in, merge_fan_in, &groups);
+        }
+        if (groups.size() == items.size()) {
+            break; //nothing fits in the budget, the final merge opens them all
+        }
+        std::vector<MergeInput> next_items;
+        for (size_t g = 0; g < groups.size(); g++) {
+            const std::vector<int32_t>& members = groups[g];
+            MergeInput item(1, 0);
+            for (size_t i = 0; i < members.size(); i++) {
+                item.bytes += items[members[i]].bytes;
+            }
+            if (members.size() == 1) {
+                item.files = items[members[0]].files;
+            } else {
+                rewritten_bytes += item.bytes;
+            }
+            next_items.push_back(item);
+        }
+        plan->AddLevel(groups);
+        items.swap(next_items);
+    }
+    plan->SetRewrittenBytes(rewritten_bytes);
+}
+
+void PlanUniformMerge(int32_t n_inputs, int32_t group_size, MergePlan* plan) {
+    assert(plan && group_size > 0);
+    plan->Reset(n_inputs);
+    std::vector<std::vector<int32_t> > groups;
+    for (int32_t i = 0; i < n_inputs; i++) {
+        if (i % group_size == 0) {
+            groups.push_back(std::vector<int32_t>());
+        }
+        groups.back().push_back(i);
+    }
+    plan->AddLevel(groups);
+}
+
+}
+}
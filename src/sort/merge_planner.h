@@ -0,0 +1,77 @@
+#ifndef _BAIDU_SHUTTLE_SORT_MERGE_PLANNER_H_
+#define _BAIDU_SHUTTLE_SORT_MERGE_PLANNER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace baidu {
+namespace shuttle {
+
+// the output of one map task, which may have been spilled to several files
+struct MergeInput {
+    int32_t files;
+    int64_t bytes;
+    MergeInput() : files(0), bytes(0) { }
+    MergeInput(int32_t f, int64_t b) : files(f), bytes(b) { }
+};
+
+struct MergeBudget {
+    // files the final merge of a reduce task may keep open
+    int32_t final_fan_in;
+    // files one intermediate merge may keep open
+    int32_t merge_fan_in;
+    // bytes a reduce task may buffer in memory, read map by map
+    // if its files are too many for the final merge
+    int64_t memory_bytes;
+    MergeBudget() : final_fan_in(0), merge_fan_in(0), memory_bytes(0) { }
+};
+
+// a merge tree: level 0 merges groups of map outputs into tuo files,
+// level i merges groups of the items of level i - 1. a group of one item
+// is passed through as it is, without being read or written.
+// the items of the last level are what the reduce tasks merge at the end
+class MergePlan {
+public:
+    MergePlan();
+    int32_t Passes() const;
+    int32_t Inputs() const;
+    int32_t Groups(int32_t level) const;
+    const std::vector<int32_t>& Members(int32_t level, int32_t group) const;
+    bool PassThrough(int32_t level, int32_t group) const;
+    // the group of level + 1 taking this group, -1 for the last level
+    int32_t Parent(int32_t level, int32_t group) const;
+    int32_t MaxFanIn(int32_t level) const;
+    int64_t RewrittenBytes() const;
+    // reduce tasks whose records fit in memory, they read the sort files
+    // of the maps without the plan, so the files are kept until they are done
+    const std::vector<int32_t>& FastReduces() const;
+
+    void Reset(int32_t n_inputs);
+    void AddLevel(const std::vector<std::vector<int32_t> >& groups);
+    void SetRewrittenBytes(int64_t bytes);
+    void SetFastReduces(const std::vector<int32_t>& reduces);
+
+    // text form shared by the reduce tasks through the shuffle work dir
+    std::string ToString() const;
+    bool FromString(const std::string& text);
+private:
+    int32_t n_inputs_;
+    int64_t rewritten_bytes_;
+    std::vector<std::vector<std::vector<int32_t> > > levels_;
+    std::vector<std::vector<int32_t> > parents_;
+    std::vector<int32_t> fast_reduces_;
+};
+
+// plans the fewest bytes to be rewritten, so that no merge opens more files
+// than the budget allows: full levels while the inputs are too many for two
+// passes, then a level merging only the smallest items that are needed
+void PlanMerge(const std::vector<MergeInput>& inputs,
+               const MergeBudget& budget, MergePlan* plan);
+
+// one level of consecutive groups, as many maps as group_size in each
+void PlanUniformMerge(int32_t n_inputs, int32_t group_size, MergePlan* plan);
+
+}
+}
+#endif
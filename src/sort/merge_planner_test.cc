@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "merge_planner.h"
+
+using namespace baidu::shuttle;
+
+static int64_t FinalFiles(const MergePlan& plan, const std::vector<MergeInput>& inputs) {
+    std::vector<MergeInput> items(inputs);
+    for (int level = 0; level < plan.Passes(); level++) {
+        std::vector<MergeInput> next_items;
+        for (int g = 0; g < plan.Groups(level); g++) {
+            const std::vector<int32_t>& members = plan.Members(level, g);
+            int32_t files = 0;
+            for (size_t i = 0; i < members.size(); i++) {
+                files += items[members[i]].files;
+            }
+            next_items.push_back(MergeInput(plan.PassThrough(level, g) ? files : 1, 0));
+        }
+        items.swap(next_items);
+    }
+    int64_t files = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        files += items[i].files;
+    }
+    return files;
+}
+
+TEST(MergePlanner, NoMergeInBudget) {
+    std::vector<MergeInput> inputs(100, MergeInput(1, 1000));
+    MergeBudget budget;
+    budget.final_fan_in = 100;
+    budget.merge_fan_in = 50;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    EXPECT_EQ(plan.Passes(), 0);
+    EXPECT_EQ(plan.Inputs(), 100);
+    EXPECT_EQ(plan.RewrittenBytes(), 0);
+}
+
+TEST(MergePlanner, MemoryLeftToReduceTasks) {
+    std::vector<MergeInput> inputs(200, MergeInput(1, 1000));
+    MergeBudget budget;
+    budget.final_fan_in = 100;
+    budget.merge_fan_in = 50;
+    //whether its records fit in memory is up to each reduce task,
+    //the shared plan is for those they do not fit
+    budget.memory_bytes = 1000000;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    EXPECT_GT(plan.Passes(), 0);
+    EXPECT_LE(FinalFiles(plan, inputs), 100);
+}
+
+TEST(MergePlanner, MergeSmallestOnly) {
+    std::vector<MergeInput> inputs;
+    for (int i = 0; i < 110; i++) {
+        inputs.push_back(MergeInput(1, (110 - i) * 1000));
+    }
+    MergeBudget budget;
+    budget.final_fan_in = 100;
+    budget.merge_fan_in = 50;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    EXPECT_EQ(plan.Passes(), 1);
+    EXPECT_EQ(FinalFiles(plan, inputs), 100);
+    //the 11 smallest maps are the last ones
+    const std::vector<int32_t>& members = plan.Members(0, 0);
+    EXPECT_EQ(members.size(), 11u);
+    for (size_t i = 0; i < members.size(); i++) {
+        EXPECT_GE(members[i], 99);
+        EXPECT_TRUE(plan.PassThrough(0, i + 1));
+    }
+    EXPECT_EQ(plan.RewrittenBytes(), 66000);
+}
+
+TEST(MergePlanner, SpilledMapsCountFiles) {
+    std::vector<MergeInput> inputs(40, MergeInput(3, 1000));
+    MergeBudget budget;
+    budget.final_fan_in = 100;
+    budget.merge_fan_in = 10;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    EXPECT_EQ(plan.Passes(), 1);
+    EXPECT_LE(FinalFiles(plan, inputs), 100);
+    for (int g = 0; g < plan.Groups(0); g++) {
+        EXPECT_LE(plan.Members(0, g).size(), 3u);
+    }
+}
+
+TEST(MergePlanner, MultiPass) {
+    std::vector<MergeInput> inputs;
+    for (int i = 0; i < 10000; i++) {
+        inputs.push_back(MergeInput(1 + i % 2, 1000 + i % 7 * 100));
+    }
+    MergeBudget budget;
+    budget.final_fan_in = 20;
+    budget.merge_fan_in = 20;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    EXPECT_EQ(plan.Passes(), 3);
+    EXPECT_LE(FinalFiles(plan, inputs), 20);
+    for (int level = 0; level < plan.Passes(); level++) {
+        EXPECT_LE(plan.MaxFanIn(level), 20);
+        for (int g = 0; g < plan.Groups(level); g++) {
+            int parent = plan.Parent(level, g);
+            if (level + 1 < plan.Passes()) {
+                ASSERT_GE(parent, 0);
+                const std::vector<int32_t>& members = plan.Members(level + 1, parent);
+                EXPECT_TRUE(std::find(members.begin(), members.end(), g) != members.end());
+            } else {
+                EXPECT_EQ(parent, -1);
+            }
+        }
+    }
+}
+
+TEST(MergePlanner, Uniform) {
+    MergePlan plan;
+    PlanUniformMerge(25, 10, &plan);
+    EXPECT_EQ(plan.Passes(), 1);
+    EXPECT_EQ(plan.Groups(0), 3);
+    EXPECT_EQ(plan.Members(0, 1)[0], 10);
+    EXPECT_EQ(plan.Members(0, 2).size(), 5u);
+}
+
+TEST(MergePlanner, Text) {
+    std::vector<MergeInput> inputs;
+    for (int i = 0; i < 500; i++) {
+        inputs.push_back(MergeInput(1, i * 10));
+    }
+    MergeBudget budget;
+    budget.final_fan_in = 16;
+    budget.merge_fan_in = 32;
+    MergePlan plan;
+    PlanMerge(inputs, budget, &plan);
+    std::string text = plan.ToString();
+    MergePlan loaded;
+    EXPECT_TRUE(loaded.FromString(text));
+    EXPECT_EQ(loaded.ToString(), text);
+    EXPECT_EQ(loaded.Passes(), plan.Passes());
+    EXPECT_EQ(loaded.RewrittenBytes(), plan.RewrittenBytes());
+    EXPECT_FALSE(loaded.FromString(text.substr(0, text.size() - 5)));
+    EXPECT_FALSE(loaded.FromString("merge_plan 2 1 0\n0,0\nend\n"));
+    EXPECT_FALSE(loaded.FromString("merge_plan 3 1 0\n0,1\nend\n"));
+    EXPECT_TRUE(loaded.FromString("merge_plan 3 1 0\n0,1 2\nend\n"));
+    EXPECT_TRUE(loaded.PassThrough(0, 1));
+    EXPECT_TRUE(loaded.FastReduces().empty());
+    std::vector<int32_t> fast_reduces;
+    fast_reduces.push_back(0);
+    fast_reduces.push_back(7);
+    plan.SetFastReduces(fast_reduces);
+    text = plan.ToString();
+    EXPECT_TRUE(loaded.FromString(text));
+    EXPECT_EQ(loaded.ToString(), text);
+    EXPECT_EQ(loaded.FastReduces(), fast_reduces);
+    EXPECT_FALSE(loaded.FromString("merge_plan 3 1 0\n0,1 2\nfast \nend\n"));
+    EXPECT_FALSE(loaded.FromString("merge_plan 3 1 0\n0,1 2\nfast 1\n"));
+}
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
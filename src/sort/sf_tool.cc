@@ -1,19 +1,34 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <string>
 #include <iostream>
+#include <queue>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <gflags/gflags.h>
 #include "sort_file.h"
 #include "logging.h"
+#include "timer.h"
+#include "common/compressor.h"
 #include "common/tools_util.h"
 
-DEFINE_string(mode, "read", "work mode: read/write/seek");
+DEFINE_string(mode, "read", "work mode: read/write/seek/bench/scan_bench/merge_bench");
 DEFINE_string(file, "", "file path, use ',' to seperate multiple files");
 DEFINE_string(start, "", "start key, in 'read' mode");
 DEFINE_string(end, "", "end key, in 'read' mode");
-DEFINE_string(fs, "hdfs", "filesytem: 'hdfs' or 'local' ");
+DEFINE_string(fs, "hdfs", "filesytem: 'hdfs', 'local' or 'mmap'(local files mapped into memory) ");
 DEFINE_string(replica, "3", "the replication number on dfs");
+DEFINE_int32(partition, -1, "only read records of this partition, in 'read' mode");
+DEFINE_int32(bloom_bits_per_key, 0, "bits per key of the bloom filter, in 'write' mode, 0 means no filter");
+DEFINE_int32(compress_threads, 0, "threads compressing blocks in background, in 'write' and 'bench' mode");
+DEFINE_int32(read_ahead_blocks, 0, "blocks prefetched in background, in 'read' mode");
+DEFINE_string(codecs, "snappy,lz4,zstd,none", "codecs to compare, in 'bench' mode");
+DEFINE_string(bench_dir, "/tmp", "local dir for temporary files, in 'bench' mode");
+DEFINE_int32(bench_size, 256, "MB of records loaded from -file, in 'bench' mode");
+DEFINE_int32(bench_rounds, 3, "rounds per reader or merge, in 'scan_bench' and 'merge_bench' mode");
+DEFINE_string(fan_ins, "10,100,1000", "numbers of merged runs to compare, in 'merge_bench' mode");
+DEFINE_int32(merge_records, 2000000, "records in all runs, in 'merge_bench' mode");
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -34,12 +49,20 @@ void DoRead() {
     }
     MergeFileReader* reader = new MergeFileReader();
     FileSystem::Param param; //TODO
+    if (FLAGS_read_ahead_blocks > 0) {
+        param["read_ahead_blocks"] = boost::lexical_cast<std::string>(FLAGS_read_ahead_blocks);
+    }
     Status status = reader->Open(file_names, param, g_file_type);
     if (status != kOk) {
         std::cerr << "fail to open: " << reader->GetErrorFile() << std::endl;
         exit(-1);
     }
-    SortFileReader::Iterator* it = reader->Scan(FLAGS_start, FLAGS_end);
+    SortFileReader::Iterator* it = NULL;
+    if (FLAGS_partition >= 0) {
+        it = reader->ScanPartition(FLAGS_partition);
+    } else {
+        it = reader->Scan(FLAGS_start, FLAGS_end);
+    }
     if (it->Error() != kOk && it->Error() != kNoMore) {
         std::cerr << "fail top scan: " << reader->GetErrorFile() 
                   << ", " << Status_Name(it->Error()) << std::endl;
@@ -62,6 +85,8 @@ void DoRead() {
         exit(-2);
     }
     delete it;
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
     status = reader->Close();
     if (status != kOk) {
         std::cerr << "fail to close: " 
@@ -69,6 +94,9 @@ void DoRead() {
                   << Status_Name(status) << std::endl;
         exit(-1);
     }
+    std::cerr << "blocks decoded: " << stat.blocks_decoded
+              << ", skipped: " << stat.blocks_skipped
+              << ", stall: " << stat.stall_micros << " us" << std::endl;
     std::cerr << "== Read Done ==" << std::endl;
     return;
 }
@@ -86,6 +114,12 @@ void DoWrite() {
     }
     FileSystem::Param param;
     param["replica"] = std::string(FLAGS_replica);
+    if (FLAGS_bloom_bits_per_key > 0) {
+        param["bloom_bits_per_key"] = boost::lexical_cast<std::string>(FLAGS_bloom_bits_per_key);
+    }
+    if (FLAGS_compress_threads > 0) {
+        param["compress_threads"] = boost::lexical_cast<std::string>(FLAGS_compress_threads);
+    }
     status = writer->Open(FLAGS_file, param);
     if (status != kOk) {
         std::cerr << "fail to open for write:" << FLAGS_file << std::endl;
@@ -156,7 +190,9 @@ void DoSeek() {
             line.erase(line.size() - 1);
         }
         std::string key = line.substr(0, span);
-        SortFileReader::Iterator* it = reader->Scan(key, key + "\1");
+        std::string end_key = key;
+        end_key.push_back('\0'); //exactly the key, the bloom filter works for it
+        SortFileReader::Iterator* it = reader->Scan(key, end_key);
         if (it->Error() != kOk && it->Error() != kNoMore) {
             std::cerr << "fail top scan: " << FLAGS_file 
                       << ", " << Status_Name(it->Error()) << std::endl;
@@ -179,14 +215,339 @@ void DoSeek() {
         } 
         delete it;
     }
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
     status = reader->Close();
     if (status != kOk) {
         std::cerr << "fail to close: " << FLAGS_file << std::endl;
         exit(-1);
     }
+    std::cerr << "blocks decoded: " << stat.blocks_decoded
+              << ", skipped: " << stat.blocks_skipped
+              << ", filtered: " << stat.filtered << std::endl;
     std::cerr << "== Seek Done ==" << std::endl;
 }
 
+static double Throughput(int64_t bytes, int64_t micros) {
+    if (micros <= 0) {
+        micros = 1;
+    }
+    return (double)bytes / micros * 1000000 / (1 << 20);
+}
+
+void DoBench() {
+    std::vector<std::string> file_names;
+    boost::split(file_names, FLAGS_file,
+                 boost::is_any_of(","), boost::token_compress_on);
+    if (file_names.size() == 0 || FLAGS_file.empty()) {
+        std::cerr << "use -file to specify input files" << std::endl;
+        exit(-1);
+    }
+    //load sample records into memory, so that only the codecs are measured
+    MergeFileReader reader;
+    FileSystem::Param param;
+    Status status = reader.Open(file_names, param, g_file_type);
+    if (status != kOk) {
+        std::cerr << "fail to open: " << reader.GetErrorFile() << std::endl;
+        exit(-1);
+    }
+    std::vector<std::pair<std::string, std::string> > records;
+    int64_t raw_bytes = 0;
+    SortFileReader::Iterator* it = reader.Scan("", "");
+    while (!it->Done() && raw_bytes < ((int64_t)FLAGS_bench_size << 20)) {
+        records.push_back(std::make_pair(it->Key().ToString(), it->Value().ToString()));
+        raw_bytes += it->Key().size() + it->Value().size();
+        it->Next();
+    }
+    if (it->Error() != kOk && it->Error() != kNoMore) {
+        std::cerr << "error happen in reading: " << reader.GetErrorFile()
+                  << Status_Name(it->Error()) << std::endl;
+        exit(-2);
+    }
+    delete it;
+    reader.Close();
+    std::cerr << "loaded " << records.size() << " records, "
+              << raw_bytes << " bytes" << std::endl;
+
+    std::vector<std::string> codecs;
+    boost::split(codecs, FLAGS_codecs,
+                 boost::is_any_of(","), boost::token_compress_on);
+    printf("%-8s %12s %8s %14s %14s\n", "codec", "file bytes", "ratio",
+           "write MB/s", "read MB/s");
+    std::vector<std::string>::iterator jt;
+    for (jt = codecs.begin(); jt != codecs.end(); jt++) {
+        const std::string& codec = *jt;
+        CompressionType type;
+        if (!Compressor::ParseName(codec, &type)) {
+            std::cerr << "unknown codec: " << codec << std::endl;
+            exit(-1);
+        }
+        std::string bench_file = FLAGS_bench_dir + "/sf_bench." + codec;
+        SortFileWriter* writer = SortFileWriter::Create(kLocalFile, &status);
+        FileSystem::Param param_write;
+        param_write["compression"] = codec;
+        if (FLAGS_compress_threads > 0) {
+            param_write["compress_threads"] = boost::lexical_cast<std::string>(FLAGS_compress_threads);
+        }
+        int64_t start = baidu::common::timer::get_micros();
+        status = writer->Open(bench_file, param_write);
+        for (size_t i = 0; i < records.size() && status == kOk; i++) {
+            status = writer->Put(records[i].first, records[i].second);
+        }
+        if (status == kOk) {
+            status = writer->Close();
+        }
+        int64_t write_micros = baidu::common::timer::get_micros() - start;
+        delete writer;
+        if (status != kOk) {
+            std::cerr << "fail to write: " << bench_file << ", "
+                      << Status_Name(status) << std::endl;
+            exit(-1);
+        }
+
+        SortFileReader* bench_reader = SortFileReader::Create(kLocalFile, &status);
+        start = baidu::common::timer::get_micros();
+        status = bench_reader->Open(bench_file, param);
+        int64_t n_read = 0;
+        if (status == kOk) {
+            SortFileReader::Iterator* scan_it = bench_reader->Scan("", "");
+            while (!scan_it->Done()) {
+                n_read += scan_it->Key().size() + scan_it->Value().size();
+                scan_it->Next();
+            }
+            if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+                status = scan_it->Error();
+            }
+            delete scan_it;
+            bench_reader->Close();
+        }
+        int64_t read_micros = baidu::common::timer::get_micros() - start;
+        delete bench_reader;
+        if (status != kOk || n_read != raw_bytes) {
+            std::cerr << "fail to read back: " << bench_file << ", "
+                      << Status_Name(status) << std::endl;
+            exit(-1);
+        }
+
+        FileSystem* fs = FileSystem::CreateLocalFs();
+        fs->Open(bench_file, param, kReadFile);
+        int64_t file_size = fs->GetSize();
+        fs->Close();
+        delete fs;
+        unlink(bench_file.c_str());
+        printf("%-8s %12ld %8.3f %14.1f %14.1f\n", codec.c_str(), file_size,
+               raw_bytes > 0 ? (double)file_size / raw_bytes : 0.0,
+               Throughput(raw_bytes, write_micros), Throughput(raw_bytes, read_micros));
+    }
+    std::cerr << "== Bench Done ==" << std::endl;
+}
+
+static Status ScanFile(FileType file_type, const std::string& file_name,
+                       int64_t* bytes, ReaderStatistics* stat) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(file_type, &status);
+    if (status != kOk) {
+        return status;
+    }
+    FileSystem::Param param;
+    if (FLAGS_read_ahead_blocks > 0) {
+        param["read_ahead_blocks"] = boost::lexical_cast<std::string>(FLAGS_read_ahead_blocks);
+    }
+    status = reader->Open(file_name, param);
+    if (status == kOk) {
+        SortFileReader::Iterator* it = reader->Scan("", "");
+        while (!it->Done()) {
+            *bytes += it->Key().size() + it->Value().size();
+            it->Next();
+        }
+        if (it->Error() != kOk && it->Error() != kNoMore) {
+            status = it->Error();
+        }
+        delete it;
+        reader->GetStatistics(stat);
+        reader->Close();
+    }
+    delete reader;
+    return status;
+}
+
+void DoScanBench() {
+    if (FLAGS_file.empty()) {
+        std::cerr << "use -file to specify a local input file" << std::endl;
+        exit(-1);
+    }
+    //rounds of the two readers interleave, so both see a similar page cache
+    const FileType types[] = {kLocalFile, kLocalMmapFile};
+    const char* names[] = {"read", "mmap"};
+    int64_t micros[] = {0, 0};
+    int64_t bytes[] = {0, 0};
+    ReaderStatistics stats[2];
+    for (int round = 0; round < FLAGS_bench_rounds; round++) {
+        for (int i = 0; i < 2; i++) {
+            int64_t start = baidu::common::timer::get_micros();
+            Status status = ScanFile(types[i], FLAGS_file, &bytes[i], &stats[i]);
+            micros[i] += baidu::common::timer::get_micros() - start;
+            if (status != kOk) {
+                std::cerr << "fail to scan: " << FLAGS_file << " by " << names[i]
+                          << ", " << Status_Name(status) << std::endl;
+                exit(-1);
+            }
+        }
+    }
+    if (bytes[0] != bytes[1]) {
+        std::cerr << "readers disagree: " << bytes[0] << " vs " << bytes[1] << std::endl;
+        exit(-1);
+    }
+    printf("%-8s %14s %14s %12s\n", "reader", "record bytes", "MB/s", "blocks");
+    for (int i = 0; i < 2; i++) {
+        printf("%-8s %14ld %14.1f %12ld\n", names[i], bytes[i] / FLAGS_bench_rounds,
+               Throughput(bytes[i], micros[i]), stats[i].blocks_decoded);
+    }
+    std::cerr << "== Scan Bench Done ==" << std::endl;
+}
+
+typedef std::vector<std::pair<std::string, std::string> > MemRun;
+
+// iterates a sorted run in memory, so that only the merge is measured
+class MemIterator : public SortFileReader::Iterator {
+public:
+    MemIterator(const MemRun* run) : run_(run), pos_(0) { }
+    bool Done() { return pos_ >= run_->size(); }
+    void Next() { pos_++; }
+    Slice Key() { return Slice((*run_)[pos_].first); }
+    Slice Value() { return Slice((*run_)[pos_].second); }
+    Status Error() { return Done() ? kNoMore : kOk; }
+    const std::string GetFileName() { return ""; }
+private:
+    const MemRun* run_;
+    size_t pos_;
+};
+
+// the former merge: a binary heap of records copied out of the runs
+class HeapMergeIterator : public SortFileReader::Iterator {
+public:
+    HeapMergeIterator(const std::vector<SortFileReader::Iterator*>& iters) : iters_(iters) {
+        for (size_t i = 0; i < iters_.size(); i++) {
+            if (!iters_[i]->Done()) {
+                queue_.push(HeapItem(iters_[i]->Key(), iters_[i]->Value(), i));
+            }
+        }
+        if (!queue_.empty()) {
+            key_ = queue_.top().key_;
+            value_ = queue_.top().value_;
+        }
+    }
+    virtual ~HeapMergeIterator() {
+        for (size_t i = 0; i < iters_.size(); i++) {
+            delete iters_[i];
+        }
+    }
+    bool Done() { return queue_.empty(); }
+    void Next() {
+        int offset = queue_.top().it_offset_;
+        SortFileReader::Iterator* it = iters_[offset];
+        it->Next();
+        queue_.pop();
+        if (!it->Done()) {
+            queue_.push(HeapItem(it->Key(), it->Value(), offset));
+        }
+        if (!queue_.empty()) {
+            key_ = queue_.top().key_;
+            value_ = queue_.top().value_;
+        }
+    }
+    Slice Key() { return key_; }
+    Slice Value() { return value_; }
+    Status Error() { return kOk; }
+    const std::string GetFileName() { return ""; }
+private:
+    struct HeapItem {
+        std::string key_;
+        std::string value_;
+        int it_offset_;
+        HeapItem(const Slice& key, const Slice& value, int it_offset)
+            : key_(key.data(), key.size()), value_(value.data(), value.size()),
+              it_offset_(it_offset) { }
+        bool operator<(const HeapItem& other) const {
+            return key_ > other.key_;
+        }
+    };
+    std::vector<SortFileReader::Iterator*> iters_;
+    std::priority_queue<HeapItem> queue_;
+    std::string key_;
+    std::string value_;
+};
+
+static int64_t MergeRuns(SortFileReader::Iterator* it, int64_t* records, int64_t* bytes) {
+    int64_t start = baidu::common::timer::get_micros();
+    while (!it->Done()) {
+        *bytes += it->Key().size() + it->Value().size();
+        (*records)++;
+        it->Next();
+    }
+    int64_t micros = baidu::common::timer::get_micros() - start;
+    delete it;
+    return micros;
+}
+
+void DoMergeBench() {
+    std::vector<std::string> fan_ins;
+    boost::split(fan_ins, FLAGS_fan_ins,
+                 boost::is_any_of(","), boost::token_compress_on);
+    printf("%-8s %12s %14s %14s %8s\n", "fan-in", "records",
+           "heap rec/s", "tree rec/s", "speedup");
+    std::vector<std::string>::iterator jt;
+    for (jt = fan_ins.begin(); jt != fan_ins.end(); jt++) {
+        int fan_in = atoi(jt->c_str());
+        if (fan_in <= 0) {
+            std::cerr << "bad fan-in: " << *jt << std::endl;
+            exit(-1);
+        }
+        //keys look like map output: a partition prefix and a short key
+        std::vector<MemRun> runs(fan_in);
+        char key[64];
+        char value[64];
+        srand(fan_in);
+        for (int i = 0; i < FLAGS_merge_records; i++) {
+            snprintf(key, sizeof(key), "%04d_key_%012d", rand() % 100, rand());
+            snprintf(value, sizeof(value), "value_%d", i);
+            runs[i % fan_in].push_back(std::make_pair(std::string(key), std::string(value)));
+        }
+        for (int i = 0; i < fan_in; i++) {
+            std::sort(runs[i].begin(), runs[i].end());
+            //copy in order to lay out the records sequentially, like a decoded block
+            MemRun packed(runs[i].begin(), runs[i].end());
+            runs[i].swap(packed);
+        }
+        int64_t micros[] = {0, 0};
+        int64_t records[] = {0, 0};
+        int64_t bytes[] = {0, 0};
+        for (int round = 0; round < FLAGS_bench_rounds; round++) {
+            std::vector<SortFileReader::Iterator*> iters;
+            for (int i = 0; i < fan_in; i++) {
+                iters.push_back(new MemIterator(&runs[i]));
+            }
+            micros[0] += MergeRuns(new HeapMergeIterator(iters), &records[0], &bytes[0]);
+            iters.clear();
+            for (int i = 0; i < fan_in; i++) {
+                iters.push_back(new MemIterator(&runs[i]));
+            }
+            MergeFileReader reader;
+            micros[1] += MergeRuns(new MergeFileReader::MergeIterator(iters, &reader),
+                                   &records[1], &bytes[1]);
+        }
+        if (records[0] != records[1] || bytes[0] != bytes[1]) {
+            std::cerr << "merges disagree: " << records[0] << " vs " << records[1] << std::endl;
+            exit(-1);
+        }
+        double heap_rate = (double)records[0] / (micros[0] > 0 ? micros[0] : 1) * 1000000;
+        double tree_rate = (double)records[1] / (micros[1] > 0 ? micros[1] : 1) * 1000000;
+        printf("%-8d %12ld %14.0f %14.0f %8.2f\n", fan_in, records[0] / FLAGS_bench_rounds,
+               heap_rate, tree_rate, heap_rate > 0 ? tree_rate / heap_rate : 0.0);
+    }
+    std::cerr << "== Merge Bench Done ==" << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     baidu::common::SetLogFile(GetLogName("./sf_tool.log").c_str());
     baidu::common::SetWarningFile(GetLogName("./sf_tool.log.wf").c_str());
@@ -195,6 +556,8 @@ int main(int argc, char* argv[]) {
         g_file_type = kHdfsFile;
     } else if (FLAGS_fs == "local") {
         g_file_type = kLocalFile;
+    } else if (FLAGS_fs == "mmap") {
+        g_file_type = kLocalMmapFile;
     } else {
         std::cerr << "unkonw file type: " << FLAGS_fs << std::endl;
         return -1;
@@ -205,6 +568,12 @@ int main(int argc, char* argv[]) {
         DoWrite();
     } else if (FLAGS_mode == "seek") {
         DoSeek();
+    } else if (FLAGS_mode == "bench") {
+        DoBench();
+    } else if (FLAGS_mode == "scan_bench") {
+        DoScanBench();
+    } else if (FLAGS_mode == "merge_bench") {
+        DoMergeBench();
     } else {
         std::cerr << "unkown work mode:" << FLAGS_mode << std::endl;
         return 1;
@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <math.h>
 #include <string>
 #include <unistd.h>
@@ -12,24 +14,46 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <sys/resource.h>
 #include "sort_file.h"
+#include "merge_planner.h"
+#include "spill_buffer.h"
+#include "proto/app_master.pb.h"
 #include "logging.h"
 #include "common/filesystem.h"
 #include "common/tools_util.h"
+#include "common/rpc_client.h"
+#include "common/io_permit.h"
 #include "thread_pool.h"
 #include "mutex.h"
 
 DEFINE_int32(total, 0, "total numbers of map tasks");
 DEFINE_int32(reduce_no, 0, "the reduce number of this reduce task");
 DEFINE_string(work_dir, "/tmp", "the shuffle work dir");
+DEFINE_string(fs, "hdfs", "filesystem of the shuffle work dir: hdfs/nfs");
 DEFINE_int32(attempt_id, 0, "the attempt_id of this reduce task");
 DEFINE_string(dfs_host, "", "host name of dfs master");
 DEFINE_string(dfs_port, "", "port of dfs master");
 DEFINE_string(dfs_user, "", "user name of dfs master");
 DEFINE_string(dfs_password, "", "password of dfs master");
 DEFINE_string(pipe, "streaming", "pipe style: streaming/bistreaming");
-DEFINE_int32(tuo_size, 0, "one tuo contains how many maps'output");
-DEFINE_int32(slow_start_no, 200, "if redcue_no greater than this, sleep a random time");
+DEFINE_int32(tuo_size, 0, "one tuo contains how many maps'output, 0 means planned by sizes and budget");
+DEFINE_string(compression, "snappy", "codec of merged tuo files: snappy/lz4/zstd/none");
+DEFINE_int32(compress_threads, 2, "threads compressing blocks of merged tuo files, 0 means compress inline");
+DEFINE_int32(merge_threads, 1, "threads merging disjoint key ranges of a tuo, 1 means merge on one thread");
+DEFINE_string(merge_combiner, "", "combiner collapsing records of a key while merging tuo files: sum, empty means none");
+DEFINE_int32(merge_parallelism, 16, "threads opening and closing the files of a merge");
+DEFINE_int32(read_ahead_blocks, 0, "blocks prefetched in background per map output, 0 means disable");
+DEFINE_int64(memory_limit, 0, "memory limit of this reduce task in KB, 0 means unlimited");
+DEFINE_int32(merge_memory_percent, 50, "percent of the memory limit the merge readers may take");
+DEFINE_int32(max_open_files, 0, "files a merge may keep open, 0 means half of the open files limit");
+DEFINE_string(master_endpoint, "", "master handing out tuo merges, empty means coordinating through the work dir");
+DEFINE_string(jobid, "", "id of the job, to talk with master");
+DEFINE_bool(local_shuffle, false, "fetch the records of this reduce task from maps as they are done into memory, spilled and merged on local disk");
+DEFINE_string(local_dir, "./shuffle_local", "local dir keeping the records fetched by a local shuffle");
+DEFINE_string(push_dir, "", "local dir keeping the records maps pushed to this reduce task, empty if they push nothing");
+DEFINE_int32(shuffle_buffer_percent, 30, "percent of the memory limit buffering the records fetched by a local shuffle");
+DEFINE_int32(slow_start_no, 200, "if redcue_no greater than this and no master paces the io, sleep a random time");
 
 using baidu::common::Log;
 using baidu::common::FATAL;
@@ -40,6 +64,36 @@ using namespace baidu::shuttle;
 
 int32_t g_file_no(0);
 FileSystem* g_fs(NULL);
+FileType g_file_type(kHdfsFile);
+CombineFunc g_combiner;
+MergePlan g_plan;
+RpcClient* g_rpc_client(NULL);
+Master_Stub* g_master(NULL);
+//spill files of the maps done, as reported to master
+std::map<int, MapOutput> g_map_outputs;
+//maps done whose outputs master does not know
+int32_t g_unknown_outputs(0);
+//bytes of each reduce task in the outputs master knows
+std::vector<int64_t> g_reduce_bytes;
+//g_map_outputs is refreshed by the rounds looking for maps done,
+//a map missing from it is not asked for on its own
+bool g_outputs_fetched(false);
+FileSystem* g_local_fs(NULL);
+
+//reduce tasks listing the map outputs to plan the merge, the others wait for the plan
+const static int sPlanners = 3;
+const static int32_t sDefaultMaxOpenFiles = 1000;
+//a reader holds the buffer of its stream, a raw and a compressed block
+const static int64_t sStreamMemory = (1 << 20);
+const static int64_t sBlockMemory = (128 << 10);
+//seconds master holds a wait for tuo
+const static int sTuoWaitSeconds = 10;
+//seconds before calling a master not reachable again
+const static int sTuoRetrySeconds = 5;
+//seconds between two looks for maps done by a local shuffle
+const static int sFetchIntervalSeconds = 5;
+//records fetched by a local shuffle are spilled once they take this much, if no memory limit
+const static int64_t sDefaultShuffleBuffer = (256 << 20);
 
 void FillParam(FileSystem::Param& param) {
     if (!FLAGS_dfs_user.empty()) {
@@ -56,6 +110,34 @@ void FillParam(FileSystem::Param& param) {
     }
 }
 
+void FillReadAheadParam(FileSystem::Param& param) {
+    if (FLAGS_read_ahead_blocks > 0) {
+        std::stringstream ss;
+        ss << FLAGS_read_ahead_blocks;
+        param["read_ahead_blocks"] = ss.str();
+    }
+}
+
+void FillMergeParam(FileSystem::Param& param) {
+    std::stringstream ss;
+    ss << FLAGS_merge_parallelism;
+    param["merge_parallelism"] = ss.str();
+}
+
+// opens the files of a merge holding an io permit of the dfs cluster,
+// so that reduce tasks starting together do not open theirs at once
+Status OpenMergeFiles(MergeFileReader* reader, const std::vector<std::string>& file_names,
+                      FileSystem::Param& param, FileType file_type) {
+    if (file_type != kHdfsFile || g_master == NULL) {
+        return reader->Open(file_names, param, file_type);
+    }
+    std::stringstream ss;
+    ss << FLAGS_jobid << "_reduce_" << FLAGS_reduce_no << "_" << FLAGS_attempt_id;
+    IoPermit permit(g_rpc_client, g_master, FLAGS_dfs_host, ss.str());
+    permit.Acquire();
+    return reader->Open(file_names, param, file_type);
+}
+
 bool AddSortFiles(const std::string map_dir, std::vector<std::string>* file_names) {
     assert(file_names);
     std::vector<FileInfo> sort_files;
@@ -74,25 +156,95 @@ bool AddSortFiles(const std::string map_dir, std::vector<std::string>* file_name
     }
 }
 
-bool MergeManyFilesToOne(const std::vector<std::string>& file_names,
-                         const std::string& output_file) {
+void FillWriteParam(FileSystem::Param& param_write, int32_t compress_threads) {
+    FillParam(param_write);
+    param_write["compression"] = FLAGS_compression;
+    param_write["partitioned"] = "true";
+    if (compress_threads > 0) {
+        std::stringstream ss;
+        ss << compress_threads;
+        param_write["compress_threads"] = ss.str();
+    }
+}
+
+static Status PutSum(SortFileWriter* writer, const Slice& key,
+                     const std::string& prefix, int64_t sum) {
+    std::stringstream ss;
+    ss << prefix << "\t" << sum;
+    return writer->Put(key, ss.str());
+}
+
+// streaming lines ending with a count after the last tab are summed up,
+// if they are equal but the count, other lines are kept as they are
+Status SumCombine(const Slice& key, GroupIterator::ValueIterator* values,
+                  SortFileWriter* writer) {
+    std::string prefix;
+    int64_t sum = 0;
+    bool summing = false;
+    Status status = kOk;
+    for (; !values->Done() && status == kOk; values->Next()) {
+        Slice line = values->Value();
+        const char* tab = (const char*)memrchr(line.data(), '\t', line.size());
+        bool is_count = false;
+        int64_t count = 0;
+        if (tab != NULL && tab + 1 < line.data() + line.size()) {
+            std::string field(tab + 1, line.data() + line.size() - tab - 1);
+            char* end = NULL;
+            errno = 0;
+            count = strtoll(field.c_str(), &end, 10);
+            is_count = (errno == 0 && *end == '\0');
+        }
+        Slice line_prefix = is_count ? Slice(line.data(), tab - line.data()) : Slice();
+        if (summing && (!is_count || line_prefix != Slice(prefix))) {
+            status = PutSum(writer, key, prefix, sum);
+            summing = false;
+        }
+        if (status != kOk) {
+            break;
+        }
+        if (!is_count) {
+            status = writer->Put(key, line);
+            continue;
+        }
+        if (!summing) {
+            prefix.assign(line_prefix.data(), line_prefix.size());
+            sum = 0;
+            summing = true;
+        }
+        sum += count;
+    }
+    if (summing && status == kOk) {
+        status = PutSum(writer, key, prefix, sum);
+    }
+    return status;
+}
+
+bool MergeRangeToOne(const std::vector<std::string>& file_names,
+                     FileType input_type,
+                     const std::string& start_key,
+                     const std::string& end_key,
+                     const std::string& output_file,
+                     FileType output_type,
+                     int32_t compress_threads) {
     MergeFileReader reader;
     FileSystem::Param param;
     FillParam(param);
-    Status status = reader.Open(file_names, param, kHdfsFile);
+    FillReadAheadParam(param);
+    FillMergeParam(param);
+    Status status = OpenMergeFiles(&reader, file_names, param, input_type);
     if (status != kOk) {
         LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
         return false;
     }
 
-    SortFileReader::Iterator* scan_it = reader.Scan("", "");
+    SortFileReader::Iterator* scan_it = reader.Scan(start_key, end_key);
     boost::scoped_ptr<SortFileReader::Iterator> scan_it_guard(scan_it);
 
     if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
         LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
         return false;
     }
-    SortFileWriter* writer = SortFileWriter::Create(kHdfsFile, &status);
+    SortFileWriter* writer = SortFileWriter::Create(output_type, &status);
     boost::scoped_ptr<SortFileWriter> writer_guard(writer);
 
     if (status != kOk) {
@@ -100,27 +252,47 @@ bool MergeManyFilesToOne(const std::vector<std::string>& file_names,
         return false;
     }
     FileSystem::Param param_write;
-    FillParam(param_write);
+    FillWriteParam(param_write, compress_threads);
     status = writer->Open(output_file, param_write);
     if (status != kOk) {
         LOG(WARNING, "fail to open %s for write", output_file.c_str());
         return false;
     }
     int64_t counter = 0;
-    while (!scan_it->Done()) {
-        status = writer->Put(scan_it->Key(), scan_it->Value());
-        if (status != kOk) {
-            LOG(WARNING, "fail to put: %s", output_file.c_str());
-            return false;
-        }
-        counter++;
-        if (counter % 5000 == 0) {
-            LOG(INFO, "have written %lld records to %s",
-                counter, output_file.c_str());
+    if (g_combiner) {
+        GroupIterator groups(scan_it);
+        while (!groups.Done()) {
+            status = g_combiner(groups.Key(), groups.Values(), writer);
+            if (status != kOk) {
+                LOG(WARNING, "fail to combine: %s", output_file.c_str());
+                return false;
+            }
+            counter++;
+            if (counter % 5000 == 0) {
+                LOG(INFO, "have combined %lld keys to %s",
+                    counter, output_file.c_str());
+            }
+            groups.Next();
+            if (groups.Error() != kOk && groups.Error() != kNoMore) {
+                break;
+            }
         }
-        scan_it->Next();
-        if (scan_it->Error() !=kOk && scan_it->Error() != kNoMore) {
-            break;
+    } else {
+        while (!scan_it->Done()) {
+            status = writer->Put(scan_it->Key(), scan_it->Value());
+            if (status != kOk) {
+                LOG(WARNING, "fail to put: %s", output_file.c_str());
+                return false;
+            }
+            counter++;
+            if (counter % 5000 == 0) {
+                LOG(INFO, "have written %lld records to %s",
+                    counter, output_file.c_str());
+            }
+            scan_it->Next();
+            if (scan_it->Error() !=kOk && scan_it->Error() != kNoMore) {
+                break;
+            }
         }
     }
     
@@ -139,32 +311,151 @@ bool MergeManyFilesToOne(const std::vector<std::string>& file_names,
         LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
         return false;
     }
-    LOG(INFO, "totally written %lld records to %s",
-        counter, output_file.c_str());
+    LOG(INFO, "totally written %lld %s to %s",
+        counter, g_combiner ? "keys" : "records", output_file.c_str());
+    return true;
+}
+
+// picks keys cutting the records of the files into ranges of similar bytes,
+// fewer keys come back if the files are too small to be cut
+bool SampleSplitKeys(const std::vector<std::string>& file_names, int n_ranges,
+                     std::vector<std::string>* split_keys) {
+    MergeFileReader reader;
+    FileSystem::Param param;
+    FillParam(param);
+    FillMergeParam(param);
+    Status status = OpenMergeFiles(&reader, file_names, param, g_file_type);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
+        return false;
+    }
+    std::vector<std::string> keys;
+    status = reader.GetIndexKeys(&keys);
+    reader.Close();
+    if (status != kOk) {
+        LOG(WARNING, "fail to get index keys: %s", reader.GetErrorFile().c_str());
+        return false;
+    }
+    for (int i = 1; i < n_ranges && !keys.empty(); i++) {
+        const std::string& key = keys[keys.size() * i / n_ranges];
+        //an empty end key means no end, and ranges must not be empty
+        if (key.empty() || (!split_keys->empty() && key <= split_keys->back())) {
+            continue;
+        }
+        split_keys->push_back(key);
+    }
     return true;
 }
 
-void MergeAndPrint(const std::vector<std::string>& file_names) {
+void MergeRangeTask(const std::vector<std::string>* file_names,
+                    const std::string& start_key,
+                    const std::string& end_key,
+                    const std::string& output_file,
+                    Mutex* mu, int* n_failed) {
+    if (!MergeRangeToOne(*file_names, g_file_type, start_key, end_key,
+                         output_file, g_file_type, 0)) {
+        MutexLock lock(mu);
+        (*n_failed)++;
+    }
+}
+
+bool ConcatToOne(const std::vector<std::string>& segments,
+                 const std::string& output_file) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    boost::scoped_ptr<SortFileWriter> writer_guard(writer);
+    if (status != kOk) {
+        LOG(WARNING, "fail to create writer");
+        return false;
+    }
+    FileSystem::Param param_write;
+    FillWriteParam(param_write, 0);
+    status = writer->Open(output_file, param_write);
+    if (status != kOk) {
+        LOG(WARNING, "fail to open %s for write", output_file.c_str());
+        return false;
+    }
+    FileSystem::Param param;
+    FillParam(param);
+    std::vector<std::string>::const_iterator it;
+    for (it = segments.begin(); it != segments.end(); it++) {
+        status = writer->Append(*it, param, g_file_type);
+        if (status != kOk) {
+            LOG(WARNING, "fail to append %s to %s", it->c_str(), output_file.c_str());
+            return false;
+        }
+    }
+    status = writer->Close();
+    if (status != kOk) {
+        LOG(WARNING, "fail to close writer: %s", output_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// disjoint key ranges are merged by threads into segments,
+// which are concatenated into the output without decoding
+bool ParallelMergeToOne(const std::vector<std::string>& file_names,
+                        const std::string& output_file) {
+    std::vector<std::string> split_keys;
+    if (!SampleSplitKeys(file_names, FLAGS_merge_threads, &split_keys)) {
+        return false;
+    }
+    int n_ranges = split_keys.size() + 1;
+    LOG(INFO, "merge %d files to %s in %d ranges",
+        file_names.size(), output_file.c_str(), n_ranges);
+    std::vector<std::string> segments;
+    Mutex mu;
+    int n_failed = 0;
+    {
+        ThreadPool pool(FLAGS_merge_threads);
+        for (int i = 0; i < n_ranges; i++) {
+            std::stringstream ss;
+            ss << output_file << ".seg_" << i;
+            segments.push_back(ss.str());
+            pool.AddTask(boost::bind(&MergeRangeTask, &file_names,
+                                     i == 0 ? "" : split_keys[i - 1],
+                                     i == n_ranges - 1 ? "" : split_keys[i],
+                                     segments.back(), &mu, &n_failed));
+        }
+        pool.Stop(true);
+    }
+    bool ok = (n_failed == 0 && ConcatToOne(segments, output_file));
+    std::vector<std::string>::iterator it;
+    for (it = segments.begin(); it != segments.end(); it++) {
+        g_fs->Remove(*it);
+    }
+    return ok;
+}
+
+bool MergeManyFilesToOne(const std::vector<std::string>& file_names,
+                         const std::string& output_file) {
+    if (FLAGS_merge_threads > 1) {
+        return ParallelMergeToOne(file_names, output_file);
+    }
+    return MergeRangeToOne(file_names, g_file_type, "", "", output_file,
+                           g_file_type, FLAGS_compress_threads);
+}
+
+void MergeAndPrint(const std::vector<std::string>& file_names, FileType file_type) {
     MergeFileReader reader;
     FileSystem::Param param;
     FillParam(param);
-    Status status = reader.Open(file_names, param, kHdfsFile);
+    FillReadAheadParam(param);
+    FillMergeParam(param);
+    Status status = OpenMergeFiles(&reader, file_names, param, file_type);
     if (status != kOk) {
         LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
         _exit(1);
     }
-    char s_reduce_no[256];
-    snprintf(s_reduce_no, sizeof(s_reduce_no), "%05d", FLAGS_reduce_no);
-    std::string s_reduce_key(s_reduce_no);
-    SortFileReader::Iterator* scan_it = reader.Scan(s_reduce_key,
-                                                    s_reduce_key + "\xff");
+    SortFileReader::Iterator* scan_it = reader.ScanPartition(FLAGS_reduce_no);
     if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
         LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
         _exit(2);
     }
     while (!scan_it->Done()) {
         if (FLAGS_pipe == "streaming") {
-            const std::string& line = scan_it->Value();
+            Slice line = scan_it->Value();
             if (!line.empty()) {
                 std::cout << line << std::endl;
             }
@@ -177,17 +468,203 @@ void MergeAndPrint(const std::vector<std::string>& file_names) {
         LOG(WARNING, "fail to scan: %s", reader.GetErrorFile().c_str());
         _exit(3);
     }
+    ReaderStatistics stat;
+    reader.GetStatistics(&stat);
+    LOG(INFO, "blocks decoded: %ld, skipped: %ld, stall: %ld us, open: %ld us, slowest open: %ld us",
+        stat.blocks_decoded, stat.blocks_skipped, stat.stall_micros,
+        stat.open_micros, stat.max_open_micros);
     reader.Close();
     delete scan_it;
 }
 
-bool MergeOneTuo(int map_from, int map_to, int tuo_now) {
-    std::vector<std::string> file_names;
-    for (int i = map_from; i <= map_to; i++) {
+std::string TuoBaseName(int level, int tuo_no) {
+    std::stringstream ss;
+    if (level > 0) {
+        ss << "l" << level << "_";
+    }
+    ss << tuo_no;
+    return ss.str();
+}
+
+std::string TuoName(int level, int tuo_no) {
+    return FLAGS_work_dir + "/" + TuoBaseName(level, tuo_no) + ".tuo";
+}
+
+// the spill files of the maps done, false if the master can not be reached
+bool FetchMapOutputs() {
+    if (g_master == NULL) {
+        return false;
+    }
+    GetMapOutputsRequest request;
+    GetMapOutputsResponse response;
+    request.set_jobid(FLAGS_jobid);
+    request.set_reduce_no(FLAGS_reduce_no);
+    if (!g_rpc_client->SendRequest(g_master, &Master_Stub::GetMapOutputs,
+                                   &request, &response, 5, 3)
+        || response.status() != kOk) {
+        LOG(WARNING, "fail to get map outputs from master: %s",
+            FLAGS_master_endpoint.c_str());
+        return false;
+    }
+    for (int i = 0; i < response.outputs_size(); i++) {
+        const MapOutput& output = response.outputs(i);
+        if (output.map_no() >= 0 && output.map_no() < FLAGS_total) {
+            g_map_outputs[output.map_no()] = output;
+        }
+    }
+    g_unknown_outputs = response.done() - response.outputs_size();
+    g_reduce_bytes.assign(response.reduce_bytes().begin(), response.reduce_bytes().end());
+    g_outputs_fetched = true;
+    LOG(INFO, "master knows the outputs of %d/%d maps, %d done",
+        g_map_outputs.size(), FLAGS_total, response.done());
+    return true;
+}
+
+// NULL if the map was not done at the last fetch, or its output is unknown
+// to master. misses are common after a reload of master, so only the first
+// lookup fetches, as every fetch carries the outputs of all maps
+const MapOutput* FindMapOutput(int map_no) {
+    if (!g_outputs_fetched) {
+        g_outputs_fetched = true; //not asked again if master is not reachable
+        FetchMapOutputs();
+    }
+    std::map<int, MapOutput>::iterator it = g_map_outputs.find(map_no);
+    return (it == g_map_outputs.end()) ? NULL : &it->second;
+}
+
+// the records of an item of a level are in the sort files of a map for level 0,
+// in the tuo of a group of the level below for the others.
+// mine_only leaves out sort files known to hold nothing of this reduce task
+bool AddItemFiles(int level, int item, bool mine_only,
+                  std::vector<std::string>* file_names) {
+    if (level == 0) {
         std::stringstream ss;
-        ss << FLAGS_work_dir << "/map_" << i;
-        const std::string& map_dir = ss.str();
-        if (!AddSortFiles(map_dir, &file_names) || file_names.empty()) {
+        const MapOutput* output = FindMapOutput(item);
+        if (output != NULL && !output->host().empty()) {
+            ss << output->host(); //kept by a minion, read as kShuffleFile
+        } else {
+            ss << FLAGS_work_dir;
+        }
+        ss << "/map_" << item;
+        if (output == NULL) {
+            size_t n_files = file_names->size();
+            return AddSortFiles(ss.str(), file_names) && file_names->size() > n_files;
+        }
+        for (int i = 0; i < output->files_size(); i++) {
+            const SpillFile& file = output->files(i);
+            if (mine_only && file.partition_bytes_size() > 0
+                && file.partition_bytes(0) == 0) {
+                continue;
+            }
+            file_names->push_back(ss.str() + "/" + file.name());
+        }
+        return true;
+    }
+    if (g_plan.PassThrough(level - 1, item)) {
+        return AddItemFiles(level - 1, g_plan.Members(level - 1, item)[0],
+                            mine_only, file_names);
+    }
+    file_names->push_back(TuoName(level - 1, item));
+    return true;
+}
+
+// a tuo is ready if it is there, or has been merged into one of a higher level
+bool TuoReady(int level, int tuo_no) {
+    while (tuo_no >= 0) {
+        if (!g_plan.PassThrough(level, tuo_no) && g_fs->Exist(TuoName(level, tuo_no))) {
+            return true;
+        }
+        tuo_no = g_plan.Parent(level, tuo_no);
+        level++;
+    }
+    return false;
+}
+
+// reduce tasks whose records fit in memory read the sort files of the maps,
+// whether merged into level 0 tuo or not. they flag themselves in this dir
+// as reduce_<no>_<attempt> before reading them, and with .done after
+std::string FastDir() {
+    return FLAGS_work_dir + "/fast_reduces";
+}
+
+std::string FastFlag(bool done) {
+    std::stringstream ss;
+    ss << FastDir() << "/reduce_" << FLAGS_reduce_no << "_" << FLAGS_attempt_id;
+    if (done) {
+        ss << ".done";
+    }
+    return ss.str();
+}
+
+bool TouchFlag(const std::string& flag) {
+    if (!g_fs->Open(flag, kWriteFile)) {
+        LOG(WARNING, "fail to create %s", flag.c_str());
+        return false;
+    }
+    return g_fs->Close();
+}
+
+// true if no reduce task taking the fast path reads the sort files of the
+// maps any more: those the plan lists, and those flagged, are all done
+bool FastReducesDone() {
+    std::set<int> listed(g_plan.FastReduces().begin(), g_plan.FastReduces().end());
+    std::set<std::string> started;
+    std::set<std::string> done;
+    if (g_fs->Exist(FastDir())) {
+        std::vector<FileInfo> flags;
+        if (!g_fs->List(FastDir(), &flags)) {
+            return false;
+        }
+        std::vector<FileInfo>::iterator it;
+        for (it = flags.begin(); it != flags.end(); it++) {
+            size_t slash = it->name.find_last_of('/');
+            const std::string base_name = it->name.substr(slash + 1);
+            if (!boost::starts_with(base_name, "reduce_")) {
+                continue;
+            }
+            if (boost::ends_with(base_name, ".done")) {
+                done.insert(base_name.substr(0, base_name.size() - 5));
+                listed.erase(atoi(base_name.c_str() + 7));
+            } else {
+                started.insert(base_name);
+            }
+        }
+    }
+    std::set<std::string>::iterator jt;
+    for (jt = started.begin(); jt != started.end(); jt++) {
+        if (done.find(*jt) == done.end()) {
+            return false;
+        }
+    }
+    return listed.empty();
+}
+
+// the removing flag turns away the reduce tasks starting the fast path
+// later, it is looked at by them after flagging themselves and set here
+// before looking at them, so one of the two sees the other
+bool MayRemoveSortFiles() {
+    if (g_master == NULL || FLAGS_tuo_size > 0) {
+        return true; //no reduce task takes the fast path
+    }
+    if (!FastReducesDone()) {
+        return false;
+    }
+    const std::string removing_flag = FastDir() + "/removing";
+    if (!g_fs->Exist(removing_flag)) {
+        g_fs->Mkdirs(FastDir());
+        if (!TouchFlag(removing_flag)) {
+            return false;
+        }
+    }
+    return FastReducesDone();
+}
+
+bool MergeOneTuo(int level, int tuo_now) {
+    std::vector<std::string> file_names;
+    const std::vector<int32_t>& members = g_plan.Members(level, tuo_now);
+    std::vector<int32_t>::const_iterator jt;
+    for (jt = members.begin(); jt != members.end(); jt++) {
+        if (!AddItemFiles(level, *jt, false, &file_names)) {
             return false;
         }
     }
@@ -196,18 +673,22 @@ bool MergeOneTuo(int map_from, int map_to, int tuo_now) {
              FLAGS_work_dir.c_str(), FLAGS_reduce_no, FLAGS_attempt_id);
     g_fs->Mkdirs(tuo_dir);
     char output_file[4096];
-    snprintf(output_file, sizeof(output_file), "%s/tuo_%d_%d/%d.tuo",
-            FLAGS_work_dir.c_str(), FLAGS_reduce_no, FLAGS_attempt_id, tuo_now);
+    snprintf(output_file, sizeof(output_file), "%s/tuo_%d_%d/%s.tuo",
+            FLAGS_work_dir.c_str(), FLAGS_reduce_no, FLAGS_attempt_id,
+            TuoBaseName(level, tuo_now).c_str());
     if (!MergeManyFilesToOne(file_names, output_file)) {
         return false;
     }
-    std::stringstream ss;
-    ss << FLAGS_work_dir << "/" << tuo_now << ".tuo";
-    const std::string real_tuo_name = ss.str();
+    const std::string real_tuo_name = TuoName(level, tuo_now);
     if (!g_fs->Rename(output_file, real_tuo_name)) {
         g_fs->Remove(output_file);
         return false;
     }
+    //the sort files of the maps are kept for the reduce tasks taking the
+    //fast path, the last of them removes them then, see FinishFastPath
+    if (level == 0 && !MayRemoveSortFiles()) {
+        return true;
+    }
     std::vector<std::string>::iterator it;
     for (it = file_names.begin(); it != file_names.end(); it++) {
         g_fs->Remove(*it);
@@ -215,60 +696,50 @@ bool MergeOneTuo(int map_from, int map_to, int tuo_now) {
     return true;
 }
 
-int MergeTuo() {
-    srand(time(0));
-    int n_tuo = (int)ceil((float)FLAGS_total / FLAGS_tuo_size) ;
-    LOG(INFO, "will merge %d tuo", n_tuo);
-    std::vector<int> tuo_list;
-    for (int i = 0; i < n_tuo; i++) {
-        tuo_list.push_back(i);
-    }
+// reduce tasks find ready tuo by polling the work dir,
+// lock files keep too many of them from merging the same tuo
+void MergeTuoByFs(int level, std::vector<int> tuo_list) {
+    int n_tuo = g_plan.Groups(level);
+    int n_merge = tuo_list.size();
     std::random_shuffle(tuo_list.begin(), tuo_list.end());
     std::set<int> ready_tuo_set;
-    if (FLAGS_reduce_no < n_tuo) {
+    if (FLAGS_reduce_no < n_tuo && !g_plan.PassThrough(level, FLAGS_reduce_no)) {
         while (ready_tuo_set.empty()) { //at first, merge tuo belongs to me!
             int tuo_now = FLAGS_reduce_no;
-            std::stringstream ss;
-            ss << FLAGS_work_dir << "/" << tuo_now << ".tuo";
-            const std::string& tuo_file_name = ss.str();
-            if (g_fs->Exist(tuo_file_name)) {
+            if (TuoReady(level, tuo_now)) {
                 ready_tuo_set.insert(tuo_now);
                 LOG(INFO, "lucky, my tuo ready, total #%d/%d tuo ready",
-                    ready_tuo_set.size(), n_tuo);
+                    ready_tuo_set.size(), n_merge);
                 continue;
             }
-            int map_from = tuo_now * FLAGS_tuo_size;
-            int map_to = std::min( (tuo_now + 1) * FLAGS_tuo_size - 1, FLAGS_total - 1);
-            LOG(INFO, "merge tuo from %d to %d", map_from, map_to);
-            if (MergeOneTuo(map_from, map_to, tuo_now)) {
+            LOG(INFO, "merge tuo %d of level %d from %d items",
+                tuo_now, level, g_plan.Members(level, tuo_now).size());
+            if (MergeOneTuo(level, tuo_now)) {
                 ready_tuo_set.insert(tuo_now);
-                LOG(INFO, "my tuo done. total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+                LOG(INFO, "my tuo done. total #%d/%d tuo ready", ready_tuo_set.size(), n_merge);
             }
             sleep(5);
         }
     }
 
-    while (ready_tuo_set.size() < (size_t)n_tuo) {
+    while (ready_tuo_set.size() < (size_t)n_merge) {
         std::vector<int>::iterator it;
         for (it = tuo_list.begin(); it != tuo_list.end(); it++) {
             int tuo_now = *it;
             if (ready_tuo_set.find(tuo_now) != ready_tuo_set.end()) {
                 continue;
             }
-            std::stringstream ss;
-            ss << FLAGS_work_dir << "/" << tuo_now << ".tuo";
-            const std::string& tuo_file_name = ss.str();
-            if (g_fs->Exist(tuo_file_name)) {
+            if (TuoReady(level, tuo_now)) {
                 ready_tuo_set.insert(tuo_now);
-                LOG(INFO, "lucky, total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+                LOG(INFO, "lucky, total #%d/%d tuo ready", ready_tuo_set.size(), n_merge);
                 continue;
             }
-            if (FLAGS_reduce_no > n_tuo * 2) {
+            if (FLAGS_reduce_no > n_merge * 2) {
                 continue;
             }
             std::stringstream ss_lock;
             std::stringstream my_lock_flag;
-            ss_lock << FLAGS_work_dir << "/tuo_lock_" << tuo_now << "/";
+            ss_lock << FLAGS_work_dir << "/tuo_lock_" << TuoBaseName(level, tuo_now) << "/";
             std::vector<baidu::shuttle::FileInfo> lockers;
             g_fs->List(ss_lock.str(), &lockers);
             my_lock_flag << ss_lock.str() << FLAGS_reduce_no;
@@ -282,15 +753,15 @@ int MergeTuo() {
             }
             if (!g_fs->Exist(my_lock_flag.str()) &&
                 g_fs->Exist(FLAGS_work_dir)) {
+                g_fs->Mkdirs(ss_lock.str());
                 g_fs->Open(my_lock_flag.str(), kWriteFile);
                 g_fs->Close(); //create my lock
             }
-            int map_from = tuo_now * FLAGS_tuo_size;
-            int map_to = std::min( (tuo_now + 1) * FLAGS_tuo_size - 1, FLAGS_total - 1);
-            LOG(INFO, "merge tuo from %d to %d", map_from, map_to);
-            if (MergeOneTuo(map_from, map_to, tuo_now)) {
+            LOG(INFO, "merge tuo %d of level %d from %d items",
+                tuo_now, level, g_plan.Members(level, tuo_now).size());
+            if (MergeOneTuo(level, tuo_now)) {
                 ready_tuo_set.insert(tuo_now);
-                LOG(INFO, "total #%d/%d tuo ready", ready_tuo_set.size(), n_tuo);
+                LOG(INFO, "total #%d/%d tuo ready", ready_tuo_set.size(), n_merge);
                 g_fs->Remove(ss_lock.str());
             } else {
                 g_fs->Remove(my_lock_flag.str());
@@ -299,7 +770,634 @@ int MergeTuo() {
         } // end of for
         sleep(5);
     }// end of while
-    return n_tuo;
+}
+
+// a tuo claimed from the master is merged by no one else,
+// and the merges of others are waited for by long polls.
+// the master numbers the tuo merged of a level in the order of tuo_list.
+// calls to a master not reachable are retried, as merging by the fs then
+// could merge a tuo the master has handed to another task.
+// returns false if the master refuses to coordinate the merge
+bool MergeTuoByMaster(int level, const std::vector<int>& tuo_list) {
+    int n_merge = tuo_list.size();
+    std::vector<int>::const_iterator mine = std::find(tuo_list.begin(), tuo_list.end(),
+                                                      FLAGS_reduce_no);
+    int prefer = (mine == tuo_list.end()) ? -1 : mine - tuo_list.begin();
+    while (true) {
+        ClaimTuoRequest claim_request;
+        ClaimTuoResponse claim_response;
+        claim_request.set_jobid(FLAGS_jobid);
+        claim_request.set_reduce_no(FLAGS_reduce_no);
+        claim_request.set_attempt_id(FLAGS_attempt_id);
+        claim_request.set_level(level);
+        claim_request.set_tuo_total(n_merge);
+        claim_request.set_prefer(prefer);
+        if (!g_rpc_client->SendRequest(g_master, &Master_Stub::ClaimTuo,
+                                       &claim_request, &claim_response, 5, 3)) {
+            LOG(WARNING, "fail to claim tuo from master, retry: %s",
+                FLAGS_master_endpoint.c_str());
+            sleep(sTuoRetrySeconds);
+            continue;
+        }
+        if (claim_response.status() == kOk) {
+            int tuo_now = tuo_list[claim_response.tuo_no()];
+            LOG(INFO, "merge tuo %d of level %d from %d items",
+                tuo_now, level, g_plan.Members(level, tuo_now).size());
+            bool ok = TuoReady(level, tuo_now) || MergeOneTuo(level, tuo_now);
+            FinishTuoRequest finish_request;
+            FinishTuoResponse finish_response;
+            finish_request.set_jobid(FLAGS_jobid);
+            finish_request.set_reduce_no(FLAGS_reduce_no);
+            finish_request.set_attempt_id(FLAGS_attempt_id);
+            finish_request.set_level(level);
+            finish_request.set_tuo_total(n_merge);
+            finish_request.set_tuo_no(claim_response.tuo_no());
+            finish_request.set_succeeded(ok);
+            while (!g_rpc_client->SendRequest(g_master, &Master_Stub::FinishTuo,
+                                              &finish_request, &finish_response, 5, 3)) {
+                LOG(WARNING, "fail to report tuo %d to master, retry", tuo_now);
+                sleep(sTuoRetrySeconds);
+            }
+            if (finish_response.status() != kOk) {
+                LOG(WARNING, "master refused the report of tuo %d: %s",
+                    tuo_now, Status_Name(finish_response.status()).c_str());
+                return false;
+            }
+            if (!ok) {
+                sleep(5);
+            }
+            prefer = -1;
+            continue;
+        } else if (claim_response.status() != kNoMore) {
+            LOG(WARNING, "master refused to hand out tuo: %s",
+                Status_Name(claim_response.status()).c_str());
+            return false;
+        }
+        WaitTuoRequest wait_request;
+        WaitTuoResponse wait_response;
+        wait_request.set_jobid(FLAGS_jobid);
+        wait_request.set_level(level);
+        wait_request.set_tuo_total(n_merge);
+        wait_request.set_timeout(sTuoWaitSeconds);
+        if (!g_rpc_client->SendRequest(g_master, &Master_Stub::WaitTuo,
+                                       &wait_request, &wait_response,
+                                       sTuoWaitSeconds + 5, 3)) {
+            //claim again, a merger gone meanwhile is taken over
+            LOG(WARNING, "fail to wait tuo on master, retry: %s",
+                FLAGS_master_endpoint.c_str());
+            sleep(sTuoRetrySeconds);
+            continue;
+        }
+        if (wait_response.status() == kOk) {
+            LOG(INFO, "all %d tuo of level %d ready", n_merge, level);
+            return true;
+        } else if (wait_response.status() != kSuspend) {
+            LOG(WARNING, "fail to wait tuo on master: %s",
+                Status_Name(wait_response.status()).c_str());
+            return false;
+        }
+        //some merges are slow, or their reduce tasks are gone, try to claim them
+        LOG(INFO, "total #%d/%d tuo ready", wait_response.done(), n_merge);
+    }
+}
+
+void MergeTuo(int level) {
+    int n_tuo = g_plan.Groups(level);
+    std::vector<int> tuo_list;
+    for (int i = 0; i < n_tuo; i++) {
+        if (!g_plan.PassThrough(level, i)) {
+            tuo_list.push_back(i);
+        }
+    }
+    LOG(INFO, "will merge %d tuo of level %d, %d passed through",
+        tuo_list.size(), level, n_tuo - tuo_list.size());
+    if (tuo_list.empty()) {
+        return;
+    }
+    if (g_master != NULL && MergeTuoByMaster(level, tuo_list)) {
+        return;
+    }
+    MergeTuoByFs(level, tuo_list);
+}
+
+void GetMergeBudget(MergeBudget* budget) {
+    int64_t max_files = FLAGS_max_open_files;
+    if (max_files <= 0) {
+        max_files = sDefaultMaxOpenFiles;
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            max_files = limit.rlim_cur / 2;
+        }
+    }
+    if (FLAGS_memory_limit > 0) {
+        int64_t memory = FLAGS_memory_limit * 1024 * FLAGS_merge_memory_percent / 100;
+        int64_t stream_memory = sStreamMemory + sBlockMemory * (1 + FLAGS_read_ahead_blocks);
+        max_files = std::min(max_files, memory / stream_memory);
+    }
+    budget->final_fan_in = max_files;
+    //every key range of a parallel merge opens all files of the tuo
+    budget->merge_fan_in = max_files / std::max(FLAGS_merge_threads, 1);
+    budget->memory_bytes = sDefaultShuffleBuffer;
+    if (FLAGS_memory_limit > 0) {
+        budget->memory_bytes = FLAGS_memory_limit * 1024 * FLAGS_shuffle_buffer_percent / 100;
+    }
+}
+
+// sizes of the outputs of all maps, false if some maps are not done yet.
+// only the maps whose outputs are unknown to master are listed
+bool ListMapOutputs(std::vector<MergeInput>* inputs) {
+    FetchMapOutputs();
+    std::vector<int> unknown_maps;
+    for (int i = 0; i < FLAGS_total; i++) {
+        if (g_map_outputs.find(i) == g_map_outputs.end()) {
+            unknown_maps.push_back(i);
+        }
+    }
+    std::vector<FileInfo>::iterator it;
+    if (!unknown_maps.empty()) {
+        std::vector<FileInfo> children;
+        if (!g_fs->List(FLAGS_work_dir, &children)) {
+            return false;
+        }
+        std::set<int> done_maps;
+        for (it = children.begin(); it != children.end(); it++) {
+            size_t slash = it->name.find_last_of('/');
+            const std::string base_name = it->name.substr(slash + 1);
+            if (boost::starts_with(base_name, "map_")) {
+                done_maps.insert(atoi(base_name.c_str() + 4));
+            }
+        }
+        std::vector<int>::iterator jt;
+        for (jt = unknown_maps.begin(); jt != unknown_maps.end(); jt++) {
+            if (done_maps.find(*jt) == done_maps.end()) {
+                LOG(INFO, "wait for map %d to plan the merge", *jt);
+                return false;
+            }
+        }
+    }
+    for (int i = 0; i < FLAGS_total; i++) {
+        std::map<int, MapOutput>::iterator kt = g_map_outputs.find(i);
+        if (kt != g_map_outputs.end()) {
+            MergeInput input;
+            for (int j = 0; j < kt->second.files_size(); j++) {
+                input.files++;
+                input.bytes += kt->second.files(j).size();
+            }
+            inputs->push_back(input);
+            continue;
+        }
+        std::stringstream ss;
+        ss << FLAGS_work_dir << "/map_" << i;
+        std::vector<FileInfo> sort_files;
+        if (!g_fs->List(ss.str(), &sort_files)) {
+            LOG(WARNING, "fail to list %s", ss.str().c_str());
+            return false;
+        }
+        MergeInput input;
+        for (it = sort_files.begin(); it != sort_files.end(); it++) {
+            if (boost::ends_with(it->name, ".sort")) {
+                input.files++;
+                input.bytes += it->size;
+            }
+        }
+        if (input.files == 0) {
+            return false;
+        }
+        inputs->push_back(input);
+    }
+    return true;
+}
+
+// true if master knows the bytes of each reduce task in the outputs of all maps
+bool MasterKnowsBytes() {
+    if (g_unknown_outputs != 0 || (int32_t)g_map_outputs.size() < FLAGS_total) {
+        return false;
+    }
+    std::map<int, MapOutput>::iterator it;
+    for (it = g_map_outputs.begin(); it != g_map_outputs.end(); it++) {
+        for (int i = 0; i < it->second.files_size(); i++) {
+            if (it->second.files(i).partition_bytes_size() == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// bytes of this reduce task in the outputs of all maps, from the slices of
+// the manifest master reports. -1 if master does not know them all
+int64_t MineBytes() {
+    while (FetchMapOutputs() && g_unknown_outputs == 0
+           && (int32_t)g_map_outputs.size() < FLAGS_total) {
+        LOG(INFO, "wait for %d maps to size reduce %d",
+            FLAGS_total - g_map_outputs.size(), FLAGS_reduce_no);
+        sleep(sFetchIntervalSeconds);
+    }
+    if (!MasterKnowsBytes()) {
+        return -1;
+    }
+    int64_t mine_bytes = 0;
+    std::map<int, MapOutput>::iterator it;
+    for (it = g_map_outputs.begin(); it != g_map_outputs.end(); it++) {
+        for (int i = 0; i < it->second.files_size(); i++) {
+            mine_bytes += it->second.files(i).partition_bytes(0);
+        }
+    }
+    return mine_bytes;
+}
+
+bool ReadMergePlan(const std::string& plan_file) {
+    if (!g_fs->Exist(plan_file)) {
+        return false;
+    }
+    FileSystem::Param param;
+    FillParam(param);
+    if (!g_fs->Open(plan_file, param, kReadFile)) {
+        LOG(WARNING, "fail to open %s", plan_file.c_str());
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    int32_t n_read = 0;
+    while ((n_read = g_fs->Read(buf, sizeof(buf))) > 0) {
+        text.append(buf, n_read);
+    }
+    g_fs->Close();
+    if (n_read < 0 || !g_plan.FromString(text) || g_plan.Inputs() != FLAGS_total) {
+        LOG(WARNING, "invalid merge plan: %s", plan_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+// the plan is written aside and renamed, the first one renamed is taken by all
+bool WriteMergePlan(const std::string& plan_file, const MergePlan& plan) {
+    std::stringstream ss;
+    ss << plan_file << "_" << FLAGS_reduce_no << "_" << FLAGS_attempt_id;
+    const std::string tmp_file = ss.str();
+    FileSystem::Param param;
+    FillParam(param);
+    if (!g_fs->Open(tmp_file, param, kWriteFile)) {
+        LOG(WARNING, "fail to open %s for write", tmp_file.c_str());
+        return false;
+    }
+    std::string text = plan.ToString();
+    bool ok = g_fs->WriteAll((void*)text.data(), text.size());
+    ok = g_fs->Close() && ok;
+    if (ok && !g_fs->Exist(plan_file)) {
+        ok = g_fs->Rename(tmp_file, plan_file);
+    }
+    g_fs->Remove(tmp_file);
+    return ok;
+}
+
+// the planners may all fit in memory and never plan, so a reduce task
+// known to be over the budget plans by itself
+void LoadMergePlan(bool over_budget) {
+    const std::string plan_file = FLAGS_work_dir + "/merge_plan";
+    MergeBudget budget;
+    GetMergeBudget(&budget);
+    while (!ReadMergePlan(plan_file)) {
+        if (FLAGS_reduce_no >= sPlanners && !over_budget) {
+            sleep(5);
+            continue;
+        }
+        std::vector<MergeInput> inputs;
+        //a plan found after the listing is taken instead of this one
+        if (!ListMapOutputs(&inputs) || g_fs->Exist(plan_file)) {
+            sleep(5);
+            continue;
+        }
+        MergePlan plan;
+        PlanMerge(inputs, budget, &plan);
+        //those whose records fit in memory merge without the plan, see TakeFastPath
+        std::vector<int32_t> fast_reduces;
+        for (size_t i = 0; i < g_reduce_bytes.size() && MasterKnowsBytes(); i++) {
+            if (g_reduce_bytes[i] <= budget.memory_bytes) {
+                fast_reduces.push_back(i);
+            }
+        }
+        plan.SetFastReduces(fast_reduces);
+        LOG(INFO, "plan the merge with fan-in %d, %d for the final one",
+            budget.merge_fan_in, budget.final_fan_in);
+        if (!WriteMergePlan(plan_file, plan)) {
+            sleep(5);
+        }
+    }
+}
+
+// a reduce task whose records fit in memory takes the fast path if no sort
+// file of the maps may have been removed, see MayRemoveSortFiles
+bool TakeFastPath() {
+    g_fs->Mkdirs(FastDir());
+    if (!TouchFlag(FastFlag(false))) {
+        return false;
+    }
+    if (g_fs->Exist(FastDir() + "/removing")) {
+        LOG(INFO, "sort files of the maps may be removed, merge by the plan");
+        TouchFlag(FastFlag(true));
+        return false;
+    }
+    return true;
+}
+
+// the last reduce task done with the fast path removes the sort files
+// of the maps merged into level 0 tuo by then, the others are removed
+// by the tasks merging them
+void FinishFastPath() {
+    TouchFlag(FastFlag(true));
+    if (!ReadMergePlan(FLAGS_work_dir + "/merge_plan") || g_plan.Passes() == 0
+        || !MayRemoveSortFiles()) {
+        return;
+    }
+    for (int i = 0; i < g_plan.Groups(0); i++) {
+        if (g_plan.PassThrough(0, i) || !TuoReady(0, i)) {
+            continue;
+        }
+        std::vector<std::string> file_names;
+        const std::vector<int32_t>& members = g_plan.Members(0, i);
+        std::vector<int32_t>::const_iterator jt;
+        for (jt = members.begin(); jt != members.end(); jt++) {
+            AddItemFiles(0, *jt, false, &file_names);
+        }
+        std::vector<std::string>::iterator it;
+        for (it = file_names.begin(); it != file_names.end(); it++) {
+            g_fs->Remove(*it);
+        }
+    }
+}
+
+// local runs of a local shuffle, a merger thread collapses them
+// while the maps are still being fetched
+struct LocalRuns {
+    Mutex mu;
+    std::vector<std::string> files;
+    int32_t next_no;
+    bool merging;
+    LocalRuns() : next_no(0), merging(false) { }
+};
+
+std::string NextRunName(LocalRuns* runs) {
+    runs->mu.AssertHeld();
+    std::stringstream ss;
+    ss << FLAGS_local_dir << "/run_" << runs->next_no++ << ".sort";
+    return ss.str();
+}
+
+bool MergeLocalRuns(LocalRuns* runs, const std::vector<std::string>& batch,
+                    const std::string& output_file) {
+    bool ok = MergeRangeToOne(batch, kLocalFile, "", "", output_file,
+                              kLocalFile, FLAGS_compress_threads);
+    MutexLock lock(&runs->mu);
+    if (ok) {
+        std::vector<std::string>::const_iterator it;
+        for (it = batch.begin(); it != batch.end(); it++) {
+            g_local_fs->Remove(*it);
+        }
+        runs->files.push_back(output_file);
+    } else {
+        LOG(WARNING, "fail to merge %d local runs", batch.size());
+        g_local_fs->Remove(output_file);
+        runs->files.insert(runs->files.end(), batch.begin(), batch.end());
+    }
+    runs->merging = false;
+    return ok;
+}
+
+// the oldest fan_in runs are merged in background if no merge is running
+void MaybeMergeRuns(LocalRuns* runs, int32_t fan_in, ThreadPool* merger) {
+    MutexLock lock(&runs->mu);
+    if (runs->merging || (int32_t)runs->files.size() < fan_in) {
+        return;
+    }
+    std::vector<std::string> batch(runs->files.begin(), runs->files.begin() + fan_in);
+    runs->files.erase(runs->files.begin(), runs->files.begin() + fan_in);
+    runs->merging = true;
+    merger->AddTask(boost::bind(&MergeLocalRuns, runs, batch, NextRunName(runs)));
+}
+
+void SpillToRun(SpillBuffer* buffer, LocalRuns* runs) {
+    std::string run_file;
+    {
+        MutexLock lock(&runs->mu);
+        run_file = NextRunName(runs);
+    }
+    int64_t bytes = buffer->Bytes();
+    if (buffer->Spill(run_file) != kOk) {
+        LOG(FATAL, "fail to spill fetched records to %s", run_file.c_str());
+    }
+    LOG(INFO, "spill %lld bytes to %s", bytes, run_file.c_str());
+    MutexLock lock(&runs->mu);
+    runs->files.push_back(run_file);
+}
+
+// maps done and not fetched yet, the work dir is listed only if
+// master does not know the outputs of some maps done
+void FindDoneMaps(const std::vector<bool>& fetched, std::vector<int>* maps) {
+    std::set<int> listed_maps;
+    if (!FetchMapOutputs() || g_unknown_outputs > 0) {
+        std::vector<FileInfo> children;
+        if (g_fs->List(FLAGS_work_dir, &children)) {
+            std::vector<FileInfo>::iterator it;
+            for (it = children.begin(); it != children.end(); it++) {
+                size_t slash = it->name.find_last_of('/');
+                const std::string base_name = it->name.substr(slash + 1);
+                if (boost::starts_with(base_name, "map_")) {
+                    listed_maps.insert(atoi(base_name.c_str() + 4));
+                }
+            }
+        }
+    }
+    for (int i = 0; i < FLAGS_total; i++) {
+        if (!fetched[i] && (g_map_outputs.find(i) != g_map_outputs.end()
+                            || listed_maps.find(i) != listed_maps.end())) {
+            maps->push_back(i);
+        }
+    }
+}
+
+// local files of the segments a map pushed to this reduce task, named by
+// the minion receiving them, false if they were pushed to another attempt
+bool AddPushedFiles(int map_no, std::vector<std::string>* file_names) {
+    if (FLAGS_push_dir.empty()) {
+        return true;
+    }
+    const MapOutput* output = FindMapOutput(map_no);
+    if (output == NULL) {
+        return true;
+    }
+    for (int i = 0; i < output->pushed_size(); i++) {
+        const PushedSegment& segment = output->pushed(i);
+        if (segment.reduce_attempt() != FLAGS_attempt_id) {
+            LOG(WARNING, "map %d pushed to attempt %d, wait for it to run again",
+                map_no, segment.reduce_attempt());
+            return false;
+        }
+        for (int chunk_no = 0; chunk_no < segment.chunks(); chunk_no++) {
+            file_names->push_back(PushedSegmentName(FLAGS_push_dir, map_no, output->attempt(),
+                                                    segment.file_no(), chunk_no));
+        }
+    }
+    return true;
+}
+
+void ScanToBuffer(MergeFileReader* reader, SpillBuffer* buffer, LocalRuns* runs) {
+    SortFileReader::Iterator* scan_it = reader->Scan(PartitionPrefix(FLAGS_reduce_no),
+                                                     PartitionPrefix(FLAGS_reduce_no + 1));
+    boost::scoped_ptr<SortFileReader::Iterator> scan_it_guard(scan_it);
+    for (; !scan_it->Done(); scan_it->Next()) {
+        buffer->Put(scan_it->Key(), scan_it->Value());
+        if (buffer->Full()) {
+            SpillToRun(buffer, runs);
+        }
+    }
+    if (scan_it->Error() != kOk && scan_it->Error() != kNoMore) {
+        LOG(WARNING, "fail to scan: %s", reader->GetErrorFile().c_str());
+        _exit(4);
+    }
+    reader->Close();
+}
+
+// the minion keeping the spills of a map is gone, master runs the map again
+// and this task waits for the output of the new attempt
+void ReportLostOutput(int map_no) {
+    std::map<int, MapOutput>::iterator it = g_map_outputs.find(map_no);
+    if (g_master == NULL || it == g_map_outputs.end()) {
+        return;
+    }
+    ReportLostOutputRequest request;
+    ReportLostOutputResponse response;
+    request.set_jobid(FLAGS_jobid);
+    request.set_map_no(map_no);
+    request.set_attempt(it->second.attempt());
+    request.set_host(it->second.host());
+    if (!g_rpc_client->SendRequest(g_master, &Master_Stub::ReportLostOutput,
+                                   &request, &response, 5, 3)
+        || response.status() != kOk) {
+        LOG(WARNING, "fail to report the lost output of map %d", map_no);
+        return;
+    }
+    g_map_outputs.erase(it);
+}
+
+// copies the records of this reduce task in the files of a map into the buffer,
+// false if the files can not be opened and the map should be fetched later.
+// records may have been spilled when a read fails, so the task gives up then
+bool FetchMap(int map_no, SpillBuffer* buffer, LocalRuns* runs) {
+    std::vector<std::string> file_names;
+    if (!AddItemFiles(0, map_no, true, &file_names)) {
+        LOG(WARNING, "fail to find the files of map %d", map_no);
+        return false;
+    }
+    std::vector<std::string> pushed_names;
+    if (!AddPushedFiles(map_no, &pushed_names)) {
+        return false;
+    }
+    const MapOutput* output = FindMapOutput(map_no);
+    bool on_host = (output != NULL && !output->host().empty());
+    MergeFileReader reader;
+    if (!file_names.empty()) {
+        FileSystem::Param param;
+        FillParam(param);
+        FillReadAheadParam(param);
+        FillMergeParam(param);
+        if (OpenMergeFiles(&reader, file_names, param,
+                           on_host ? kShuffleFile : g_file_type) != kOk) {
+            LOG(WARNING, "fail to open: %s", reader.GetErrorFile().c_str());
+            if (on_host) {
+                ReportLostOutput(map_no);
+            }
+            return false;
+        }
+    }
+    MergeFileReader pushed_reader;
+    if (!pushed_names.empty()) {
+        FileSystem::Param param;
+        if (pushed_reader.Open(pushed_names, param, kLocalFile) != kOk) {
+            //pushed records are nowhere else, master runs the map again
+            LOG(WARNING, "fail to open pushed: %s", pushed_reader.GetErrorFile().c_str());
+            _exit(4);
+        }
+    }
+    if (!file_names.empty()) {
+        ScanToBuffer(&reader, buffer, runs);
+    }
+    if (!pushed_names.empty()) {
+        ScanToBuffer(&pushed_reader, buffer, runs);
+    }
+    return true;
+}
+
+// the records of this reduce task are fetched from the maps as they are done,
+// buffered in memory and spilled to local runs, so that no tuo file is
+// written to the shuffle fs and each record is read from it only once
+void LocalShuffle(std::vector<std::string>* file_names) {
+    MergeBudget budget;
+    GetMergeBudget(&budget);
+    int32_t fan_in = std::max(budget.merge_fan_in, 2);
+    int64_t buffer_limit = budget.memory_bytes;
+    g_local_fs = FileSystem::CreateLocalFs();
+    g_local_fs->Remove(FLAGS_local_dir); //left by an earlier attempt
+    if (!g_local_fs->Mkdirs(FLAGS_local_dir)) {
+        LOG(FATAL, "fail to make local dir: %s", FLAGS_local_dir.c_str());
+    }
+    FileSystem::Param param_write;
+    FillWriteParam(param_write, FLAGS_compress_threads);
+    SpillBuffer buffer(buffer_limit, kLocalFile, param_write);
+    LocalRuns runs;
+    ThreadPool merger(1);
+    std::vector<bool> fetched(FLAGS_total, false);
+    int n_fetched = 0;
+    while (n_fetched < FLAGS_total) {
+        std::vector<int> maps;
+        FindDoneMaps(fetched, &maps);
+        std::vector<int>::iterator it;
+        for (it = maps.begin(); it != maps.end(); it++) {
+            if (!FetchMap(*it, &buffer, &runs)) {
+                continue;
+            }
+            fetched[*it] = true;
+            n_fetched++;
+            MaybeMergeRuns(&runs, fan_in, &merger);
+        }
+        LOG(INFO, "total #%d/%d maps fetched, %lld bytes buffered",
+            n_fetched, FLAGS_total, buffer.Bytes());
+        if (n_fetched < FLAGS_total) {
+            sleep(sFetchIntervalSeconds);
+        }
+    }
+    if (!buffer.Empty()) {
+        SpillToRun(&buffer, &runs);
+    }
+    merger.Stop(true);
+    //only the runs beyond the final fan-in are merged after the last map
+    while ((int32_t)runs.files.size() > std::max(budget.final_fan_in, 2)) {
+        std::vector<std::string> batch;
+        std::string run_file;
+        {
+            MutexLock lock(&runs.mu);
+            size_t n = std::min(runs.files.size(), (size_t)fan_in);
+            batch.assign(runs.files.begin(), runs.files.begin() + n);
+            runs.files.erase(runs.files.begin(), runs.files.begin() + n);
+            runs.merging = true;
+            run_file = NextRunName(&runs);
+        }
+        if (!MergeLocalRuns(&runs, batch, run_file)) {
+            break; //the final merge opens them all
+        }
+    }
+    file_names->swap(runs.files);
+}
+
+// prints the records of this reduce task merged from the local runs
+// they are fetched into
+void ShuffleLocally() {
+    std::vector<std::string> run_names;
+    LocalShuffle(&run_names);
+    if (!run_names.empty()) {
+        MergeAndPrint(run_names, kLocalFile);
+    }
+    g_local_fs->Remove(FLAGS_local_dir);
 }
 
 int main(int argc, char* argv[]) {
@@ -308,31 +1406,99 @@ int main(int argc, char* argv[]) {
     google::ParseCommandLineFlags(&argc, &argv, true);
     FileSystem::Param param;
     FillParam(param);
-    g_fs = FileSystem::CreateInfHdfs(param);
+    if (FLAGS_fs == "nfs") {
+        g_file_type = kNfsFile;
+        g_fs = FileSystem::CreateNfs();
+    } else {
+        g_fs = FileSystem::CreateInfHdfs(param);
+    }
     if (FLAGS_total == 0 ) {
         LOG(FATAL, "invalid map task total");
     }
-    if (FLAGS_tuo_size == 0) {
-        FLAGS_tuo_size = std::min((int32_t)ceil(sqrt(FLAGS_total)), 300);
-        int n_tuo = (int)ceil((float)FLAGS_total / FLAGS_tuo_size);
-        if (n_tuo < 100) {
-            FLAGS_tuo_size = std::max((int32_t)ceil(sqrt(FLAGS_tuo_size)), 10);
+    if (FLAGS_merge_combiner == "sum") {
+        if (FLAGS_pipe == "streaming") {
+            g_combiner = &SumCombine;
+        } else {
+            LOG(WARNING, "sum combiner only works on streaming records, ignored");
         }
+    } else if (!FLAGS_merge_combiner.empty()) {
+        LOG(FATAL, "unknown merge combiner: %s", FLAGS_merge_combiner.c_str());
     }
-    LOG(INFO, "tuo_size: %d", FLAGS_tuo_size);
-    int n_tuo = MergeTuo();
-    std::vector<std::string>  tuo_file_names;
-    for (int i = 0;  i< n_tuo; i++) {
-        std::stringstream ss;
-        ss << FLAGS_work_dir + "/" << i << ".tuo";
-        tuo_file_names.push_back(ss.str());
+    if (!FLAGS_master_endpoint.empty() && !FLAGS_jobid.empty()) {
+        g_rpc_client = new RpcClient();
+        g_rpc_client->GetStub(FLAGS_master_endpoint, &g_master);
+    }
+    srand(time(0));
+    if (FLAGS_local_shuffle) {
+        ShuffleLocally();
+        return 0;
+    }
+    MergeBudget budget;
+    GetMergeBudget(&budget);
+    bool fast_path = false;
+    if (FLAGS_tuo_size > 0) {
+        PlanUniformMerge(FLAGS_total, FLAGS_tuo_size, &g_plan);
+    } else {
+        //decided by each reduce task, as the slices of a skewed job differ
+        int64_t mine_bytes = MineBytes();
+        if (mine_bytes >= 0 && mine_bytes <= budget.memory_bytes && TakeFastPath()) {
+            LOG(INFO, "%lld bytes of reduce %d fit in memory, merge no tuo",
+                mine_bytes, FLAGS_reduce_no);
+            g_plan.Reset(FLAGS_total);
+            fast_path = true;
+        } else {
+            LoadMergePlan(mine_bytes >= 0);
+            const std::vector<int32_t>& fast_reduces = g_plan.FastReduces();
+            if (std::find(fast_reduces.begin(), fast_reduces.end(), FLAGS_reduce_no)
+                != fast_reduces.end()) {
+                TouchFlag(FastFlag(true)); //listed, but not on the fast path
+            }
+        }
+    }
+    LOG(INFO, "merge in %d passes, %lld bytes rewritten",
+        g_plan.Passes(), g_plan.RewrittenBytes());
+    for (int level = 0; level < g_plan.Passes(); level++) {
+        LOG(INFO, "level %d: %d tuo, fan-in up to %d",
+            level, g_plan.Groups(level), g_plan.MaxFanIn(level));
+        MergeTuo(level);
+    }
+    int top = g_plan.Passes();
+    int n_items = (top == 0) ? FLAGS_total : g_plan.Groups(top - 1);
+    std::vector<std::string> file_names;
+    for (int i = 0; i < n_items; i++) {
+        if (!AddItemFiles(top, i, true, &file_names)) {
+            LOG(WARNING, "fail to find the files of item %d", i);
+            _exit(1);
+        }
+    }
+    if (file_names.empty()) {
+        LOG(INFO, "no map output holds records of reduce %d", FLAGS_reduce_no);
+        if (fast_path) {
+            FinishFastPath();
+        }
+        return 0;
     }
-    if (FLAGS_reduce_no > FLAGS_slow_start_no) {
+    if (top == 0 && (int32_t)file_names.size() > std::max(budget.final_fan_in, 2)) {
+        //no tuo as the records fit in memory, none is written to the
+        //shuffle fs, whatever does not fit is spilled to local disk
+        LOG(INFO, "%d files are too many for one merge, fetch them map by map",
+            file_names.size());
+        ShuffleLocally();
+        if (fast_path) {
+            FinishFastPath();
+        }
+        return 0;
+    }
+    //with master the opens of the merge are paced by io permits
+    if (g_master == NULL && FLAGS_reduce_no > FLAGS_slow_start_no) {
         double rn = rand() / (RAND_MAX+0.0);
         int random_period = static_cast<int>(rn * 90);
         LOG(INFO, "sleep a random time: %d", random_period);
         sleep(random_period);
     }
-    MergeAndPrint(tuo_file_names);
+    MergeAndPrint(file_names, g_file_type);
+    if (fast_path) {
+        FinishFastPath();
+    }
     return 0;
 }
@@ -4,11 +4,12 @@
 #include <algorithm>
 #include <map>
 #include <string>
-#include <queue>
 #include <vector>
+#include <boost/function.hpp>
 #include "proto/shuttle.pb.h"
 #include "proto/sortfile.pb.h"
 #include "common/filesystem.h"
+#include "common/slice.h"
 #include "thread_pool.h"
 #include "mutex.h"
 
@@ -18,7 +19,26 @@ namespace shuttle {
 enum FileType {
     kHdfsFile = 0, 
     kNfsFile = 1,
-    kLocalFile = 2
+    kLocalFile = 2,
+    kLocalMmapFile = 3, //local files, readers map them into memory
+    kShuffleFile = 4 //map spills read from the minion keeping them, no writer
+};
+
+// Map outputs prefix every key with its reduce number in big endian,
+// so files sorted by keys are sorted by partitions first
+const static size_t sPartitionPrefixSize = 4;
+std::string PartitionPrefix(int32_t partition);
+
+struct ReaderStatistics {
+    int64_t blocks_decoded;
+    int64_t blocks_skipped; //passed over by scan positioning without decoding
+    int64_t stall_micros; //time the iterator waited for the read-ahead
+    int64_t filtered; //point lookups answered by the bloom filter alone
+    int64_t open_micros; //time to open the file, summed over the files of a merge
+    int64_t max_open_micros; //the slowest open among the files of a merge
+    ReaderStatistics() : blocks_decoded(0), blocks_skipped(0),
+                         stall_micros(0), filtered(0),
+                         open_micros(0), max_open_micros(0) { }
 };
 
 class SortFileReader {
@@ -28,16 +48,23 @@ public:
     public:
         virtual bool Done() = 0;
         virtual void Next() = 0;
-        virtual const std::string& Key() = 0;
-        virtual const std::string& Value() = 0;
+        // the returned slices are valid until the next call of Next()
+        virtual Slice Key() = 0;
+        virtual Slice Value() = 0;
         virtual Status Error() = 0;
         virtual ~Iterator() {};
         virtual const std::string GetFileName() = 0;
     };
     virtual Status Open(const std::string& path, FileSystem::Param param) = 0;
     virtual Iterator* Scan(const std::string& start_key, const std::string& end_key) = 0;
+    // records of one partition, the keys returned have no partition prefix
+    virtual Iterator* ScanPartition(int32_t partition) = 0;
+    // first keys of the indexed blocks in order, a sample of the keys weighted
+    // by bytes, v5 files only give the first keys of their index partitions
+    virtual Status GetIndexKeys(std::vector<std::string>* keys) = 0;
     virtual Status Close() = 0;
     virtual std::string GetFileName() = 0;
+    virtual void GetStatistics(ReaderStatistics* stat) = 0;
     virtual ~SortFileReader() {}
 };
 
@@ -45,27 +72,20 @@ class SortFileWriter {
 public:
     static SortFileWriter* Create(FileType file_type, Status* status);
     virtual Status Open(const std::string& path, FileSystem::Param param) = 0;
-    virtual Status Put(const std::string& key, const std::string& value) = 0;
+    virtual Status Put(const Slice& key, const Slice& value) = 0;
+    // appends the data blocks of a v4 sort file with the same codec and
+    // partitioning, whose keys follow all the keys appended before,
+    // blocks are copied without decoding, a writer either puts or appends
+    virtual Status Append(const std::string& path, FileSystem::Param param,
+                          FileType file_type) = 0;
     virtual Status Close() = 0;
     virtual ~SortFileWriter() {}
 };
 
 class MergeFileReader {
 public:
-    struct MergeItem {
-        std::string key_;
-        std::string value_;
-        int it_offset_;
-        MergeItem(const std::string& key, const std::string& value, int it_offset) {
-            key_ = key;
-            value_ = value;
-            it_offset_ = it_offset;
-        }
-        bool operator<(const MergeItem& other) const {
-            return key_ > other.key_;
-        }
-    };
-
+    // k-way merge by a loser tree over the child iterators,
+    // records are not copied, Key() and Value() point into the winner
     class MergeIterator : public SortFileReader::Iterator {
     public:
         MergeIterator(const std::vector<SortFileReader::Iterator*>& iters,
@@ -73,42 +93,94 @@ public:
         virtual ~MergeIterator();
         bool Done();
         void Next();
-        const std::string& Key() {return key_;}
-        const std::string& Value() {return value_;}
+        Slice Key();
+        Slice Value();
         Status Error() {return status_;};
         const std::string GetFileName() {return "";}
     private:
-        std::string key_;
-        std::string value_;
+        int BuildTree(int node);
+        bool Less(int a, int b);
         Status status_;
         std::vector<SortFileReader::Iterator*> iters_;
-        std::priority_queue<MergeItem> queue_;
+        //tree_[0] is the winner, tree_[1..k-1] keep the losers of inner
+        //nodes, leaf i is node k + i, the children of node n are 2n and 2n+1
+        std::vector<int> tree_;
+        //current key of each child, refreshed only when the child moves
+        std::vector<Slice> keys_;
+        std::vector<bool> drained_;
         MergeFileReader* merge_reader_;
     };
 
+    MergeFileReader();
     ~MergeFileReader();
+    // files are opened by "merge_parallelism" threads of param, which also
+    // set up the scans and close the files, the first failure stops the rest
     Status Open(const std::vector<std::string>& files, 
                 FileSystem::Param param,
                 FileType file_type);
     SortFileReader::Iterator* Scan(const std::string& start_key, const std::string& end_key);
+    SortFileReader::Iterator* ScanPartition(int32_t partition);
+    // index keys of all the files, sorted
+    Status GetIndexKeys(std::vector<std::string>* keys);
     Status Close();
     const std::string& GetErrorFile() {return err_file_;}
+    void GetStatistics(ReaderStatistics* stat);
 private:
+    typedef boost::function<SortFileReader::Iterator* (SortFileReader*)> ScanFunc;
+    SortFileReader::Iterator* ScanAll(ScanFunc scan);
     void AddIter(std::vector<SortFileReader::Iterator*>* iters,
                  SortFileReader* reader,
-                 const std::string& start_key,
-                 const std::string& end_key,
+                 ScanFunc scan,
+                 size_t slot,
                  bool* has_error);
     void AddReader(const std::string& file_name,
                    FileSystem::Param param,
                    FileType type,
+                   size_t slot,
                    Status* st); 
     void CloseReader(SortFileReader* reader, Status* st);
     std::vector<SortFileReader*> readers_;
+    int32_t parallelism_;
     std::string err_file_;
     Mutex mu_;
 };
 
+// Iterates the records of a scan key by key, the values of a key
+// come in the order of the scan, the scan is not owned
+class GroupIterator {
+public:
+    class ValueIterator {
+    public:
+        ValueIterator(GroupIterator* group) : group_(group) { }
+        // no more values of the current key
+        bool Done();
+        void Next();
+        // valid until the next call of Next()
+        Slice Value();
+    private:
+        GroupIterator* group_;
+    };
+    GroupIterator(SortFileReader::Iterator* it);
+    bool Done();
+    // moves to the next key, the values not iterated are skipped
+    void Next();
+    Slice Key() {return key_;}
+    // values of the current key, valid until the next call of Next()
+    ValueIterator* Values() {return &values_;}
+    Status Error() {return it_->Error();}
+private:
+    SortFileReader::Iterator* it_;
+    bool done_;
+    std::string key_;
+    ValueIterator values_;
+};
+
+// Collapses the values of a key while merging, the combined records
+// are put to the writer under the same key
+typedef boost::function<Status (const Slice& key,
+                                GroupIterator::ValueIterator* values,
+                                SortFileWriter* writer)> CombineFunc;
+
 }
 }
 #endif
@@ -217,7 +217,7 @@ TEST(HdfsTest, Read6) {
     int count = 0;
     while (!it->Done()) {
         count++;
-        printf("%s -> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s -> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
     }
     status = reader->Close();
@@ -239,7 +239,7 @@ TEST(HdfsTest, Read7) {
     int count = 0;
     while (!it->Done()) {
         count++;
-        printf("%s -> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s -> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
     }
     status = reader->Close();
@@ -261,7 +261,7 @@ TEST(HdfsTest, Read8) {
     int count = 0;
     while (!it->Done()) {
         count++;
-        printf("%s -> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s -> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
     }
     status = reader->Close();
@@ -282,7 +282,7 @@ TEST(HdfsTest, Read9) {
     int count = 0;
     while (!it->Done()) {
         count++;
-        printf("%s -> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s -> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
     }
     status = reader->Close();
@@ -304,7 +304,7 @@ TEST(HdfsTest, Read10) {
     int count = 0;
     while (!it->Done()) {
         count++;
-        printf("%s -> %s\n", it->Key().c_str(), it->Value().c_str());
+        printf("%s -> %s\n", it->Key().ToString().c_str(), it->Value().ToString().c_str());
         it->Next();
     }
     EXPECT_EQ(it->Error(), kInvalidArg);
@@ -336,6 +336,683 @@ TEST(HdfsTest, ReadSameKey) {
     delete it;
 }
 
+TEST(HdfsTest, ReadStatistics) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_005000000", "key_005000010");
+    EXPECT_EQ(it->Error(), kOk);
+    int count = 0;
+    while (!it->Done()) {
+        count++;
+        it->Next();
+    }
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    EXPECT_EQ(count, 10);
+    EXPECT_LE(stat.blocks_decoded, 2);
+    EXPECT_GT(stat.blocks_skipped, 0);
+    delete it;
+}
+
+TEST(HdfsTest, ReadAhead) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["read_ahead_blocks"] = "4";
+    param["read_ahead_bytes"] = "262144";
+    std::string file_path = g_work_dir + "/put_test.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    for (int round = 0; round < 2; round++) {
+        SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000101123");
+        EXPECT_EQ(it->Error(), kOk);
+        int n = 123;
+        while (!it->Done()) {
+            char key[256];
+            snprintf(key, sizeof(key), "key_%09d", n);
+            EXPECT_EQ(it->Key(), std::string(key));
+            it->Next();
+            n++;
+        }
+        EXPECT_EQ(it->Error(), kOk);
+        EXPECT_EQ(n, 101123);
+        delete it;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, ReadMmap) {
+    if (g_file_type == kHdfsFile) {
+        return; //only local files can be mapped
+    }
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(kLocalMmapFile, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000101123");
+    EXPECT_EQ(it->Error(), kOk);
+    int n = 123;
+    while (!it->Done()) {
+        char key[256];
+        char value[256];
+        snprintf(key, sizeof(key), "key_%09d", n);
+        snprintf(value, sizeof(value), "value_%d", n*2);
+        EXPECT_EQ(it->Key(), std::string(key));
+        EXPECT_EQ(it->Value(), std::string(value));
+        it->Next();
+        n++;
+    }
+    EXPECT_EQ(it->Error(), kOk);
+    EXPECT_EQ(n, 101123);
+    delete it;
+    it = reader->Scan("key_007499990", "");
+    n = 7499990;
+    while (!it->Done()) {
+        it->Next();
+        n++;
+    }
+    EXPECT_EQ(n, total + 1);
+    delete it;
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutBloom) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["bloom_bits_per_key"] = "10";
+    std::string file_path = g_work_dir + "/put_test_bloom.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int i = 0; i < 25000; i++) {
+        snprintf(key, sizeof(key), "key_%09d", i * 2);
+        snprintf(value, sizeof(value), "value_%d", i * 2);
+        status = writer->Put(key, value);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadBloom) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_bloom.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    int found = 0;
+    for (int i = 1000; i < 3000; i++) {
+        char key[256];
+        snprintf(key, sizeof(key), "key_%09d", i);
+        std::string end_key(key);
+        end_key.push_back('\0');
+        SortFileReader::Iterator *it = reader->Scan(key, end_key);
+        EXPECT_EQ(it->Error(), kOk);
+        if (!it->Done()) {
+            EXPECT_EQ(it->Key(), std::string(key));
+            EXPECT_EQ(i % 2, 0);
+            found++;
+            it->Next();
+        }
+        EXPECT_TRUE(it->Done());
+        delete it;
+    }
+    EXPECT_EQ(found, 1000);
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
+    EXPECT_GT(stat.filtered, 900); //about 1% false positive with 10 bits
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutPartition) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["partitioned"] = "true";
+    std::string file_path = g_work_dir + "/put_test_partition.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int partition = 0; partition < 10; partition++) {
+        if (partition == 5) {
+            continue;
+        }
+        for (int i = 0; i < 3000; i++) {
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, i);
+            status = writer->Put(PartitionPrefix(partition) + key, value);
+            EXPECT_EQ(status, kOk);
+        }
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadPartition) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_partition.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    for (int partition = 9; partition >= 0; partition--) {
+        SortFileReader::Iterator *it = reader->ScanPartition(partition);
+        EXPECT_EQ(it->Error(), kOk);
+        int n = 0;
+        while (!it->Done()) {
+            char key[256];
+            char value[256];
+            snprintf(key, sizeof(key), "key_%09d", n);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, n);
+            EXPECT_EQ(it->Key(), std::string(key));
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            n++;
+        }
+        EXPECT_TRUE(it->Error() == kOk || it->Error() == kNoMore);
+        EXPECT_EQ(n, partition == 5 ? 0 : 3000);
+        delete it;
+    }
+    SortFileReader::Iterator *it = reader->ScanPartition(100);
+    EXPECT_TRUE(it->Done());
+    delete it;
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutAsync) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["partitioned"] = "true";
+    param["compress_threads"] = "3";
+    param["max_inflight_blocks"] = "4";
+    std::string file_path = g_work_dir + "/put_test_async.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int partition = 0; partition < 10; partition++) {
+        if (partition == 5) {
+            continue;
+        }
+        for (int i = 0; i < 30000; i++) {
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, i);
+            status = writer->Put(PartitionPrefix(partition) + key, value);
+            EXPECT_EQ(status, kOk);
+        }
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+    delete writer;
+}
+
+TEST(HdfsTest, ReadAsync) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_async.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    for (int partition = 0; partition < 10; partition++) {
+        SortFileReader::Iterator *it = reader->ScanPartition(partition);
+        int n = 0;
+        while (!it->Done()) {
+            char key[256];
+            char value[256];
+            snprintf(key, sizeof(key), "key_%09d", n);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, n);
+            EXPECT_EQ(it->Key(), std::string(key));
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            n++;
+        }
+        EXPECT_TRUE(it->Error() == kOk || it->Error() == kNoMore);
+        EXPECT_EQ(n, partition == 5 ? 0 : 30000);
+        delete it;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutAppend) {
+    //the records of PutPartition in 3 segments, partition 4 is cut by the first two
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    Status status;
+    SortFileWriter* writer = NULL;
+    int segment = -1;
+    for (int partition = 0; partition < 10; partition++) {
+        if (partition == 5) {
+            continue;
+        }
+        for (int i = 0; i < 3000; i++) {
+            int cur = (partition < 4 || (partition == 4 && i < 1000)) ? 0
+                      : (partition < 6 || (partition == 6 && i < 2000)) ? 1 : 2;
+            if (cur != segment) {
+                if (writer != NULL) {
+                    EXPECT_EQ(writer->Close(), kOk);
+                    delete writer;
+                }
+                segment = cur;
+                writer = SortFileWriter::Create(g_file_type, &status);
+                EXPECT_EQ(status, kOk);
+                FileSystem::Param param;
+                param["partitioned"] = "true";
+                snprintf(key, sizeof(key), "/put_test_segment%d.data", segment);
+                EXPECT_EQ(writer->Open(g_work_dir + key, param), kOk);
+            }
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, i);
+            status = writer->Put(PartitionPrefix(partition) + key, value);
+            EXPECT_EQ(status, kOk);
+        }
+    }
+    EXPECT_EQ(writer->Close(), kOk);
+    delete writer;
+
+    writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["partitioned"] = "true";
+    std::string file_path = g_work_dir + "/put_test_append.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    for (int i = 0; i < 3; i++) {
+        snprintf(key, sizeof(key), "/put_test_segment%d.data", i);
+        status = writer->Append(g_work_dir + key, FileSystem::Param(), g_file_type);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Append(g_work_dir + "/put_test_segment0.data",
+                            FileSystem::Param(), g_file_type);
+    EXPECT_EQ(status, kInvalidArg);
+    status = writer->Put(PartitionPrefix(10) + "key", "value");
+    EXPECT_EQ(status, kInvalidArg);
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+    delete writer;
+}
+
+TEST(HdfsTest, ReadAppend) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_append.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    for (int partition = 9; partition >= 0; partition--) {
+        SortFileReader::Iterator *it = reader->ScanPartition(partition);
+        EXPECT_EQ(it->Error(), kOk);
+        int n = 0;
+        while (!it->Done()) {
+            char key[256];
+            char value[256];
+            snprintf(key, sizeof(key), "key_%09d", n);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, n);
+            EXPECT_EQ(it->Key(), std::string(key));
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            n++;
+        }
+        EXPECT_TRUE(it->Error() == kOk || it->Error() == kNoMore);
+        EXPECT_EQ(n, partition == 5 ? 0 : 3000);
+        delete it;
+    }
+    SortFileReader::Iterator *it = reader->Scan("", "");
+    int n = 0;
+    while (!it->Done()) {
+        it->Next();
+        n++;
+    }
+    EXPECT_EQ(n, 27000);
+    delete it;
+    std::vector<std::string> keys;
+    status = reader->GetIndexKeys(&keys);
+    EXPECT_EQ(status, kOk);
+    EXPECT_FALSE(keys.empty());
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutManyPartitions) {
+    //a block for each partition, too many blocks for one index block
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["partitioned"] = "true";
+    std::string file_path = g_work_dir + "/put_test_many_partitions.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int partition = 0; partition < 20000; partition++) {
+        for (int i = 0; i < 2; i++) {
+            snprintf(key, sizeof(key), "key_%09d", i);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, i);
+            status = writer->Put(PartitionPrefix(partition) + key, value);
+            EXPECT_EQ(status, kOk);
+        }
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+    delete writer;
+}
+
+TEST(HdfsTest, ReadManyPartitions) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_many_partitions.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("", "");
+    int n = 0;
+    std::string last_key;
+    while (!it->Done()) {
+        EXPECT_LT(last_key, it->Key().ToString());
+        last_key = it->Key().ToString();
+        it->Next();
+        n++;
+    }
+    EXPECT_TRUE(it->Error() == kOk || it->Error() == kNoMore);
+    EXPECT_EQ(n, 40000);
+    delete it;
+    char key[256];
+    char value[256];
+    int partitions[] = {0, 1, 4095, 4096, 14999, 15000, 15001, 19999};
+    for (size_t i = 0; i < sizeof(partitions) / sizeof(int); i++) {
+        int partition = partitions[i];
+        it = reader->ScanPartition(partition);
+        EXPECT_EQ(it->Error(), kOk);
+        n = 0;
+        while (!it->Done()) {
+            snprintf(key, sizeof(key), "key_%09d", n);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, n);
+            EXPECT_EQ(it->Key(), std::string(key));
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            n++;
+        }
+        EXPECT_EQ(n, 2);
+        delete it;
+        //point lookup of the second record
+        snprintf(key, sizeof(key), "key_%09d", 1);
+        std::string point_key = PartitionPrefix(partition) + key;
+        it = reader->Scan(point_key, point_key + std::string("\0", 1));
+        n = 0;
+        while (!it->Done()) {
+            EXPECT_EQ(it->Key(), point_key);
+            snprintf(value, sizeof(value), "value_%d_%d", partition, 1);
+            EXPECT_EQ(it->Value(), std::string(value));
+            it->Next();
+            n++;
+        }
+        EXPECT_EQ(n, 1);
+        delete it;
+    }
+    //a range across partitions
+    snprintf(key, sizeof(key), "key_%09d", 1);
+    it = reader->Scan(PartitionPrefix(14998) + key, PartitionPrefix(15002));
+    n = 0;
+    while (!it->Done()) {
+        it->Next();
+        n++;
+    }
+    EXPECT_EQ(n, 7);
+    delete it;
+    std::vector<std::string> keys;
+    status = reader->GetIndexKeys(&keys);
+    EXPECT_EQ(status, kOk);
+    EXPECT_GT(keys.size(), 1u);
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    snprintf(key, sizeof(key), "key_%09d", 0);
+    EXPECT_EQ(keys.front(), PartitionPrefix(0) + key);
+    //the blocks before the start block are skipped, by the index or the partitions
+    ReaderStatistics stat;
+    reader->GetStatistics(&stat);
+    int64_t skipped = stat.blocks_skipped;
+    it = reader->ScanPartition(19999);
+    delete it;
+    reader->GetStatistics(&stat);
+    EXPECT_EQ(stat.blocks_skipped - skipped, 19999);
+    skipped = stat.blocks_skipped;
+    it = reader->Scan(PartitionPrefix(15000) + key, "");
+    delete it;
+    reader->GetStatistics(&stat);
+    //the block before may end with the start key, so it is read as well
+    EXPECT_EQ(stat.blocks_skipped - skipped, 14999);
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    delete reader;
+}
+
+TEST(HdfsTest, PutV1) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["sort_file_version"] = "1";
+    std::string file_path = g_work_dir + "/put_test_v1.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int i = 1; i <= 25000; i++) {
+        snprintf(key, sizeof(key), "key_%09d", i);
+        snprintf(value, sizeof(value), "value_%d", i*2);
+        status = writer->Put(key, value);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadV1) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_v1.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000011123");
+    EXPECT_EQ(it->Error(), kOk);
+    int n = 123;
+    while (!it->Done()) {
+        char key[256];
+        char value[256];
+        snprintf(key, sizeof(key), "key_%09d", n);
+        snprintf(value, sizeof(value), "value_%d", n*2);
+        EXPECT_EQ(it->Key(), std::string(key));
+        EXPECT_EQ(it->Value(), std::string(value));
+        it->Next();
+        n++;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    EXPECT_EQ(n, 11123);
+    delete it;
+}
+
+TEST(HdfsTest, PutV2) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["sort_file_version"] = "2";
+    std::string file_path = g_work_dir + "/put_test_v2.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int i = 1; i <= 25000; i++) {
+        snprintf(key, sizeof(key), "key_%09d", i);
+        snprintf(value, sizeof(value), "value_%d", i*2);
+        status = writer->Put(key, value);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadV2) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_v2.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000011123");
+    EXPECT_EQ(it->Error(), kOk);
+    int n = 123;
+    while (!it->Done()) {
+        char key[256];
+        char value[256];
+        snprintf(key, sizeof(key), "key_%09d", n);
+        snprintf(value, sizeof(value), "value_%d", n*2);
+        EXPECT_EQ(it->Key(), std::string(key));
+        EXPECT_EQ(it->Value(), std::string(value));
+        it->Next();
+        n++;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    EXPECT_EQ(n, 11123);
+    delete it;
+}
+
+TEST(HdfsTest, PutLz4) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["compression"] = "lz4";
+    std::string file_path = g_work_dir + "/put_test_lz4.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int i = 1; i <= 25000; i++) {
+        snprintf(key, sizeof(key), "key_%09d", i);
+        snprintf(value, sizeof(value), "value_%d", i*2);
+        status = writer->Put(key, value);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadLz4) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_lz4.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000011123");
+    EXPECT_EQ(it->Error(), kOk);
+    int n = 123;
+    while (!it->Done()) {
+        char key[256];
+        char value[256];
+        snprintf(key, sizeof(key), "key_%09d", n);
+        snprintf(value, sizeof(value), "value_%d", n*2);
+        EXPECT_EQ(it->Key(), std::string(key));
+        EXPECT_EQ(it->Value(), std::string(value));
+        it->Next();
+        n++;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    EXPECT_EQ(n, 11123);
+    delete it;
+}
+
+TEST(HdfsTest, PutZstd) {
+    Status status;
+    SortFileWriter* writer = SortFileWriter::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    param["compression"] = "zstd";
+    std::string file_path = g_work_dir + "/put_test_zstd.data";
+    status = writer->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    char key[256] = {'\0'};
+    char value[256] = {'\0'};
+    for (int i = 1; i <= 25000; i++) {
+        snprintf(key, sizeof(key), "key_%09d", i);
+        snprintf(value, sizeof(value), "value_%d", i*2);
+        status = writer->Put(key, value);
+        EXPECT_EQ(status, kOk);
+    }
+    status = writer->Close();
+    EXPECT_EQ(status, kOk);
+}
+
+TEST(HdfsTest, ReadZstd) {
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(g_file_type, &status);
+    EXPECT_EQ(status, kOk);
+    FileSystem::Param param;
+    std::string file_path = g_work_dir + "/put_test_zstd.data";
+    status = reader->Open(file_path, param);
+    EXPECT_EQ(status, kOk);
+    SortFileReader::Iterator *it = reader->Scan("key_000000123", "key_000011123");
+    EXPECT_EQ(it->Error(), kOk);
+    int n = 123;
+    while (!it->Done()) {
+        char key[256];
+        char value[256];
+        snprintf(key, sizeof(key), "key_%09d", n);
+        snprintf(value, sizeof(value), "value_%d", n*2);
+        EXPECT_EQ(it->Key(), std::string(key));
+        EXPECT_EQ(it->Value(), std::string(value));
+        it->Next();
+        n++;
+    }
+    status = reader->Close();
+    EXPECT_EQ(status, kOk);
+    EXPECT_EQ(n, 11123);
+    delete it;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         printf("./sort_test [hdfs work dir] [filetype](optional) \n");
@@ -346,6 +1023,10 @@ int main(int argc, char* argv[]) {
             g_file_type = kHdfsFile;
         } else if (strcmp(argv[2], "local") == 0) {
             g_file_type = kLocalFile;
+        } else if (strcmp(argv[2], "mmap") == 0) {
+            g_file_type = kLocalMmapFile;
+        } else if (strcmp(argv[2], "nfs") == 0) {
+            g_file_type = kNfsFile;
         }
     }
     g_work_dir = argv[1];
@@ -1,6 +1,7 @@
 #include "sort_file_impl.h"
+#include <boost/bind.hpp>
 #include "logging.h"
-#include <snappy.h>
+#include "timer.h"
 
 using baidu::common::INFO;
 using baidu::common::WARNING;
@@ -10,8 +11,75 @@ namespace shuttle {
 
 const static int32_t sBlockSize = (64 << 10);
 const static int32_t sMagicNumber = 25997;
+const static int32_t sMagicNumberV2 = 25998;
+const static int32_t sRestartInterval = 16;
 const static int32_t sMaxIndexSize = 15000;
 const static size_t sMaxIndexBytes = (56 << 20);
+const static int64_t sReadAheadBytes = (16 << 20);
+const static int32_t sIndexPartitionSize = 4096;
+const static size_t sIndexPartitionBytes = (4 << 20);
+const static size_t sMaxCachedIndexPartitions = 8;
+const static int32_t sMaxInflightBlocks = 16;
+const static int32_t sCopyChunkSize = (4 << 20);
+
+static void PutFixed32(std::string* dst, uint32_t value) {
+    dst->append((const char*)&value, sizeof(value));
+}
+
+static uint32_t DecodeFixed32(const char* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static void PutVarint32(std::string* dst, uint32_t value) {
+    char buf[5];
+    int len = 0;
+    while (value >= 128) {
+        buf[len++] = (value & 127) | 128;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    dst->append(buf, len);
+}
+
+static const char* GetVarint32Ptr(const char* p, const char* limit, uint32_t* value) {
+    uint32_t result = 0;
+    for (uint32_t shift = 0; shift <= 28 && p < limit; shift += 7) {
+        uint32_t byte = *(reinterpret_cast<const unsigned char*>(p));
+        p++;
+        if (byte & 128) {
+            result |= ((byte & 127) << shift);
+        } else {
+            result |= (byte << shift);
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+std::string PartitionPrefix(int32_t partition) {
+    char buf[sPartitionPrefixSize];
+    uint32_t value = partition;
+    buf[0] = (value >> 24) & 0xff;
+    buf[1] = (value >> 16) & 0xff;
+    buf[2] = (value >> 8) & 0xff;
+    buf[3] = value & 0xff;
+    return std::string(buf, sizeof(buf));
+}
+
+struct PartitionRangeLess {
+    bool operator()(const PartitionRange& range, int32_t partition) const {
+        return range.partition() < partition;
+    }
+};
+
+static int32_t DecodePartition(const char* ptr) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(ptr);
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                     | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
 
 SortFileReader* SortFileReader::Create(FileType file_type, Status* status) {
     if (file_type == kHdfsFile) {
@@ -20,6 +88,15 @@ SortFileReader* SortFileReader::Create(FileType file_type, Status* status) {
     } else if (file_type == kLocalFile) {
         *status = kOk;
         return new SortFileReaderImpl(FileSystem::CreateLocalFs());
+    } else if (file_type == kLocalMmapFile) {
+        *status = kOk;
+        return new SortFileReaderImpl(FileSystem::CreateMmapFs());
+    } else if (file_type == kNfsFile) {
+        *status = kOk;
+        return new SortFileReaderImpl(FileSystem::CreateNfs());
+    } else if (file_type == kShuffleFile) {
+        *status = kOk;
+        return new SortFileReaderImpl(FileSystem::CreateShuffleFs());
     } else {
         *status = kNotImplement;
         return NULL;
@@ -30,9 +107,12 @@ SortFileWriter* SortFileWriter::Create(FileType file_type, Status* status) {
     if (file_type == kHdfsFile) {
         *status = kOk;
         return new SortFileWriterImpl(FileSystem::CreateInfHdfs());
-    } else if (file_type == kLocalFile) {
+    } else if (file_type == kLocalFile || file_type == kLocalMmapFile) {
         *status = kOk;
         return new SortFileWriterImpl(FileSystem::CreateLocalFs());
+    } else if (file_type == kNfsFile) {
+        *status = kOk;
+        return new SortFileWriterImpl(FileSystem::CreateNfs());
     } else {
         *status = kNotImplement;
         return NULL;
@@ -44,7 +124,11 @@ SortFileReaderImpl::IteratorImpl::IteratorImpl(const std::string& start_key,
                                                SortFileReaderImpl* reader) {
     reader_ = reader;
     error_ = kOk;
-    cur_offset_ = 0;
+    block_offsets_ = NULL;
+    block_items_ = 0;
+    cur_offset_ = -1;
+    next_pos_ = 0;
+    key_prefix_size_ = 0;
     start_key_ = start_key;
     end_key_ = end_key;
 }
@@ -61,37 +145,198 @@ const std::string SortFileReaderImpl::IteratorImpl::GetFileName() {
     }
 }
 
+Status SortFileReaderImpl::IteratorImpl::LoadBlock() {
+    Status status = reader_->NextBlock(&block_buf_);
+    if (status != kOk) {
+        return status;
+    }
+    reader_->stat_.blocks_decoded++;
+    cur_offset_ = -1;
+    next_pos_ = 0;
+    key_buf_.clear();
+    if (reader_->version_ == sSortFileV1) {
+        if (!cur_block_.ParseFromString(block_buf_)) {
+            LOG(WARNING, "bad format block, %s", reader_->path_.c_str());
+            return kUnKnown;
+        }
+        block_items_ = cur_block_.items_size();
+        return kOk;
+    }
+    //[item]...[item][offset]...[offset][number of offsets]
+    //v2 has an offset for every item, v3 only for restart points
+    size_t buf_size = block_buf_.size();
+    if (buf_size < sizeof(uint32_t)) {
+        LOG(WARNING, "bad format block, %s", reader_->path_.c_str());
+        return kUnKnown;
+    }
+    const char* limit = block_buf_.data() + buf_size - sizeof(uint32_t);
+    uint32_t n_offsets = DecodeFixed32(limit);
+    if (n_offsets > (buf_size - sizeof(uint32_t)) / sizeof(uint32_t)) {
+        LOG(WARNING, "bad offset number of block: %u, %s", n_offsets, reader_->path_.c_str());
+        return kUnKnown;
+    }
+    block_offsets_ = limit - n_offsets * sizeof(uint32_t);
+    block_items_ = n_offsets;
+    return kOk;
+}
+
+bool SortFileReaderImpl::IteratorImpl::ParseItem(int offset, Slice* key, Slice* value) {
+    if (reader_->version_ == sSortFileV1) {
+        const KeyValue& item = cur_block_.items(offset);
+        *key = item.key();
+        *value = item.value();
+        return true;
+    }
+    const char* base = block_buf_.data();
+    const char* limit = block_offsets_;
+    uint32_t pos = DecodeFixed32(block_offsets_ + offset * sizeof(uint32_t));
+    if (pos >= (uint32_t)(limit - base)) {
+        return false;
+    }
+    uint32_t key_len = 0;
+    uint32_t value_len = 0;
+    const char* p = GetVarint32Ptr(base + pos, limit, &key_len);
+    if (p != NULL) {
+        p = GetVarint32Ptr(p, limit, &value_len);
+    }
+    if (p == NULL || (size_t)key_len + value_len > (size_t)(limit - p)) {
+        return false;
+    }
+    *key = Slice(p, key_len);
+    *value = Slice(p + key_len, value_len);
+    return true;
+}
+
+bool SortFileReaderImpl::IteratorImpl::ParseEntry(uint32_t pos, bool is_restart) {
+    //v3 item: [varint shared][varint non shared][varint value len][key delta][value]
+    const char* base = block_buf_.data();
+    const char* limit = block_offsets_;
+    if (pos >= (uint32_t)(limit - base)) {
+        return false;
+    }
+    uint32_t shared = 0;
+    uint32_t non_shared = 0;
+    uint32_t value_len = 0;
+    const char* p = GetVarint32Ptr(base + pos, limit, &shared);
+    if (p != NULL) {
+        p = GetVarint32Ptr(p, limit, &non_shared);
+    }
+    if (p != NULL) {
+        p = GetVarint32Ptr(p, limit, &value_len);
+    }
+    if (is_restart) {
+        key_buf_.clear();
+    }
+    if (p == NULL || shared > key_buf_.size()
+        || (size_t)non_shared + value_len > (size_t)(limit - p)) {
+        return false;
+    }
+    key_buf_.resize(shared);
+    key_buf_.append(p, non_shared);
+    key_ = key_buf_;
+    value_ = Slice(p + non_shared, value_len);
+    next_pos_ = (p + non_shared + value_len) - base;
+    return true;
+}
+
+bool SortFileReaderImpl::IteratorImpl::NextInBlock() {
+    if (reader_->version_ < sSortFileV3) {
+        cur_offset_ ++;
+        if (cur_offset_ >= block_items_) {
+            return false;
+        }
+        if (!ParseItem(cur_offset_, &key_, &value_)) {
+            LOG(WARNING, "bad item in block, %s", reader_->path_.c_str());
+            error_ = kUnKnown;
+            return false;
+        }
+        return true;
+    }
+    if (next_pos_ >= (uint32_t)(block_offsets_ - block_buf_.data())) {
+        return false; //reach the restart array
+    }
+    if (!ParseEntry(next_pos_, false)) {
+        LOG(WARNING, "bad item in block, %s", reader_->path_.c_str());
+        error_ = kUnKnown;
+        return false;
+    }
+    return true;
+}
+
+bool SortFileReaderImpl::IteratorImpl::SeekInBlock(const Slice& target) {
+    if (reader_->version_ < sSortFileV3) {
+        //every item is addressable, find the first one not less than target
+        int low = 0;
+        int high = block_items_;
+        Slice key;
+        Slice value;
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+            if (!ParseItem(mid, &key, &value)) {
+                LOG(WARNING, "bad item in block, %s", reader_->path_.c_str());
+                error_ = kUnKnown;
+                return false;
+            }
+            if (key < target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        cur_offset_ = low - 1;
+        return NextInBlock();
+    }
+    //find the last restart point whose key is less than target,
+    //then walk forward from there, at most one restart interval
+    int low = 0;
+    int high = block_items_ - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        uint32_t pos = DecodeFixed32(block_offsets_ + mid * sizeof(uint32_t));
+        if (!ParseEntry(pos, true)) {
+            LOG(WARNING, "bad restart point in block, %s", reader_->path_.c_str());
+            error_ = kUnKnown;
+            return false;
+        }
+        if (key_ < target) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    if (block_items_ == 0) {
+        return false;
+    }
+    next_pos_ = DecodeFixed32(block_offsets_ + low * sizeof(uint32_t));
+    key_buf_.clear();
+    while (NextInBlock()) {
+        if (!(key_ < target)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void SortFileReaderImpl::IteratorImpl::Init() {
-    if (has_more_ && cur_block_.items_size() == 0) {
+    if (has_more_) {
         //Initiate data for the iterator, locate to the right place
-        Status status = reader_->ReadNextRecord(cur_block_);
-        if (status != kOk) {
-            error_ = status;
-            has_more_ = false;
-            return;
-        }
+        Status status = LoadBlock();
         while (status == kOk) {
-            while(cur_offset_ < cur_block_.items_size() &&
-                  cur_block_.items(cur_offset_).key() < start_key_) {
-                cur_offset_ ++;
-                //printf("%d\n", cur_offset_);
-            } //skip the items less than start_key
-            if (cur_offset_ >= cur_block_.items_size()) {
-                status = reader_->ReadNextRecord(cur_block_);
-                cur_offset_ = 0;
-                //printf("read next block\n");
-                //read the next block
-            } else {
+            if (SeekInBlock(start_key_)) {
                 break;
             }
+            if (error_ != kOk) {
+                has_more_ = false;
+                return;
+            }
+            //all the items are less than start_key, read the next block
+            status = LoadBlock();
         }
         if (status != kOk) {
             error_ = status;
             has_more_ = false;
             return;
         }
-        key_ = cur_block_.items(cur_offset_).key();
-        value_ =  cur_block_.items(cur_offset_).value();
         if (key_ >= end_key_ && !end_key_.empty()) {
             has_more_ = false;
             return;
@@ -104,30 +349,38 @@ bool SortFileReaderImpl::IteratorImpl::Done() {
 }
 
 void SortFileReaderImpl::IteratorImpl::Next() {
-    cur_offset_ ++ ;
-    if (cur_offset_ >= cur_block_.items_size()) {
-        Status status = reader_->ReadNextRecord(cur_block_);
+    if (!NextInBlock()) {
+        if (error_ != kOk) {
+            has_more_ = false;
+            return;
+        }
+        Status status = LoadBlock();
         if (status != kOk) {
             error_ = status;
             has_more_ = false;
             return;
         }
-        cur_offset_ = 0;
+        if (!NextInBlock()) {
+            LOG(WARNING, "empty block, %s", reader_->path_.c_str());
+            error_ = kUnKnown;
+            has_more_ = false;
+            return;
+        }
     }
-    if (cur_block_.items(cur_offset_).key() >= end_key_
-        && !end_key_.empty()) {
+    if (key_ >= end_key_ && !end_key_.empty()) {
         has_more_ = false;
         return;
     }
-    key_ = cur_block_.items(cur_offset_).key();
-    value_ = cur_block_.items(cur_offset_).value();
 }
 
-const std::string& SortFileReaderImpl::IteratorImpl::Key() {
+Slice SortFileReaderImpl::IteratorImpl::Key() {
+    if (key_prefix_size_ > 0 && key_.size() >= key_prefix_size_) {
+        return Slice(key_.data() + key_prefix_size_, key_.size() - key_prefix_size_);
+    }
     return key_;
 }
 
-const std::string& SortFileReaderImpl::IteratorImpl::Value() {
+Slice SortFileReaderImpl::IteratorImpl::Value() {
     return value_;
 }
 
@@ -143,6 +396,10 @@ void SortFileReaderImpl::IteratorImpl::SetHasMore(bool has_more) {
     has_more_ = has_more;
 }
 
+void SortFileReaderImpl::IteratorImpl::SetKeyPrefixSize(size_t size) {
+    key_prefix_size_ = size;
+}
+
 Status SortFileReaderImpl::ReadFull(std::string* result_buf, int32_t len,
                                     bool is_read_data) {
     if (result_buf == NULL || len < 0 ) {
@@ -194,55 +451,238 @@ Status SortFileReaderImpl::ReadFull(std::string* result_buf, int32_t len,
     return status;
 }
 
-Status SortFileReaderImpl::ReadNextRecord(DataBlock& data_block) {
-    int32_t block_size;
-    int n_read = fs_->Read((void*)&block_size, sizeof(int32_t));
+Status SortFileReaderImpl::ReadBlockHeader(int32_t* block_size, std::string* first_key) {
+    //v4 block: [block size][first key size][first key][compressed block]
+    //other versions: [block size][compressed block]
+    if (fs_->Tell() >= data_end_) {
+        return kNoMore;
+    }
+    int n_read = fs_->Read((void*)block_size, sizeof(int32_t));
     //LOG(INFO, "read: %s, block_size: %ld", path_.c_str(), block_size);
     if (n_read != sizeof(int32_t)) {
         LOG(WARNING, "fail to read block size, %s", path_.c_str());
         return kReadFileFail;
     }
-    std::string block_raw, block_uncompress;
-    Status status = ReadFull(&block_raw, block_size, true);
+    if (version_ < sSortFileV4) {
+        return kOk;
+    }
+    int32_t key_size;
+    n_read = fs_->Read((void*)&key_size, sizeof(int32_t));
+    if (n_read != sizeof(int32_t)) {
+        LOG(WARNING, "fail to read key size of block, %s", path_.c_str());
+        return kReadFileFail;
+    }
+    first_key->clear();
+    if (key_size > 0) {
+        return ReadFull(first_key, key_size, true);
+    }
+    return kOk;
+}
+
+Status SortFileReaderImpl::ReadNextRecord(std::string* block_buf) {
+    int32_t block_size;
+    std::string first_key;
+    Status status = ReadBlockHeader(&block_size, &first_key);
     if (status != kOk) {
         return status;
     }
-    snappy::Uncompress(block_raw.data(), block_raw.size(), &block_uncompress);
-    bool ret = data_block.ParseFromString(block_uncompress);
-    if (!ret) {
-        LOG(WARNING, "bad format block, %s", path_.c_str());
+    if (block_size < 0) {
+        LOG(WARNING, "bad block size: %d, %s", block_size, path_.c_str());
+        return kInvalidArg;
+    }
+    std::string block_raw;
+    const char* raw_data = NULL;
+    int32_t n_read = fs_->ReadZeroCopy(&raw_data, block_size);
+    if (n_read >= 0) {
+        //the file is mapped, uncompress right from the mapping
+        if (n_read < block_size || fs_->Tell() > idx_offset_) {
+            LOG(WARNING, "no more data block, %s", path_.c_str());
+            return kNoMore;
+        }
+    } else {
+        status = ReadFull(&block_raw, block_size, true);
+        if (status != kOk) {
+            return status;
+        }
+        raw_data = block_raw.data();
+    }
+    if (!compressor_->Uncompress(raw_data, block_size, block_buf)) {
+        LOG(WARNING, "fail to uncompress block, %s", path_.c_str());
         return kUnKnown;
     }
     return kOk;
 }
 
-Status SortFileReaderImpl::LoadIndexBlock(IndexBlock* idx_block) {
+Status SortFileReaderImpl::NextBlock(std::string* block_buf) {
+    if (read_ahead_blocks_ <= 0) {
+        return ReadNextRecord(block_buf);
+    }
+    if (!read_ahead_running_) {
+        StartReadAhead();
+    }
+    MutexLock lock(&mu_);
+    if (read_ahead_queue_.empty()) {
+        int64_t start = common::timer::get_micros();
+        while (read_ahead_queue_.empty()) {
+            not_empty_.Wait();
+        }
+        stat_.stall_micros += common::timer::get_micros() - start;
+    }
+    ReadAheadItem* item = read_ahead_queue_.front();
+    if (item->status != kOk) {
+        return item->status; //keep it in queue, the read-ahead has ended
+    }
+    read_ahead_queue_.pop_front();
+    read_ahead_queued_bytes_ -= item->block.size();
+    not_full_.Signal();
+    block_buf->swap(item->block);
+    delete item;
+    return kOk;
+}
+
+void SortFileReaderImpl::StartReadAhead() {
+    //the read-ahead thread owns fs_ until it is stopped
+    read_ahead_stop_ = false;
+    read_ahead_running_ = true;
+    read_ahead_thread_.Start(boost::bind(&SortFileReaderImpl::ReadAheadLoop, this));
+}
+
+void SortFileReaderImpl::StopReadAhead() {
+    if (!read_ahead_running_) {
+        return;
+    }
+    {
+        MutexLock lock(&mu_);
+        read_ahead_stop_ = true;
+        not_full_.Signal();
+    }
+    read_ahead_thread_.Join();
+    read_ahead_running_ = false;
+    std::deque<ReadAheadItem*>::iterator it;
+    for (it = read_ahead_queue_.begin(); it != read_ahead_queue_.end(); it++) {
+        delete *it;
+    }
+    read_ahead_queue_.clear();
+    read_ahead_queued_bytes_ = 0;
+}
+
+void SortFileReaderImpl::ReadAheadLoop() {
+    while (true) {
+        {
+            MutexLock lock(&mu_);
+            while (!read_ahead_stop_
+                   && ((int32_t)read_ahead_queue_.size() >= read_ahead_blocks_
+                       || read_ahead_queued_bytes_ >= read_ahead_bytes_)) {
+                not_full_.Wait();
+            }
+            if (read_ahead_stop_) {
+                return;
+            }
+        }
+        ReadAheadItem* item = new ReadAheadItem();
+        item->status = ReadNextRecord(&item->block);
+        MutexLock lock(&mu_);
+        read_ahead_queue_.push_back(item);
+        read_ahead_queued_bytes_ += item->block.size();
+        not_empty_.Signal();
+        if (item->status != kOk) {
+            return; //no more blocks or failed
+        }
+    }
+}
+
+Status SortFileReaderImpl::LoadFooter(int64_t* index_offset) {
+    //v1 ends with: [index offset][magic]
+    //v2 ends with: [FileFooter][footer size][magic v2]
     int64_t file_size = fs_->GetSize();
-    int32_t magic_number;
-    int64_t index_offset;
-    int32_t index_size;
-    int32_t span = sizeof(int32_t) + sizeof(int64_t);
-    if (file_size <= 0 || !fs_->Seek(file_size - span)) {
+    char tail[sizeof(int64_t) + sizeof(int32_t)];
+    int32_t span = sizeof(tail);
+    if (file_size < span || !fs_->Seek(file_size - span)) {
         LOG(WARNING, "fail to seek the foot of %s", path_.c_str());
         return kOpenFileFail;
     }
-    int n_read = fs_->Read((void*)&index_offset, sizeof(int64_t));
-    if (n_read != sizeof(int64_t)) {
-        LOG(WARNING, "fail to read index offset, %s, %d", path_.c_str(), n_read);
+    int n_read = fs_->Read((void*)tail, span);
+    if (n_read != span) {
+        LOG(WARNING, "fail to read the foot of %s, %d", path_.c_str(), n_read);
         return kOpenFileFail;
     }
-    n_read = fs_->Read((void*)&magic_number, sizeof(int32_t));
-    if (n_read != sizeof(int32_t) || magic_number != sMagicNumber) {
+    int32_t magic_number = DecodeFixed32(tail + sizeof(int64_t));
+    filter_offset_ = 0;
+    filter_size_ = 0;
+    partitioned_ = false;
+    partitions_.clear();
+    if (magic_number == sMagicNumber) {
+        version_ = sSortFileV1;
+        memcpy(index_offset, tail, sizeof(int64_t));
+        return kOk;
+    }
+    if (magic_number != sMagicNumberV2) {
         LOG(WARNING, "fail to read index magic, %s, %d", path_.c_str(), magic_number);
         return kBadMagic;
     }
-    if (!fs_->Seek(index_offset)) {
-        LOG(WARNING, "fail to seek the start index offset of %s at %ld",
-            path_.c_str(), index_offset);
+    int32_t footer_size = DecodeFixed32(tail + sizeof(int32_t));
+    int64_t footer_offset = file_size - footer_size - 2 * sizeof(int32_t);
+    if (footer_size <= 0 || footer_offset < 0 || !fs_->Seek(footer_offset)) {
+        LOG(WARNING, "fail to seek the footer of %s, size: %d", path_.c_str(), footer_size);
         return kOpenFileFail;
     }
+    std::string footer_buf;
+    Status status = ReadFull(&footer_buf, footer_size);
+    if (status != kOk) {
+        LOG(WARNING, "read footer fail, %s", Status_Name(status).c_str());
+        return status;
+    }
+    FileFooter footer;
+    if (!footer.ParseFromString(footer_buf)) {
+        LOG(WARNING, "unserialize footer fail, %s", path_.c_str());
+        return kUnKnown;
+    }
+    if (footer.version() < sSortFileV1 || footer.version() > sSortFileV5) {
+        LOG(WARNING, "unsupported version %d of %s", footer.version(), path_.c_str());
+        return kNotImplement;
+    }
+    if (footer.compression() != compressor_->Type()) {
+        Compressor* compressor = Compressor::Create(footer.compression());
+        if (compressor == NULL) {
+            LOG(WARNING, "unsupported compression %d of %s",
+                footer.compression(), path_.c_str());
+            return kNotImplement;
+        }
+        delete compressor_;
+        compressor_ = compressor;
+    }
+    version_ = footer.version();
+    *index_offset = footer.index_offset();
+    filter_offset_ = footer.filter_offset();
+    filter_size_ = footer.filter_size();
+    partitioned_ = footer.partitioned();
+    partitions_.assign(footer.partitions().begin(), footer.partitions().end());
+    return kOk;
+}
+
+Status SortFileReaderImpl::LoadIndexBlock(IndexBlock* idx_block) {
+    int64_t index_offset;
+    Status status = LoadFooter(&index_offset);
+    if (status != kOk) {
+        return status;
+    }
     idx_offset_ = index_offset;
-    n_read = fs_->Read((void*)&index_size, sizeof(int32_t));
+    status = ReadIndexBlock(index_offset, idx_block);
+    if (status == kOk && version_ >= sSortFileV5 && idx_block->items_size() > 0) {
+        //index partitions are written right after the data blocks
+        idx_offset_ = idx_block->items(0).offset();
+    }
+    return status;
+}
+
+Status SortFileReaderImpl::ReadIndexBlock(int64_t offset, IndexBlock* idx_block) {
+    int32_t index_size;
+    if (!fs_->Seek(offset)) {
+        LOG(WARNING, "fail to seek the start index offset of %s at %ld",
+            path_.c_str(), offset);
+        return kOpenFileFail;
+    }
+    int n_read = fs_->Read((void*)&index_size, sizeof(int32_t));
     if (n_read != sizeof(int32_t)) {
         LOG(WARNING, "fail to read size of index, %s, %d", path_.c_str(), n_read);
         return kOpenFileFail;
@@ -257,7 +697,10 @@ Status SortFileReaderImpl::LoadIndexBlock(IndexBlock* idx_block) {
         return status;
     }
     std::string tmp_buf;
-    snappy::Uncompress(index_raw_buf.data(), index_raw_buf.size(), &tmp_buf);
+    if (!compressor_->Uncompress(index_raw_buf.data(), index_raw_buf.size(), &tmp_buf)) {
+        LOG(WARNING, "fail to uncompress index block, %s", path_.c_str());
+        return kUnKnown;
+    }
     bool ret = idx_block->ParseFromString(tmp_buf);
     if (!ret) {
         LOG(WARNING, "unserialize index block fail, %s, buf_len:%ld", path_.c_str(), tmp_buf.size());
@@ -267,17 +710,236 @@ Status SortFileReaderImpl::LoadIndexBlock(IndexBlock* idx_block) {
     return kOk;
 }
 
+Status SortFileReaderImpl::GetIndexPartition(const std::string& start_key,
+                                             const IndexBlock** idx_block,
+                                             int64_t* first_block) {
+    *first_block = 0;
+    if (version_ < sSortFileV5) {
+        *idx_block = &idx_block_;
+        return kOk;
+    }
+    //the last partition headed by a key less than start_key
+    //holds the last index item less than start_key
+    int low = 0;
+    int high = idx_block_.items_size() - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (idx_block_.items(mid).key() < start_key) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    int64_t offset = idx_block_.items(low).offset();
+    *first_block = idx_block_.items(low).first_block();
+    std::map<int64_t, IndexBlock*>::iterator it = idx_partitions_.find(offset);
+    if (it != idx_partitions_.end()) {
+        *idx_block = it->second;
+        return kOk;
+    }
+    IndexBlock* partition = new IndexBlock();
+    Status status = ReadIndexBlock(offset, partition);
+    if (status != kOk || partition->items_size() == 0) {
+        LOG(WARNING, "fail to load index partition at %ld, %s", offset, path_.c_str());
+        delete partition;
+        return status == kOk ? kUnKnown : status;
+    }
+    if (idx_partition_fifo_.size() >= sMaxCachedIndexPartitions) {
+        int64_t oldest = idx_partition_fifo_.front();
+        idx_partition_fifo_.pop_front();
+        delete idx_partitions_[oldest];
+        idx_partitions_.erase(oldest);
+    }
+    idx_partitions_[offset] = partition;
+    idx_partition_fifo_.push_back(offset);
+    *idx_block = partition;
+    return kOk;
+}
+
+Status SortFileReaderImpl::LoadBlockIndex(IndexBlock* idx_block) {
+    Status status = LoadIndexOnce();
+    if (status != kOk) {
+        return status;
+    }
+    if (version_ < sSortFileV5) {
+        idx_block->CopyFrom(idx_block_);
+        return kOk;
+    }
+    for (int i = 0; i < idx_block_.items_size(); i++) {
+        IndexBlock partition;
+        status = ReadIndexBlock(idx_block_.items(i).offset(), &partition);
+        if (status != kOk || partition.items_size() == 0) {
+            LOG(WARNING, "fail to load index partition %d, %s", i, path_.c_str());
+            return status == kOk ? kUnKnown : status;
+        }
+        idx_block->MergeFrom(partition);
+    }
+    return kOk;
+}
+
+Status SortFileReaderImpl::CopyBlocks(FileSystem* dst) {
+    //data blocks take the file from the start up to the index
+    if (!fs_->Seek(0)) {
+        LOG(WARNING, "fail to seek the start of %s", path_.c_str());
+        return kReadFileFail;
+    }
+    std::string buf(std::min((int64_t)sCopyChunkSize, idx_offset_), '\0');
+    int64_t copied = 0;
+    while (copied < idx_offset_) {
+        size_t len = std::min((int64_t)buf.size(), idx_offset_ - copied);
+        int32_t n_read = fs_->Read((void*)&buf[0], len);
+        if (n_read <= 0) {
+            LOG(WARNING, "fail to read blocks of %s at %ld", path_.c_str(), copied);
+            return kReadFileFail;
+        }
+        if (!dst->WriteAll((void*)buf.data(), n_read)) {
+            LOG(WARNING, "fail to copy blocks of %s", path_.c_str());
+            return kWriteFileFail;
+        }
+        copied += n_read;
+    }
+    return kOk;
+}
+
+void SortFileReaderImpl::ClearIndexPartitions() {
+    std::map<int64_t, IndexBlock*>::iterator it;
+    for (it = idx_partitions_.begin(); it != idx_partitions_.end(); it++) {
+        delete it->second;
+    }
+    idx_partitions_.clear();
+    idx_partition_fifo_.clear();
+}
+
+Status SortFileReaderImpl::LoadFilter() {
+    filter_.clear();
+    if (filter_size_ <= 0) {
+        return kOk;
+    }
+    if (!fs_->Seek(filter_offset_)) {
+        LOG(WARNING, "fail to seek the filter of %s at %ld", path_.c_str(), filter_offset_);
+        return kReadFileFail;
+    }
+    Status status = ReadFull(&filter_, filter_size_);
+    if (status != kOk) {
+        filter_.clear();
+        LOG(WARNING, "read filter fail, %s, %s", path_.c_str(), Status_Name(status).c_str());
+    }
+    return status;
+}
+
+SortFileReaderImpl::SortFileReaderImpl(FileSystem* fs) : version_(sSortFileV1),
+                                                         compressor_(Compressor::Create(kSnappy)),
+                                                         fs_(fs),
+                                                         idx_loaded_(false),
+                                                         filter_offset_(0),
+                                                         filter_size_(0),
+                                                         partitioned_(false),
+                                                         data_end_(0),
+                                                         read_ahead_blocks_(0),
+                                                         read_ahead_bytes_(sReadAheadBytes),
+                                                         read_ahead_running_(false),
+                                                         read_ahead_stop_(false),
+                                                         read_ahead_queued_bytes_(0),
+                                                         not_empty_(&mu_),
+                                                         not_full_(&mu_) {
+
+}
+
+SortFileReaderImpl::~SortFileReaderImpl() {
+    StopReadAhead();
+    ClearIndexPartitions();
+    delete fs_;
+    delete compressor_;
+}
+
 Status SortFileReaderImpl::Open(const std::string& path, FileSystem::Param param) {
     LOG(INFO, "try to open: %s", path.c_str());
     path_ = path;
+    idx_block_.Clear();
+    ClearIndexPartitions();
+    idx_loaded_ = false;
+    if (param.find("read_ahead_blocks") != param.end()) {
+        read_ahead_blocks_ = atoi(param["read_ahead_blocks"].c_str());
+    }
+    if (param.find("read_ahead_bytes") != param.end()) {
+        read_ahead_bytes_ = atol(param["read_ahead_bytes"].c_str());
+        if (read_ahead_bytes_ <= 0) {
+            LOG(WARNING, "invalid read ahead bytes: %ld", read_ahead_bytes_);
+            return kInvalidArg;
+        }
+    }
+    int64_t start = common::timer::get_micros();
     if (!fs_->Open(path, param, kReadFile)) {
         return kOpenFileFail;
     }
+    stat_.open_micros = common::timer::get_micros() - start;
+    stat_.max_open_micros = stat_.open_micros;
     return kOk;
 }
 
+Status SortFileReaderImpl::LoadIndexOnce() {
+    if (idx_loaded_) {
+        return kOk;
+    }
+    LOG(INFO, "try load index of: %s", path_.c_str());
+    Status status = LoadIndexBlock(&idx_block_);
+    for(int i = 0; i < 3 && status != kOk; i++) {
+        idx_block_.Clear();
+        status = LoadIndexBlock(&idx_block_);
+        sleep(1);
+    }
+    if (status != kOk) {
+        LOG(WARNING, "faild to load index block, %s", path_.c_str());
+        return status;
+    }
+    LoadFilter(); //scan without the filter if it is broken
+    idx_loaded_ = true;
+    return kOk;
+}
+
+SortFileReader::Iterator* SortFileReaderImpl::ScanPartition(int32_t partition) {
+    StopReadAhead();
+    std::string start_key = PartitionPrefix(partition);
+    std::string end_key = PartitionPrefix(partition + 1);
+    if (LoadIndexOnce() != kOk) {
+        IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
+        it->SetHasMore(false);
+        it->SetError(kReadFileFail);
+        return it;
+    }
+    if (!partitioned_) {
+        //written before the partition directory, keys look like "%05d\t" + key
+        char s_partition[256];
+        snprintf(s_partition, sizeof(s_partition), "%05d", partition);
+        IteratorImpl* it = static_cast<IteratorImpl*>(
+            Scan(s_partition, std::string(s_partition) + "\xff"));
+        it->SetKeyPrefixSize(strlen(s_partition) + 1);
+        return it;
+    }
+    IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
+    it->SetKeyPrefixSize(sPartitionPrefixSize);
+    std::vector<PartitionRange>::iterator range = std::lower_bound(
+        partitions_.begin(), partitions_.end(), partition, PartitionRangeLess());
+    if (range == partitions_.end() || range->partition() != partition) {
+        it->SetHasMore(false); //no record of this partition
+        return it;
+    }
+    data_end_ = range->end_offset();
+    stat_.blocks_skipped += range->first_block();
+    if (!fs_->Seek(range->offset())) {
+        LOG(WARNING, "fail to seek the partition %d at %ld", partition, range->offset());
+        it->SetHasMore(false);
+        it->SetError(kReadFileFail);
+    } else {
+        it->SetHasMore(true);
+    }
+    it->Init();
+    return it;
+}
+
 SortFileReader::Iterator* SortFileReaderImpl::Scan(const std::string& start_key, 
                                                    const std::string& end_key) {
+    StopReadAhead(); //it is going to move the file offset
     if (start_key > end_key && !end_key.empty()) {
         IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
         it->SetHasMore(false);
@@ -287,21 +949,37 @@ SortFileReader::Iterator* SortFileReaderImpl::Scan(const std::string& start_key,
         return it; 
     }
 
-    IndexBlock idx_block;
-    LOG(INFO, "try load index of: %s", path_.c_str());
-    Status status = LoadIndexBlock(&idx_block);
-    for(int i = 0; i < 3 && status != kOk; i++) {
-        idx_block.Clear();
-        status = LoadIndexBlock(&idx_block);
-        sleep(1);
-    }
-    if (status != kOk) {
-        LOG(WARNING, "faild to load index block, %s", path_.c_str());
+    if (LoadIndexOnce() != kOk) {
         IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
         it->SetHasMore(false);
         it->SetError(kReadFileFail);
         return it;
     }
+    data_end_ = idx_offset_;
+
+    //[key, key + "\0") holds nothing but key itself
+    bool is_point = end_key.size() == start_key.size() + 1
+                    && end_key[start_key.size()] == '\0'
+                    && end_key.compare(0, start_key.size(), start_key) == 0;
+    if (is_point && !filter_.empty() && !BloomFilterMayMatch(start_key, filter_)) {
+        stat_.filtered++;
+        IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
+        it->SetHasMore(false);
+        return it;
+    }
+
+    const IndexBlock* idx_partition = &idx_block_;
+    int64_t first_block = 0;
+    if (idx_block_.items_size() > 0) {
+        Status status = GetIndexPartition(start_key, &idx_partition, &first_block);
+        if (status != kOk) {
+            IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
+            it->SetHasMore(false);
+            it->SetError(kReadFileFail);
+            return it;
+        }
+    }
+    const IndexBlock& idx_block = *idx_partition;
 
     int low = 0;
     int high = idx_block.items_size() - 1;
@@ -323,16 +1001,11 @@ SortFileReader::Iterator* SortFileReaderImpl::Scan(const std::string& start_key,
     }
 
     const std::string& bound_key = idx_block.items(low).key();
-    int64_t offset;
-    if (bound_key < start_key) {
-        offset = idx_block.items(low).offset();
-    } else {
-        if (low > 0) {
-            offset = idx_block.items(low-1).offset();
-        } else {
-            offset = idx_block.items(0).offset();
-        }
+    if (bound_key >= start_key && low > 0) {
+        low--;
     }
+    int64_t offset = idx_block.items(low).offset();
+    stat_.blocks_skipped += first_block + low;
     IteratorImpl* it = new IteratorImpl(start_key, end_key, this);
     if (!fs_->Seek(offset)) {
         LOG(WARNING, "fail to seek the data block at %ld", offset);
@@ -345,69 +1018,405 @@ SortFileReader::Iterator* SortFileReaderImpl::Scan(const std::string& start_key,
     return it;
 }
 
+Status SortFileReaderImpl::GetIndexKeys(std::vector<std::string>* keys) {
+    StopReadAhead(); //loading the index moves the file offset
+    Status status = LoadIndexOnce();
+    if (status != kOk) {
+        return status;
+    }
+    for (int i = 0; i < idx_block_.items_size(); i++) {
+        keys->push_back(idx_block_.items(i).key());
+    }
+    return kOk;
+}
+
+void SortFileReaderImpl::GetStatistics(ReaderStatistics* stat) {
+    *stat = stat_;
+}
+
 Status SortFileReaderImpl::Close() {
-    LOG(INFO, "try close file: %s", path_.c_str());
+    StopReadAhead();
+    LOG(INFO, "try close file: %s, blocks decoded: %ld, skipped: %ld, stall: %ld us",
+        path_.c_str(), stat_.blocks_decoded, stat_.blocks_skipped, stat_.stall_micros);
     if (!fs_->Close()) {
         return kCloseFileFail;
     }
     return kOk;
 }
 
-SortFileWriterImpl::SortFileWriterImpl(FileSystem* fs) : cur_block_size_(0),
-                                                         fs_(fs) {
+SortFileWriterImpl::SortFileWriterImpl(FileSystem* fs) : version_(sSortFileV4),
+                                                         restart_interval_(sRestartInterval),
+                                                         compressor_(Compressor::Create(kSnappy)),
+                                                         filter_builder_(NULL),
+                                                         partitioned_(false),
+                                                         block_items_(0),
+                                                         cur_block_size_(0),
+                                                         fs_(fs),
+                                                         num_blocks_(0),
+                                                         appended_(false),
+                                                         compress_threads_(0),
+                                                         max_inflight_blocks_(sMaxInflightBlocks),
+                                                         compress_pool_(NULL),
+                                                         write_behind_status_(kOk),
+                                                         write_behind_stop_(false),
+                                                         write_behind_running_(false),
+                                                         block_done_(&mu_),
+                                                         not_full_(&mu_) {
+
+}
 
+SortFileWriterImpl::~SortFileWriterImpl() {
+    StopWriteBehind();
+    delete fs_;
+    delete compressor_;
+    delete filter_builder_;
 }
 
 Status SortFileWriterImpl::Open(const std::string& path, FileSystem::Param param) {
+    if (param.find("sort_file_version") != param.end()) {
+        //old readers only understand v1, keep it writable for upgrading
+        version_ = atoi(param["sort_file_version"].c_str());
+        if (version_ < sSortFileV1 || version_ > sSortFileV4) {
+            LOG(WARNING, "unknown sort file version: %d", version_);
+            return kInvalidArg;
+        }
+    }
+    if (param.find("restart_interval") != param.end()) {
+        restart_interval_ = atoi(param["restart_interval"].c_str());
+        if (restart_interval_ <= 0) {
+            LOG(WARNING, "invalid restart interval: %d", restart_interval_);
+            return kInvalidArg;
+        }
+    }
+    CompressionType compression = kSnappy;
+    if (param.find("compression") != param.end()
+        && !Compressor::ParseName(param["compression"], &compression)) {
+        LOG(WARNING, "unknown compression: %s", param["compression"].c_str());
+        return kInvalidArg;
+    }
+    if (version_ == sSortFileV1 && compression != kSnappy) {
+        LOG(WARNING, "v1 sort file can only be compressed by snappy");
+        return kInvalidArg;
+    }
+    delete compressor_;
+    compressor_ = Compressor::Create(compression);
+    if (param.find("bloom_bits_per_key") != param.end()) {
+        int bits_per_key = atoi(param["bloom_bits_per_key"].c_str());
+        if (bits_per_key < 0 || (bits_per_key > 0 && version_ == sSortFileV1)) {
+            LOG(WARNING, "invalid bloom bits per key: %d, version: %d", bits_per_key, version_);
+            return kInvalidArg;
+        }
+        delete filter_builder_;
+        filter_builder_ = bits_per_key > 0 ? new BloomFilterBuilder(bits_per_key) : NULL;
+    }
+    if (param.find("partitioned") != param.end()) {
+        partitioned_ = (param["partitioned"] == "true");
+        if (partitioned_ && version_ == sSortFileV1) {
+            LOG(WARNING, "v1 sort file has no partition directory");
+            return kInvalidArg;
+        }
+    }
+    if (param.find("compress_threads") != param.end()) {
+        compress_threads_ = atoi(param["compress_threads"].c_str());
+    }
+    if (param.find("max_inflight_blocks") != param.end()) {
+        max_inflight_blocks_ = atoi(param["max_inflight_blocks"].c_str());
+        if (max_inflight_blocks_ <= 0) {
+            LOG(WARNING, "invalid max inflight blocks: %d", max_inflight_blocks_);
+            return kInvalidArg;
+        }
+    }
     if (!fs_->Open(path, param, kWriteFile)) {
         return kOpenFileFail;
     }
     path_ = path;
+    if (compress_threads_ > 0) {
+        StartWriteBehind();
+    }
     return kOk;
 }
 
-Status SortFileWriterImpl::Put(const std::string& key, const std::string& value) {
+Status SortFileWriterImpl::Put(const Slice& key, const Slice& value) {
+    if (appended_) {
+        LOG(WARNING, "can not put to %s after appending files", path_.c_str());
+        return kInvalidArg;
+    }
     if (key < last_key_) {
         LOG(WARNING, "try to put a un-ordered key: %s \n last: %s",
-            key.c_str(), last_key_.c_str());
+            key.ToString().c_str(), last_key_.c_str());
         return kInvalidArg;
     }
+    if (partitioned_) {
+        if (key.size() < sPartitionPrefixSize) {
+            LOG(WARNING, "key without partition prefix: %s", key.ToString().c_str());
+            return kInvalidArg;
+        }
+        int32_t partition = DecodePartition(key.data());
+        if (partitions_.empty() || partitions_.back().partition() != partition) {
+            //a partition starts with a new block, so it can be read alone,
+            //its offsets are known after the blocks are written, see FlushIdxBlock
+            Status status = FlushCurBlock();
+            if (status != kOk) {
+                return status;
+            }
+            PartitionRange range;
+            range.set_partition(partition);
+            partitions_.push_back(range);
+            partition_blocks_.push_back(num_blocks_);
+        }
+    }
     if (cur_block_size_ >= sBlockSize) {
         Status status = FlushCurBlock();
         if (status != kOk) {
             return status;
         }
     }
-    KeyValue* item = cur_block_.add_items();
-    item->set_key(key);
-    item->set_value(value);
+    if (version_ == sSortFileV1) {
+        KeyValue* item = cur_block_.add_items();
+        item->set_key(key.data(), key.size());
+        item->set_value(value.data(), value.size());
+    } else {
+        AppendToBlock(key, value);
+    }
+    if (filter_builder_ != NULL && (filter_builder_->NumKeys() == 0 || key != last_key_)) {
+        filter_builder_->AddKey(key);
+    }
     cur_block_size_ += (key.size() + value.size());
-    last_key_ = key;
+    last_key_.assign(key.data(), key.size());
+    return kOk;
+}
+
+Status SortFileWriterImpl::Append(const std::string& path, FileSystem::Param param,
+                                  FileType file_type) {
+    if (version_ < sSortFileV4 || filter_builder_ != NULL) {
+        LOG(WARNING, "only v4 files without filter can be appended to, %s", path_.c_str());
+        return kInvalidArg;
+    }
+    if (!appended_ && (num_blocks_ > 0 || block_items_ > 0)) {
+        LOG(WARNING, "can not append to %s after putting records", path_.c_str());
+        return kInvalidArg;
+    }
+    //nothing is pending, blocks are copied by this thread from now on
+    Status status = StopWriteBehind();
+    if (status != kOk) {
+        return status;
+    }
+    appended_ = true;
+    SortFileReader* reader = SortFileReader::Create(file_type, &status);
+    if (status != kOk) {
+        return status;
+    }
+    status = reader->Open(path, param);
+    if (status == kOk) {
+        status = AppendBlocks(static_cast<SortFileReaderImpl*>(reader));
+        Status close_status = reader->Close();
+        if (status == kOk) {
+            status = close_status;
+        }
+    }
+    delete reader;
+    if (status != kOk) {
+        LOG(WARNING, "fail to append %s to %s, %s",
+            path.c_str(), path_.c_str(), Status_Name(status).c_str());
+    }
+    return status;
+}
+
+Status SortFileWriterImpl::AppendBlocks(SortFileReaderImpl* reader) {
+    IndexBlock idx_block;
+    Status status = reader->LoadBlockIndex(&idx_block);
+    if (status != kOk) {
+        return status;
+    }
+    if (reader->version_ < sSortFileV4 || reader->partitioned_ != partitioned_
+        || reader->compressor_->Type() != compressor_->Type()) {
+        LOG(WARNING, "unmatched file, version: %d, partitioned: %d, compression: %s",
+            reader->version_, reader->partitioned_,
+            Compressor::Name(reader->compressor_->Type()).c_str());
+        return kInvalidArg;
+    }
+    if (idx_block.items_size() == 0) {
+        return kOk;
+    }
+    //only the first key of each block is known here, so the order check is loose
+    if (idx_block.items(0).key() < last_key_) {
+        LOG(WARNING, "appended file starts before the last block: %s",
+            idx_block.items(0).key().c_str());
+        return kInvalidArg;
+    }
+    int64_t base = fs_->Tell();
+    if (base == -1) {
+        LOG(WARNING, "get offset fail");
+        return kWriteFileFail;
+    }
+    status = reader->CopyBlocks(fs_);
+    if (status != kOk) {
+        return status;
+    }
+    for (int i = 0; i < idx_block.items_size(); i++) {
+        KeyOffset* item = idx_block_.add_items();
+        item->CopyFrom(idx_block.items(i));
+        item->set_offset(item->offset() + base);
+    }
+    std::vector<PartitionRange>::const_iterator it;
+    for (it = reader->partitions_.begin(); it != reader->partitions_.end(); it++) {
+        if (!partitions_.empty() && partitions_.back().partition() == it->partition()) {
+            continue; //it goes on from the last file
+        }
+        int low = 0;
+        int high = idx_block.items_size() - 1;
+        while (low < high) {
+            int mid = low + (high - low) / 2;
+            if (idx_block.items(mid).offset() < it->offset()) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (idx_block.items(low).offset() != it->offset()) {
+            LOG(WARNING, "partition %d does not start with a block", it->partition());
+            return kUnKnown;
+        }
+        partitions_.push_back(*it);
+        partition_blocks_.push_back(num_blocks_ + low);
+    }
+    num_blocks_ += idx_block.items_size();
+    last_key_ = idx_block.items(idx_block.items_size() - 1).key();
     return kOk;
 }
 
+void SortFileWriterImpl::AppendToBlock(const Slice& key, const Slice& value) {
+    if (block_items_ == 0) {
+        first_key_.assign(key.data(), key.size());
+    }
+    if (version_ == sSortFileV2) {
+        //item: [varint key len][varint value len][key][value]
+        block_offsets_.push_back(block_buf_.size());
+        PutVarint32(&block_buf_, key.size());
+        PutVarint32(&block_buf_, value.size());
+        block_buf_.append(key.data(), key.size());
+    } else {
+        //item: [varint shared][varint non shared][varint value len][key delta][value]
+        //the key of a restart point is stored in full
+        size_t shared = 0;
+        if (block_items_ % restart_interval_ == 0) {
+            block_offsets_.push_back(block_buf_.size());
+        } else {
+            size_t min_len = std::min(last_key_.size(), key.size());
+            while (shared < min_len && last_key_[shared] == key[shared]) {
+                shared++;
+            }
+        }
+        PutVarint32(&block_buf_, shared);
+        PutVarint32(&block_buf_, key.size() - shared);
+        PutVarint32(&block_buf_, value.size());
+        block_buf_.append(key.data() + shared, key.size() - shared);
+    }
+    block_buf_.append(value.data(), value.size());
+    block_items_++;
+}
+
 Status SortFileWriterImpl::FlushIdxBlock() {
+    int64_t data_end = fs_->Tell();
+    if (data_end == -1) {
+        LOG(WARNING, "get offset fail");
+        return kWriteFileFail;
+    }
+    for (size_t i = 0; i < partitions_.size(); i++) {
+        assert(partition_blocks_[i] < idx_block_.items_size());
+        partitions_[i].set_offset(idx_block_.items(partition_blocks_[i]).offset());
+        partitions_[i].set_first_block(partition_blocks_[i]);
+        if (i > 0) {
+            partitions_[i - 1].set_end_offset(partitions_[i].offset());
+        }
+    }
+    if (!partitions_.empty()) {
+        partitions_.back().set_end_offset(data_end);
+    }
+    if (version_ >= sSortFileV4 && (idx_block_.items_size() > sMaxIndexSize
+                                    || (size_t)idx_block_.ByteSize() > sMaxIndexBytes)) {
+        return FlushTwoLevelIndex();
+    }
+    //only files of older versions are given a sparse index
     while (idx_block_.items_size() > sMaxIndexSize) {
         MakeIndexSparse();
     }
+    while ((size_t)idx_block_.ByteSize() > sMaxIndexBytes && idx_block_.items_size() > 1) {
+        LOG(WARNING, "index too large: %d, make it sparse.", idx_block_.ByteSize());
+        MakeIndexSparse();
+    }
+    int64_t offset;
+    Status status = WriteIndexBlock(idx_block_, &offset);
+    if (status != kOk) {
+        return status;
+    }
+    if (version_ != sSortFileV1) {
+        return FlushFooter(offset);
+    }
+    int32_t h_ret = fs_->Write((void*)&offset, sizeof(int64_t));
+    if (h_ret != sizeof(int64_t)) {
+        LOG(WARNING, "write start-offset of index fail");
+        return kWriteFileFail;
+    }
+    h_ret = fs_->Write((void*)&sMagicNumber, sizeof(int32_t));
+    if (h_ret != sizeof(int32_t) ) {
+        LOG(WARNING, "write magic number fail");
+        return kWriteFileFail;
+    }  
+    return kOk;
+}
+
+Status SortFileWriterImpl::FlushTwoLevelIndex() {
+    //index partitions keep an item for every block, the top level index
+    //is small enough to be loaded on open, see SortFileReaderImpl::GetIndexPartition
+    IndexBlock top_index;
+    IndexBlock partition;
+    size_t partition_bytes = 0;
+    for (int i = 0; i < idx_block_.items_size(); i++) {
+        const KeyOffset& item = idx_block_.items(i);
+        partition.add_items()->CopyFrom(item);
+        partition_bytes += item.key().size() + sizeof(int64_t);
+        if (partition.items_size() < sIndexPartitionSize
+            && partition_bytes < sIndexPartitionBytes
+            && i + 1 < idx_block_.items_size()) {
+            continue;
+        }
+        int64_t offset;
+        Status status = WriteIndexBlock(partition, &offset);
+        if (status != kOk) {
+            return status;
+        }
+        KeyOffset* top_item = top_index.add_items();
+        top_item->set_key(partition.items(0).key());
+        top_item->set_offset(offset);
+        top_item->set_first_block(i + 1 - partition.items_size());
+        partition.Clear();
+        partition_bytes = 0;
+    }
+    LOG(INFO, "write %d index items in %d partitions, %s",
+        idx_block_.items_size(), top_index.items_size(), path_.c_str());
+    int64_t offset;
+    Status status = WriteIndexBlock(top_index, &offset);
+    if (status != kOk) {
+        return status;
+    }
+    version_ = sSortFileV5;
+    return FlushFooter(offset);
+}
+
+Status SortFileWriterImpl::WriteIndexBlock(const IndexBlock& idx_block, int64_t* offset) {
     std::string raw_buf, tmp_buf;
-    bool ret = idx_block_.SerializeToString(&tmp_buf);
+    bool ret = idx_block.SerializeToString(&tmp_buf);
     if (!ret) {
         LOG(WARNING, "serialize index fail");
         return kUnKnown;
     }
-    while (tmp_buf.size() > sMaxIndexBytes) {
-        LOG(WARNING, "index too large: %ld, make it sparse.", tmp_buf.size());
-        MakeIndexSparse();
-        ret = idx_block_.SerializeToString(&tmp_buf);
-        if (!ret) {
-            LOG(WARNING, "serialize index fail");
-            return kUnKnown;
-        }
+    if (!compressor_->Compress(tmp_buf.data(), tmp_buf.size(), &raw_buf)) {
+        LOG(WARNING, "compress index fail");
+        return kUnKnown;
     }
-    snappy::Compress(tmp_buf.data(), tmp_buf.size(), &raw_buf);
-    int64_t offset = fs_->Tell();
-    if (offset == -1) {
+    *offset = fs_->Tell();
+    if (*offset == -1) {
         LOG(WARNING, "get offset fail");
         return kWriteFileFail;
     }
@@ -422,16 +1431,56 @@ Status SortFileWriterImpl::FlushIdxBlock() {
         LOG(WARNING, "wirte index block fail");
         return kWriteFileFail;
     }
-    h_ret = fs_->Write((void*)&offset, sizeof(int64_t));
-    if (h_ret != sizeof(int64_t)) {
-        LOG(WARNING, "write start-offset of index fail");
+    return kOk;
+}
+
+Status SortFileWriterImpl::FlushFooter(int64_t index_offset) {
+    FileFooter footer;
+    footer.set_version(version_);
+    footer.set_index_offset(index_offset);
+    footer.set_compression(compressor_->Type());
+    footer.set_partitioned(partitioned_);
+    std::vector<PartitionRange>::iterator it;
+    for (it = partitions_.begin(); it != partitions_.end(); it++) {
+        footer.add_partitions()->CopyFrom(*it);
+    }
+    if (filter_builder_ != NULL) {
+        std::string filter;
+        filter_builder_->Finish(&filter);
+        int64_t filter_offset = fs_->Tell();
+        if (filter_offset == -1) {
+            LOG(WARNING, "get offset fail");
+            return kWriteFileFail;
+        }
+        int32_t h_ret = fs_->Write((void*)filter.data(), filter.size());
+        if (h_ret != (int32_t)filter.size()) {
+            LOG(WARNING, "write filter fail");
+            return kWriteFileFail;
+        }
+        footer.set_filter_offset(filter_offset);
+        footer.set_filter_size(filter.size());
+    }
+    std::string footer_buf;
+    if (!footer.SerializeToString(&footer_buf)) {
+        LOG(WARNING, "serialize footer fail");
+        return kUnKnown;
+    }
+    int32_t footer_size = footer_buf.size();
+    int32_t h_ret = fs_->Write((void*)footer_buf.data(), footer_buf.size());
+    if (h_ret != footer_size) {
+        LOG(WARNING, "write footer fail");
         return kWriteFileFail;
     }
-    h_ret = fs_->Write((void*)&sMagicNumber, sizeof(int32_t));
-    if (h_ret != sizeof(int32_t) ) {
+    h_ret = fs_->Write((void*)&footer_size, sizeof(int32_t));
+    if (h_ret != sizeof(int32_t)) {
+        LOG(WARNING, "write footer size fail");
+        return kWriteFileFail;
+    }
+    h_ret = fs_->Write((void*)&sMagicNumberV2, sizeof(int32_t));
+    if (h_ret != sizeof(int32_t)) {
         LOG(WARNING, "write magic number fail");
         return kWriteFileFail;
-    }  
+    }
     return kOk;
 }
 
@@ -446,17 +1495,80 @@ void SortFileWriterImpl::MakeIndexSparse() {
 }
 
 Status SortFileWriterImpl::FlushCurBlock() {
-    if (cur_block_.items_size() == 0) {
-        return kOk;
+    PendingBlock* block = new PendingBlock();
+    if (version_ == sSortFileV1) {
+        if (cur_block_.items_size() == 0) {
+            delete block;
+            return kOk;
+        }
+        block->first_key = cur_block_.items(0).key();
+        block->items.Swap(&cur_block_);
+    } else {
+        if (block_items_ == 0) {
+            delete block;
+            return kOk;
+        }
+        std::vector<uint32_t>::iterator it;
+        for (it = block_offsets_.begin(); it != block_offsets_.end(); it++) {
+            PutFixed32(&block_buf_, *it);
+        }
+        PutFixed32(&block_buf_, block_offsets_.size());
+        block->first_key = first_key_;
+        block->raw.swap(block_buf_);
     }
-    std::string raw_buf, compressed_buf;
-    bool ret = cur_block_.SerializeToString(&raw_buf);
-    if (!ret) {
-        LOG(WARNING, "serialize data block fail");
-        return kUnKnown;
+    cur_block_.Clear();
+    block_buf_.clear();
+    block_offsets_.clear();
+    block_items_ = 0;
+    cur_block_size_ = 0;
+    num_blocks_++;
+    if (compress_pool_ == NULL) {
+        CompressBlock(block);
+        Status status = block->status;
+        if (status == kOk) {
+            status = WriteBlock(*block);
+        }
+        delete block;
+        return status;
+    }
+    MutexLock lock(&mu_);
+    while ((int32_t)pending_blocks_.size() >= max_inflight_blocks_
+           && write_behind_status_ == kOk) {
+        not_full_.Wait();
+    }
+    if (write_behind_status_ != kOk) {
+        delete block;
+        return write_behind_status_;
+    }
+    pending_blocks_.push_back(block);
+    compress_pool_->AddTask(boost::bind(&SortFileWriterImpl::CompressTask, this, block));
+    return kOk;
+}
+
+void SortFileWriterImpl::CompressBlock(PendingBlock* block) {
+    if (version_ == sSortFileV1) {
+        if (!block->items.SerializeToString(&block->raw)) {
+            LOG(WARNING, "serialize data block fail");
+            block->status = kUnKnown;
+            return;
+        }
     }
-    snappy::Compress(raw_buf.data(), raw_buf.size(), &compressed_buf);
-    int32_t block_size = compressed_buf.size();
+    if (!compressor_->Compress(block->raw.data(), block->raw.size(), &block->compressed)) {
+        LOG(WARNING, "compress data block fail");
+        block->status = kUnKnown;
+    }
+    std::string().swap(block->raw);
+}
+
+void SortFileWriterImpl::CompressTask(PendingBlock* block) {
+    CompressBlock(block);
+    MutexLock lock(&mu_);
+    block->done = true;
+    block_done_.Broadcast();
+}
+
+Status SortFileWriterImpl::WriteBlock(const PendingBlock& block) {
+    int32_t block_size = block.compressed.size();
     int64_t offset = fs_->Tell();
     if (offset == -1) {
         LOG(WARNING, "get cur offset fail");
@@ -468,26 +1580,98 @@ Status SortFileWriterImpl::FlushCurBlock() {
         LOG(WARNING, "write block size fail");
         return kWriteFileFail;
     }
-    h_ret = fs_->Write((void*)compressed_buf.data(), compressed_buf.size());
-    if (h_ret != (int32_t)compressed_buf.size() ) {
+    if (version_ >= sSortFileV4) {
+        int32_t key_size = block.first_key.size();
+        h_ret = fs_->Write((void*)&key_size, sizeof(int32_t));
+        if (h_ret != sizeof(int32_t) ) {
+            LOG(WARNING, "write key size of block fail");
+            return kWriteFileFail;
+        }
+        h_ret = fs_->Write((void*)block.first_key.data(), block.first_key.size());
+        if (h_ret != key_size) {
+            LOG(WARNING, "write first key of block fail");
+            return kWriteFileFail;
+        }
+    }
+    h_ret = fs_->Write((void*)block.compressed.data(), block.compressed.size());
+    if (h_ret != (int32_t)block.compressed.size() ) {
         LOG(WARNING, "write data block fail");
         return kWriteFileFail;
     }
 
     KeyOffset* item = idx_block_.add_items();
-    item->set_key(cur_block_.items(0).key());
+    item->set_key(block.first_key);
     item->set_offset(offset);
-
-    cur_block_.Clear();
-    cur_block_size_ = 0;
     return kOk;
 }
 
+void SortFileWriterImpl::StartWriteBehind() {
+    //blocks are compressed by the pool in any order, and written
+    //in order by the write-behind thread, which owns fs_ and idx_block_
+    compress_pool_ = new ThreadPool(compress_threads_);
+    write_behind_status_ = kOk;
+    write_behind_stop_ = false;
+    write_behind_running_ = true;
+    write_behind_thread_.Start(boost::bind(&SortFileWriterImpl::WriteBehindLoop, this));
+}
+
+Status SortFileWriterImpl::StopWriteBehind() {
+    if (!write_behind_running_) {
+        return kOk;
+    }
+    {
+        MutexLock lock(&mu_);
+        write_behind_stop_ = true;
+        block_done_.Broadcast();
+    }
+    write_behind_thread_.Join();
+    write_behind_running_ = false;
+    delete compress_pool_;
+    compress_pool_ = NULL;
+    return write_behind_status_;
+}
+
+void SortFileWriterImpl::WriteBehindLoop() {
+    while (true) {
+        PendingBlock* block = NULL;
+        Status status = kOk;
+        {
+            MutexLock lock(&mu_);
+            while ((pending_blocks_.empty() || !pending_blocks_.front()->done)
+                   && !(write_behind_stop_ && pending_blocks_.empty())) {
+                block_done_.Wait();
+            }
+            if (pending_blocks_.empty()) {
+                return; //stopped and drained
+            }
+            block = pending_blocks_.front();
+            status = write_behind_status_;
+        }
+        if (status == kOk) {
+            status = block->status;
+        }
+        if (status == kOk) {
+            status = WriteBlock(*block);
+        }
+        MutexLock lock(&mu_);
+        pending_blocks_.pop_front();
+        delete block;
+        if (status != kOk) {
+            write_behind_status_ = status;
+        }
+        not_full_.Signal();
+    }
+}
+
 Status SortFileWriterImpl::Close() {
     Status status = FlushCurBlock();
+    Status wb_status = StopWriteBehind();
     if (status != kOk) {
         return status;
     }
+    if (wb_status != kOk) {
+        return wb_status;
+    }
     status = FlushIdxBlock();
     if (status != kOk) {
         return status;
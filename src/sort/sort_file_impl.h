@@ -1,12 +1,29 @@
 #ifndef _BAIDU_SHUTTLE_SORT_FILE_IMPL_H_
 #define _BAIDU_SHUTTLE_SORT_FILE_IMPL_H_
 
+#include <deque>
 #include "sort_file.h"
+#include "thread.h"
+#include "thread_pool.h"
 #include "common/filesystem.h"
+#include "common/compressor.h"
+#include "common/bloom_filter.h"
 
 namespace baidu {
 namespace shuttle {
 
+// v1: data blocks are serialized DataBlock messages
+// v2: data blocks are flat buffers, see SortFileWriterImpl::AppendToBlock
+// v3: same as v2 but keys are prefix compressed between restart points
+// v4: same as v3 but every block is headed by its first key uncompressed
+// v5: same as v4 but the index is split into partitions, written by v4
+//     writers when the index is too large to be read at once
+const static int32_t sSortFileV1 = 1;
+const static int32_t sSortFileV2 = 2;
+const static int32_t sSortFileV3 = 3;
+const static int32_t sSortFileV4 = 4;
+const static int32_t sSortFileV5 = 5;
+
 class SortFileReaderImpl : public SortFileReader {
 public:
     class IteratorImpl : public Iterator {
@@ -17,58 +34,164 @@ public:
         virtual ~IteratorImpl();
         virtual bool Done();
         virtual void Next();
-        virtual const std::string& Key();
-        virtual const std::string& Value();
+        virtual Slice Key();
+        virtual Slice Value();
         virtual Status Error();
         void SetError(Status status);
         void SetHasMore(bool has_more);
+        void SetKeyPrefixSize(size_t size);
         virtual void Init();
         const std::string GetFileName();
     private:
+        Status LoadBlock();
+        bool ParseItem(int offset, Slice* key, Slice* value);
+        bool ParseEntry(uint32_t pos, bool is_restart);
+        bool NextInBlock();
+        bool SeekInBlock(const Slice& target);
         SortFileReaderImpl* reader_;
         bool has_more_;
         Status error_;
         DataBlock cur_block_;
+        std::string block_buf_;
+        const char* block_offsets_; //offsets of items(v2) or restart points(v3)
+        int block_items_;
         int cur_offset_;
-        std::string key_;
-        std::string value_;
+        size_t key_prefix_size_; //stripped from the keys returned
+        uint32_t next_pos_;
+        std::string key_buf_;
+        Slice key_;
+        Slice value_;
         std::string start_key_;
         std::string end_key_;
     }; //class IteratorImpl
 
-    SortFileReaderImpl(FileSystem* fs) {fs_ = fs;} ;
-    virtual ~SortFileReaderImpl(){ delete fs_; };
+    SortFileReaderImpl(FileSystem* fs);
+    virtual ~SortFileReaderImpl();
     virtual Status Open(const std::string& path, FileSystem::Param param);
     virtual Iterator* Scan(const std::string& start_key, const std::string& end_key);
+    virtual Iterator* ScanPartition(int32_t partition);
+    virtual Status GetIndexKeys(std::vector<std::string>* keys);
     virtual Status Close();
     std::string GetFileName() {return path_;}
+    void GetStatistics(ReaderStatistics* stat);
 private:
+    friend class SortFileWriterImpl; //appends the blocks of this file
+    Status LoadIndexOnce();
+    Status LoadBlockIndex(IndexBlock* idx_block);
+    Status CopyBlocks(FileSystem* dst);
     Status LoadIndexBlock(IndexBlock* idx_block);
+    Status ReadIndexBlock(int64_t offset, IndexBlock* idx_block);
+    Status GetIndexPartition(const std::string& start_key, const IndexBlock** idx_block,
+                             int64_t* first_block);
+    void ClearIndexPartitions();
+    Status LoadFilter();
+    Status ReadBlockHeader(int32_t* block_size, std::string* first_key);
+    Status LoadFooter(int64_t* index_offset);
     Status ReadFull(std::string* result_buf, int32_t len, bool is_read_data = false);
-    Status ReadNextRecord(DataBlock& data_block);
+    Status ReadNextRecord(std::string* block_buf);
+    Status NextBlock(std::string* block_buf);
+    void StartReadAhead();
+    void StopReadAhead();
+    void ReadAheadLoop();
 private:
+    struct ReadAheadItem {
+        Status status;
+        std::string block;
+    };
     std::string path_;
     int64_t idx_offset_;
+    int32_t version_;
+    Compressor* compressor_;
     FileSystem* fs_;
+    ReaderStatistics stat_;
+    //index and filter are loaded by the first scan and kept for the later ones
+    IndexBlock idx_block_; //the top level index for v5
+    bool idx_loaded_;
+    std::map<int64_t, IndexBlock*> idx_partitions_; //v5 index partitions by offset
+    std::deque<int64_t> idx_partition_fifo_;
+    int64_t filter_offset_;
+    int32_t filter_size_;
+    std::string filter_;
+    bool partitioned_;
+    std::vector<PartitionRange> partitions_;
+    int64_t data_end_; //where the blocks of current scan end
+    //blocks fetched and decompressed in the background, 0 blocks disables it
+    int32_t read_ahead_blocks_;
+    int64_t read_ahead_bytes_;
+    bool read_ahead_running_;
+    bool read_ahead_stop_;
+    std::deque<ReadAheadItem*> read_ahead_queue_;
+    int64_t read_ahead_queued_bytes_;
+    common::Thread read_ahead_thread_;
+    Mutex mu_;
+    CondVar not_empty_;
+    CondVar not_full_;
 };
 
 class SortFileWriterImpl : public SortFileWriter {
 public:
     SortFileWriterImpl(FileSystem* fs);
-    virtual ~SortFileWriterImpl(){delete fs_; };
+    virtual ~SortFileWriterImpl();
     virtual Status Open(const std::string& path, FileSystem::Param param);
-    virtual Status Put(const std::string& key, const std::string& value);
+    virtual Status Put(const Slice& key, const Slice& value);
+    virtual Status Append(const std::string& path, FileSystem::Param param,
+                          FileType file_type);
     virtual Status Close();
 private:
+    // a sealed data block on its way to the file
+    struct PendingBlock {
+        std::string first_key;
+        DataBlock items; //v1 only
+        std::string raw;
+        std::string compressed;
+        bool done;
+        Status status;
+        PendingBlock() : done(false), status(kOk) { }
+    };
+    Status AppendBlocks(SortFileReaderImpl* reader);
+    void AppendToBlock(const Slice& key, const Slice& value);
     Status FlushCurBlock();
+    void CompressBlock(PendingBlock* block);
+    void CompressTask(PendingBlock* block);
+    Status WriteBlock(const PendingBlock& block);
+    void StartWriteBehind();
+    Status StopWriteBehind();
+    void WriteBehindLoop();
     Status FlushIdxBlock();
+    Status FlushTwoLevelIndex();
+    Status WriteIndexBlock(const IndexBlock& idx_block, int64_t* offset);
+    Status FlushFooter(int64_t index_offset);
     void MakeIndexSparse();
+    int32_t version_;
+    int32_t restart_interval_;
+    Compressor* compressor_;
+    BloomFilterBuilder* filter_builder_;
+    bool partitioned_;
+    std::vector<PartitionRange> partitions_;
     DataBlock cur_block_;
+    std::string block_buf_;
+    std::vector<uint32_t> block_offsets_;
+    int32_t block_items_;
+    std::string first_key_;
     IndexBlock idx_block_;
     int32_t cur_block_size_;
     std::string last_key_;
     FileSystem* fs_;
     std::string path_;
+    int32_t num_blocks_;
+    std::vector<int32_t> partition_blocks_; //first block of each partition
+    bool appended_;
+    int32_t compress_threads_;
+    int32_t max_inflight_blocks_;
+    ThreadPool* compress_pool_;
+    std::deque<PendingBlock*> pending_blocks_;
+    Status write_behind_status_;
+    bool write_behind_stop_;
+    bool write_behind_running_;
+    common::Thread write_behind_thread_;
+    Mutex mu_;
+    CondVar block_done_;
+    CondVar not_full_;
 };
 
 } //namespace shuttle
@@ -0,0 +1,85 @@
+#include "spill_buffer.h"
+#include <algorithm>
+#include <boost/scoped_ptr.hpp>
+#include "logging.h"
+
+namespace baidu {
+namespace shuttle {
+
+class SpillBuffer::RecordLess {
+public:
+    explicit RecordLess(const std::string& data) : data_(data) { }
+    bool operator()(const Record& a, const Record& b) const {
+        return Slice(data_.data() + a.offset, a.key_size)
+               < Slice(data_.data() + b.offset, b.key_size);
+    }
+private:
+    const std::string& data_;
+};
+
+SpillBuffer::SpillBuffer(int64_t limit, FileType file_type,
+                         const FileSystem::Param& param) :
+                         limit_(limit), file_type_(file_type), param_(param) {
+
+}
+
+Status SpillBuffer::Put(const Slice& key, const Slice& value) {
+    Record record;
+    record.offset = data_.size();
+    record.key_size = key.size();
+    record.value_size = value.size();
+    data_.append(key.data(), key.size());
+    data_.append(value.data(), value.size());
+    records_.push_back(record);
+    return kOk;
+}
+
+int64_t SpillBuffer::Bytes() const {
+    return data_.size() + records_.size() * sizeof(Record);
+}
+
+bool SpillBuffer::Full() const {
+    return Bytes() >= limit_;
+}
+
+bool SpillBuffer::Empty() const {
+    return records_.empty();
+}
+
+void SpillBuffer::Reset() {
+    std::string().swap(data_);
+    std::vector<Record>().swap(records_);
+}
+
+Status SpillBuffer::Spill(const std::string& file_name) {
+    std::stable_sort(records_.begin(), records_.end(), RecordLess(data_));
+    Status status = kOk;
+    SortFileWriter* writer = SortFileWriter::Create(file_type_, &status);
+    boost::scoped_ptr<SortFileWriter> writer_guard(writer);
+    if (status == kOk) {
+        status = writer->Open(file_name, param_);
+    }
+    if (status != kOk) {
+        LOG(WARNING, "fail to open %s for write", file_name.c_str());
+        Reset();
+        return status;
+    }
+    std::vector<Record>::iterator it;
+    for (it = records_.begin(); it != records_.end() && status == kOk; it++) {
+        const char* key = data_.data() + it->offset;
+        status = writer->Put(Slice(key, it->key_size),
+                             Slice(key + it->key_size, it->value_size));
+    }
+    Status close_status = writer->Close();
+    if (status == kOk) {
+        status = close_status;
+    }
+    if (status != kOk) {
+        LOG(WARNING, "fail to spill %d records to %s", records_.size(), file_name.c_str());
+    }
+    Reset();
+    return status;
+}
+
+}
+}
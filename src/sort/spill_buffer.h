@@ -0,0 +1,44 @@
+#ifndef _BAIDU_SHUTTLE_SORT_SPILL_BUFFER_H_
+#define _BAIDU_SHUTTLE_SORT_SPILL_BUFFER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sort_file.h"
+
+namespace baidu {
+namespace shuttle {
+
+// records fetched in any order are kept in memory, then sorted and
+// written to a sort file when the buffer is spilled.
+// records of the same key keep the order they were put in
+class SpillBuffer {
+public:
+    SpillBuffer(int64_t limit, FileType file_type, const FileSystem::Param& param);
+    Status Put(const Slice& key, const Slice& value);
+    // the records and their index take at least limit bytes
+    bool Full() const;
+    bool Empty() const;
+    int64_t Bytes() const;
+    // the buffer is empty afterwards, even if the spill fails
+    Status Spill(const std::string& file_name);
+private:
+    struct Record {
+        size_t offset;
+        uint32_t key_size;
+        uint32_t value_size;
+    };
+    class RecordLess;
+    void Reset();
+private:
+    int64_t limit_;
+    FileType file_type_;
+    FileSystem::Param param_;
+    //keys and values of the records back to back
+    std::string data_;
+    std::vector<Record> records_;
+};
+
+}
+}
+#endif
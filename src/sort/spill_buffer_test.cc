@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include "spill_buffer.h"
+
+using namespace baidu::shuttle;
+
+std::string g_work_dir = "/tmp";
+
+TEST(SpillBuffer, SortOnSpill) {
+    FileSystem::Param param;
+    SpillBuffer buffer(1 << 20, kLocalFile, param);
+    EXPECT_TRUE(buffer.Empty());
+    char key[256];
+    char value[256];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key_%05d", (i * 7) % 500);
+        snprintf(value, sizeof(value), "value_%d", i);
+        EXPECT_EQ(buffer.Put(key, value), kOk);
+    }
+    EXPECT_FALSE(buffer.Full());
+    std::string file_name = g_work_dir + "/spill_buffer_test.sort";
+    EXPECT_EQ(buffer.Spill(file_name), kOk);
+    EXPECT_TRUE(buffer.Empty());
+
+    Status status;
+    SortFileReader* reader = SortFileReader::Create(kLocalFile, &status);
+    boost::scoped_ptr<SortFileReader> reader_guard(reader);
+    ASSERT_EQ(reader->Open(file_name, param), kOk);
+    SortFileReader::Iterator* it = reader->Scan("", "");
+    boost::scoped_ptr<SortFileReader::Iterator> it_guard(it);
+    std::string last_key;
+    int last_no = -1;
+    int n = 0;
+    for (; !it->Done(); it->Next()) {
+        std::string cur_key = it->Key().ToString();
+        int no = atoi(it->Value().ToString().c_str() + 6);
+        EXPECT_LE(last_key, cur_key);
+        if (cur_key == last_key) {
+            EXPECT_LT(last_no, no); //in the order put
+        }
+        last_key = cur_key;
+        last_no = no;
+        n++;
+    }
+    EXPECT_EQ(n, 1000);
+    reader->Close();
+    remove(file_name.c_str());
+}
+
+TEST(SpillBuffer, Full) {
+    FileSystem::Param param;
+    SpillBuffer buffer(100, kLocalFile, param);
+    EXPECT_EQ(buffer.Put("key", std::string(50, 'v')), kOk);
+    EXPECT_FALSE(buffer.Full());
+    EXPECT_EQ(buffer.Put("key", std::string(50, 'v')), kOk);
+    EXPECT_TRUE(buffer.Full());
+    EXPECT_EQ(buffer.Spill("/nonexistent_dir/spill_buffer_test.sort"), kOpenFileFail);
+    EXPECT_TRUE(buffer.Empty());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        g_work_dir = argv[1];
+    }
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}